@@ -0,0 +1,237 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "BRRFileScanner.h"
+#include "SPCSampDir.h"
+
+BRRFileScanner::BRRFileScanner() :
+	num_threads(0),
+	chunk_size(0x100000),
+	map_base(NULL),
+	map_size(0),
+	num_chunks(0),
+	next_scan_index(0),
+	next_deliver_index(0),
+	stopping(false)
+{
+}
+
+BRRFileScanner::~BRRFileScanner()
+{
+	Close();
+}
+
+bool BRRFileScanner::Open(const std::string & filename)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		m_message = "Unable to open";
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || (ULONGLONG)file_size.QuadPart > (SIZE_MAX >> 1)) {
+		CloseHandle(file);
+		m_message = "File too large";
+		return false;
+	}
+	if (file_size.QuadPart == 0) {
+		CloseHandle(file);
+		m_message = "File is empty";
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		m_message = "Unable to map the file";
+		return false;
+	}
+
+	void * base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (base == NULL) {
+		m_message = "Unable to map the file";
+		return false;
+	}
+	map_size = (size_t)file_size.QuadPart;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) {
+		m_message = "Unable to open";
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		m_message = "Not a regular file";
+		return false;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		m_message = "File is empty";
+		return false;
+	}
+
+	void * base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		m_message = "Unable to map the file";
+		return false;
+	}
+	map_size = (size_t)st.st_size;
+#endif
+
+	map_base = (const uint8_t *)base;
+
+	m_message.clear();
+	return true;
+}
+
+void BRRFileScanner::Close(void)
+{
+	Stop();
+	Unmap();
+}
+
+void BRRFileScanner::Start(void)
+{
+	Stop();
+
+	int num_workers = num_threads;
+	if (num_workers <= 0) {
+		num_workers = (int)std::thread::hardware_concurrency();
+		if (num_workers <= 0) {
+			num_workers = 1;
+		}
+	}
+
+	if (chunk_size == 0) {
+		chunk_size = 0x100000;
+	}
+	num_chunks = (map_size + chunk_size - 1) / chunk_size;
+
+	// a couple of chunks per worker keeps every thread busy while the caller consumes
+	slots.resize((size_t)num_workers * 2);
+	for (auto itr = slots.begin(); itr != slots.end(); ++itr) {
+		itr->done = false;
+	}
+
+	next_scan_index = 0;
+	next_deliver_index = 0;
+	stopping = false;
+	for (int i = 0; i < num_workers; i++) {
+		workers.push_back(std::thread(&BRRFileScanner::WorkerMain, this));
+	}
+}
+
+bool BRRFileScanner::Next(std::vector<BRRScanner::Chain> & chains)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (workers.empty() || next_deliver_index >= num_chunks) {
+		return false;
+	}
+
+	Slot & slot = slots[next_deliver_index % slots.size()];
+	slot_ready.wait(lock, [&slot] { return slot.done; });
+
+	// the caller's previous buffer goes back to the slot for reuse
+	chains.swap(slot.chains);
+	slot.done = false;
+	next_deliver_index++;
+
+	lock.unlock();
+	slot_free.notify_all();
+	return true;
+}
+
+void BRRFileScanner::Stop(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	slot_free.notify_all();
+
+	for (auto itr = workers.begin(); itr != workers.end(); ++itr) {
+		itr->join();
+	}
+	workers.clear();
+	slots.clear();
+}
+
+void BRRFileScanner::ScanChunk(size_t index, std::vector<BRRScanner::Chain> & chains) const
+{
+	chains.clear();
+
+	// chunk [chunk_start, chunk_end) reports the chains whose end block
+	// starts in it, and sees far enough back for the longest of them
+	size_t chunk_start = index * chunk_size;
+	size_t chunk_end = (map_size - chunk_start > chunk_size) ? chunk_start + chunk_size : map_size;
+	size_t max_size = scanner.GetMaxSize();
+	size_t slice_start = (chunk_start > max_size) ? chunk_start - max_size : 0;
+	size_t slice_end = (map_size - chunk_end > SPCSampDir::BRR_CHUNK_SIZE - 1) ? chunk_end + SPCSampDir::BRR_CHUNK_SIZE - 1 : map_size;
+
+	scanner.Scan(&map_base[slice_start], slice_end - slice_start, chains, chunk_start - slice_start);
+	for (auto itr = chains.begin(); itr != chains.end(); ++itr) {
+		itr->start += slice_start;
+		itr->end += slice_start;
+	}
+}
+
+void BRRFileScanner::WorkerMain(void)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		slot_free.wait(lock, [this] {
+			return stopping || next_scan_index >= num_chunks ||
+				next_scan_index < next_deliver_index + slots.size();
+		});
+		if (stopping || next_scan_index >= num_chunks) {
+			break;
+		}
+
+		size_t index = next_scan_index++;
+		Slot & slot = slots[index % slots.size()];
+		lock.unlock();
+
+		ScanChunk(index, slot.chains);
+
+		lock.lock();
+		slot.done = true;
+		slot_ready.notify_all();
+	}
+}
+
+void BRRFileScanner::Unmap(void)
+{
+	if (map_base != NULL) {
+#ifdef _WIN32
+		UnmapViewOfFile(map_base);
+#else
+		munmap((void *)map_base, map_size);
+#endif
+		map_base = NULL;
+		map_size = 0;
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef BRRFILESCANNER_H_INCLUDED
+#define BRRFILESCANNER_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "BRRScanner.h"
+
+// Scans a file of any size (a ROM image, a data blob) for BRR chains from
+// a read-only mapping. Start() splits the file into chunks that overlap by
+// the scanner's maximum chain size and scans them on a pool of worker
+// threads; Next() hands out the chains of each chunk in file order, so a
+// chain is reported once, by the chunk holding its end block.
+class BRRFileScanner
+{
+public:
+	BRRFileScanner();
+	virtual ~BRRFileScanner();
+
+	inline int GetNumThreads(void) const {
+		return num_threads;
+	}
+
+	// 0 uses every core
+	inline void SetNumThreads(int num_threads) {
+		this->num_threads = num_threads;
+	}
+
+	inline size_t GetChunkSize(void) const {
+		return chunk_size;
+	}
+
+	inline void SetChunkSize(size_t chunk_size) {
+		this->chunk_size = chunk_size;
+	}
+
+	// settings must not change between Start() and Stop()
+	inline BRRScanner & GetScanner(void) {
+		return scanner;
+	}
+
+	inline const uint8_t * GetData(void) const {
+		return map_base;
+	}
+
+	inline size_t GetSize(void) const {
+		return map_size;
+	}
+
+	inline const std::string & message(void) const {
+		return m_message;
+	}
+
+	bool Open(const std::string & filename);
+	void Close(void);
+
+	// Next() returns false after the last chunk; chain offsets are file offsets.
+	void Start(void);
+	bool Next(std::vector<BRRScanner::Chain> & chains);
+	void Stop(void);
+
+protected:
+	int num_threads;
+	size_t chunk_size;
+	BRRScanner scanner;
+
+	std::string m_message;
+
+private:
+	BRRFileScanner(const BRRFileScanner &);
+	BRRFileScanner & operator=(const BRRFileScanner &);
+
+	struct Slot {
+		std::vector<BRRScanner::Chain> chains;
+		bool done;
+	};
+
+	void ScanChunk(size_t index, std::vector<BRRScanner::Chain> & chains) const;
+	void WorkerMain(void);
+	void Unmap(void);
+
+	const uint8_t * map_base;
+	size_t map_size;
+	size_t num_chunks;
+
+	std::vector<std::thread> workers;
+	std::vector<Slot> slots;
+	std::mutex mutex;
+	std::condition_variable slot_ready;
+	std::condition_variable slot_free;
+	size_t next_scan_index;
+	size_t next_deliver_index;
+	bool stopping;
+};
+
+#endif /* !BRRFILESCANNER_H_INCLUDED */
@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "BRRScanner.h"
+#include "SPCSampDir.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline int count_trailing_zeros(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#elif defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	int n = 0;
+	while ((x & 1) == 0) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+BRRScanner::BRRScanner() :
+	min_blocks(8),
+	min_score(70),
+	max_size(0x10000)
+{
+}
+
+BRRScanner::~BRRScanner()
+{
+}
+
+void BRRScanner::Scan(const uint8_t * data, size_t size, std::vector<Chain> & chains, size_t report_from, const uint64_t * excluded) const
+{
+	const size_t block_size = SPCSampDir::BRR_CHUNK_SIZE;
+	if (size < block_size) {
+		return;
+	}
+
+	size_t num_words = (size + 63) / 64;
+	std::vector<uint64_t> end_bits(num_words);
+	std::vector<uint64_t> range_bits(num_words);
+	SPCSampDir::scan_brr_headers(data, size, &end_bits[0], &range_bits[0]);
+
+	// Every byte heads a block of the phase (offset % 9), so only the bytes
+	// with a flag change the state of their phase: an invalid range breaks
+	// the run, an end flag closes it.
+	size_t run_start[SPCSampDir::BRR_CHUNK_SIZE];
+	bool packed[SPCSampDir::BRR_CHUNK_SIZE];
+	for (size_t phase = 0; phase < block_size; phase++) {
+		run_start[phase] = phase;
+		packed[phase] = false;
+	}
+
+	// phase of (word * 64 + bit) is phases[word * 64 % 9 + bit]
+	uint8_t phases[64 + SPCSampDir::BRR_CHUNK_SIZE];
+	for (size_t i = 0; i < sizeof(phases); i++) {
+		phases[i] = (uint8_t)(i % block_size);
+	}
+
+	size_t last_head = size - block_size;
+	for (size_t word = 0; word < num_words; word++) {
+		size_t word_phase = (word * 64) % block_size;
+		uint64_t flagged = end_bits[word] | range_bits[word];
+		while (flagged != 0) {
+			int bit = count_trailing_zeros(flagged);
+			flagged &= flagged - 1;
+
+			size_t offset = word * 64 + bit;
+			if (offset > last_head) {
+				break;
+			}
+
+			size_t phase = phases[word_phase + bit];
+			size_t end = offset + block_size;
+			if ((range_bits[word] & ((uint64_t)1 << bit)) != 0) {
+				run_start[phase] = end;
+				packed[phase] = false;
+				continue;
+			}
+
+			// most runs are too short to look at any further
+			if (offset >= report_from && end - run_start[phase] >= min_blocks * block_size) {
+				size_t start = run_start[phase];
+				bool chain_packed = packed[phase];
+				if (end - start > max_size) {
+					start = end - max_size / block_size * block_size;
+					chain_packed = false;
+				}
+
+				// padding before a sample decodes to silence; encoders often open a
+				// sample with one silent block, so one is kept
+				size_t first_sound = start;
+				while (first_sound + block_size < end && IsSilentBlock(&data[first_sound])) {
+					first_sound += block_size;
+				}
+				if (first_sound - start > block_size) {
+					start = first_sound - block_size;
+					chain_packed = false;
+				}
+
+				// samples are encoded from silence, so a chain nearly always opens
+				// with filter 0; blocks before that are taken as unrelated data
+				size_t first = start;
+				while (first < end && (data[first] & 0x0c) != 0) {
+					first += block_size;
+				}
+				if (first < end && first != start) {
+					start = first;
+					chain_packed = false;
+				}
+
+				// decoding is the costly part, so it comes last
+				if ((end - start) / block_size >= min_blocks &&
+					(excluded == NULL || !IsExcluded(excluded, start, end))) {
+					int score = ScoreHeaders(data, start, end, chain_packed);
+					if (score + MAX_SIGNAL_SCORE >= min_score) {
+						int signal_score = ScoreSignal(data, start, end);
+						score = (signal_score >= 0) ? score + signal_score : 0;
+						if (score >= min_score) {
+							Chain chain;
+							chain.start = start;
+							chain.end = end;
+							chain.looped = (data[offset] & 2) != 0;
+							chain.score = score;
+							chains.push_back(chain);
+						}
+					}
+				}
+			}
+
+			run_start[phase] = end;
+			packed[phase] = true;
+		}
+	}
+}
+
+int BRRScanner::Score(const uint8_t * data, size_t start, size_t end, bool packed)
+{
+	int signal_score = ScoreSignal(data, start, end);
+	if (signal_score < 0) {
+		return 0;
+	}
+	return ScoreHeaders(data, start, end, packed) + signal_score;
+}
+
+bool BRRScanner::IsSilentBlock(const uint8_t * block)
+{
+	// from a silent history, the filter adds nothing to zero samples
+	for (int i = 1; i < SPCSampDir::BRR_CHUNK_SIZE; i++) {
+		if (block[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BRRScanner::IsExcluded(const uint64_t * excluded, size_t start, size_t end)
+{
+	size_t first_word = start / 64;
+	size_t last_word = (end - 1) / 64;
+	for (size_t word = first_word; word <= last_word; word++) {
+		uint64_t bits = excluded[word];
+		if (word == first_word) {
+			bits &= ~(uint64_t)0 << (start % 64);
+		}
+		if (word == last_word) {
+			bits &= ~(uint64_t)0 >> (63 - (end - 1) % 64);
+		}
+		if (bits != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int BRRScanner::ScoreHeaders(const uint8_t * data, size_t start, size_t end, bool packed)
+{
+	const size_t block_size = SPCSampDir::BRR_CHUNK_SIZE;
+
+	int score = 0;
+	if ((data[start] & 0x0c) == 0) {
+		score += 15;
+	}
+	if (packed) {
+		score += 10;
+	}
+
+	// an encoder picks each range from the level of the block, which seldom
+	// jumps, while the headers of random data are all over the place
+	size_t range_steps = 0;
+	for (size_t offset = start + block_size; offset < end; offset += block_size) {
+		range_steps += abs((data[offset] >> 4) - (data[offset - block_size] >> 4));
+	}
+
+	// ten times the mean step, rounded up
+	size_t num_steps = (end - start) / block_size - 1;
+	size_t range_penalty = (num_steps != 0) ? (range_steps * 10 + num_steps - 1) / num_steps : 0;
+	if (range_penalty < 50) {
+		score += (range_penalty <= 10) ? 40 : (int)(50 - range_penalty);
+	}
+	return score;
+}
+
+int BRRScanner::ScoreSignal(const uint8_t * data, size_t start, size_t end)
+{
+	std::vector<int16_t> pcm(SPCSampDir::decode_brr(&data[start], end - start));
+
+	// garbage data overflows the filters, which wraps the output around
+	int peak = 0;
+	size_t wraps = 0;
+	for (size_t i = 0; i < pcm.size(); i++) {
+		int level = abs(pcm[i]);
+		if (level > peak) {
+			peak = level;
+		}
+		if (i != 0 && abs(pcm[i] - pcm[i - 1]) >= 0x8000) {
+			wraps++;
+		}
+	}
+
+	// runs of zero bytes decode to silence, which is no sample at all
+	if (peak == 0) {
+		return -1;
+	}
+
+	// every 0.1% of wrapped samples costs a point
+	size_t wrap_penalty = wraps * 1000 / pcm.size();
+	return (wrap_penalty < MAX_SIGNAL_SCORE) ? MAX_SIGNAL_SCORE - (int)wrap_penalty : 0;
+}
@@ -0,0 +1,81 @@
+#ifndef BRRSCANNER_H_INCLUDED
+#define BRRSCANNER_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <vector>
+
+// Finds BRR chains from their block headers alone, without a sample
+// directory. At each of the 9 block phases, a run of blocks with valid
+// ranges that is closed by a block with the end flag makes a candidate,
+// which is then scored on how much it looks like a real sample.
+class BRRScanner
+{
+public:
+	struct Chain {
+		size_t start;   // offset of the first block
+		size_t end;     // offset just past the end block
+		bool looped;    // loop flag of the end block
+		int score;      // 0-100
+	};
+
+	BRRScanner();
+	virtual ~BRRScanner();
+
+	inline size_t GetMinBlocks(void) const {
+		return min_blocks;
+	}
+
+	inline void SetMinBlocks(size_t min_blocks) {
+		this->min_blocks = min_blocks;
+	}
+
+	inline int GetMinScore(void) const {
+		return min_score;
+	}
+
+	inline void SetMinScore(int min_score) {
+		this->min_score = min_score;
+	}
+
+	inline size_t GetMaxSize(void) const {
+		return max_size;
+	}
+
+	// longer runs of blocks are cut to their last max_size bytes
+	inline void SetMaxSize(size_t max_size) {
+		this->max_size = max_size;
+	}
+
+	// Appends the chains of data[0, size) whose end block lies at or after
+	// report_from and that pass min_blocks and min_score, ordered by end.
+	// A chain found in a slice of a larger buffer is the same as in the
+	// whole buffer as long as the slice starts max_size bytes or more
+	// before report_from. excluded, if given, holds one bit per byte laid
+	// out as in SPCSampDir::scan_brr_headers; chains touching a set bit are
+	// dropped without being scored.
+	void Scan(const uint8_t * data, size_t size, std::vector<Chain> & chains, size_t report_from = 0, const uint64_t * excluded = NULL) const;
+
+	// Score of the chain data[start, end), 0 if it decodes to silence:
+	// 15 for a first block with filter 0 (decoding starts from silence),
+	// 10 if packed right after another chain, up to 40 for ranges that
+	// change little from block to block, and up to 35 for a decoded signal
+	// without 15-bit wrap-arounds.
+	static int Score(const uint8_t * data, size_t start, size_t end, bool packed);
+
+private:
+	static const int MAX_SIGNAL_SCORE = 35;
+
+	static bool IsSilentBlock(const uint8_t * block);
+	static bool IsExcluded(const uint64_t * excluded, size_t start, size_t end);
+	static int ScoreHeaders(const uint8_t * data, size_t start, size_t end, bool packed);
+	// -1 for silence
+	static int ScoreSignal(const uint8_t * data, size_t start, size_t end);
+
+	size_t min_blocks;
+	int min_score;
+	size_t max_size;
+};
+
+#endif /* !BRRSCANNER_H_INCLUDED */
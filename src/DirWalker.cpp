@@ -0,0 +1,241 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#include "DirWalker.h"
+#include "cpath.h"
+
+#ifdef WIN32
+#define strcasecmp _stricmp
+#endif
+
+DirWalker::DirWalker() :
+	num_threads(0),
+	extension()
+{
+}
+
+DirWalker::~DirWalker()
+{
+}
+
+bool DirWalker::Walk(const std::string & root_dir, std::vector<std::string> & filenames)
+{
+	if (!path_isdir(root_dir.c_str())) {
+		m_message = root_dir + ": Not a directory";
+		return false;
+	}
+
+	int workers = num_threads;
+	if (workers <= 0) {
+		workers = (int)std::thread::hardware_concurrency();
+		if (workers <= 0) {
+			workers = 1;
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<std::string> pending_dirs;
+	int active_workers = 0;
+	int unreadable_dirs = 0;
+
+	std::vector<std::vector<std::string> > found(workers);
+	pending_dirs.push_back(root_dir);
+
+	auto worker = [&](std::vector<std::string> & found_files) {
+		for (;;) {
+			std::string dir;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cond.wait(lock, [&] { return !pending_dirs.empty() || active_workers == 0; });
+				if (pending_dirs.empty()) {
+					return;
+				}
+
+				dir = pending_dirs.front();
+				pending_dirs.pop_front();
+				active_workers++;
+			}
+
+			std::vector<std::string> subdirs;
+			bool readable = true;
+
+#ifdef _WIN32
+			WIN32_FIND_DATAA find_data;
+			HANDLE find = FindFirstFileA(JoinPath(dir, "*").c_str(), &find_data);
+			if (find != INVALID_HANDLE_VALUE) {
+				do {
+					const char * name = find_data.cFileName;
+					if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+						continue;
+					}
+
+					std::string path(JoinPath(dir, name));
+					if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+						if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0) {
+							subdirs.push_back(path);
+						}
+					}
+					else if (IsTargetFile(path)) {
+						found_files.push_back(path);
+					}
+				} while (FindNextFileA(find, &find_data));
+				FindClose(find);
+			}
+			else {
+				readable = false;
+			}
+#else
+			DIR * dirp = opendir(dir.c_str());
+			if (dirp != NULL) {
+				struct dirent * entry;
+				while ((entry = readdir(dirp)) != NULL) {
+					const char * name = entry->d_name;
+					if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+						continue;
+					}
+
+					std::string path(JoinPath(dir, name));
+
+					// d_type saves a stat per entry; symlinks are followed for files only
+					unsigned char type = entry->d_type;
+					if (type == DT_UNKNOWN || type == DT_LNK) {
+						struct stat st;
+						int stat_result = (type == DT_LNK) ? stat(path.c_str(), &st) : lstat(path.c_str(), &st);
+						if (stat_result != 0) {
+							continue;
+						}
+
+						if (S_ISDIR(st.st_mode)) {
+							type = (entry->d_type == DT_LNK) ? DT_LNK : DT_DIR;
+						}
+						else if (S_ISREG(st.st_mode)) {
+							type = DT_REG;
+						}
+					}
+
+					if (type == DT_DIR) {
+						subdirs.push_back(path);
+					}
+					else if (type == DT_REG && IsTargetFile(path)) {
+						found_files.push_back(path);
+					}
+				}
+				closedir(dirp);
+			}
+			else {
+				readable = false;
+			}
+#endif
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending_dirs.insert(pending_dirs.end(), subdirs.begin(), subdirs.end());
+				if (!readable) {
+					unreadable_dirs++;
+				}
+				active_workers--;
+			}
+			cond.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < workers; i++) {
+		threads.push_back(std::thread(worker, std::ref(found[i])));
+	}
+	worker(found[0]);
+	for (auto itr = threads.begin(); itr != threads.end(); ++itr) {
+		itr->join();
+	}
+
+	// directory order differs between runs, keep the output stable
+	size_t first_new = filenames.size();
+	for (auto itr = found.begin(); itr != found.end(); ++itr) {
+		filenames.insert(filenames.end(), itr->begin(), itr->end());
+	}
+	std::sort(filenames.begin() + first_new, filenames.end());
+
+	m_message.clear();
+	if (unreadable_dirs != 0) {
+		char tmp[32];
+		sprintf(tmp, "%d", unreadable_dirs);
+		m_message = root_dir + ": " + tmp + " director" + (unreadable_dirs == 1 ? "y" : "ies") + " could not be read";
+	}
+	return true;
+}
+
+bool DirWalker::ReadFileList(const std::string & list_filename, std::vector<std::string> & filenames)
+{
+	FILE * fp;
+	if (list_filename == "-") {
+		fp = stdin;
+	}
+	else {
+		fp = fopen(list_filename.c_str(), "rb");
+		if (fp == NULL) {
+			return false;
+		}
+	}
+
+	// NUL-delimited, as written by `find -print0`
+	std::string filename;
+	char buf[4096];
+	size_t size;
+	while ((size = fread(buf, 1, sizeof(buf), fp)) != 0) {
+		for (size_t i = 0; i < size; i++) {
+			if (buf[i] == '\0') {
+				if (!filename.empty()) {
+					filenames.push_back(filename);
+					filename.clear();
+				}
+			}
+			else {
+				filename.push_back(buf[i]);
+			}
+		}
+	}
+	if (!filename.empty()) {
+		filenames.push_back(filename);
+	}
+
+	bool result = (ferror(fp) == 0);
+	if (fp != stdin) {
+		fclose(fp);
+	}
+	return result;
+}
+
+bool DirWalker::IsTargetFile(const std::string & filename) const
+{
+	if (extension.empty()) {
+		return true;
+	}
+	return strcasecmp(path_findext(filename.c_str()), extension.c_str()) == 0;
+}
+
+std::string DirWalker::JoinPath(const std::string & dir, const std::string & name)
+{
+	if (!dir.empty() && (dir[dir.size() - 1] == PATH_SEPARATOR_CHAR || dir[dir.size() - 1] == '/')) {
+		return dir + name;
+	}
+	return dir + PATH_SEPARATOR_STR + name;
+}
@@ -0,0 +1,53 @@
+
+#ifndef DIRWALKER_H_INCLUDED
+#define DIRWALKER_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+// Collects files under a directory tree. Subdirectories are scanned by a
+// pool of worker threads, so that large trees on high-latency storage do
+// not serialize on every readdir round-trip.
+class DirWalker
+{
+public:
+	DirWalker();
+	virtual ~DirWalker();
+
+	inline int GetNumThreads(void) const {
+		return num_threads;
+	}
+
+	inline void SetNumThreads(int num_threads) {
+		this->num_threads = num_threads;
+	}
+
+	inline const std::string & GetExtension(void) const {
+		return extension;
+	}
+
+	// case-insensitive filter such as ".spc", empty string matches any file
+	inline void SetExtension(const std::string & extension) {
+		this->extension = extension;
+	}
+
+	inline const std::string & message(void) const {
+		return m_message;
+	}
+
+	bool Walk(const std::string & root_dir, std::vector<std::string> & filenames);
+
+	static bool ReadFileList(const std::string & list_filename, std::vector<std::string> & filenames);
+
+protected:
+	int num_threads;
+	std::string extension;
+
+	std::string m_message;
+
+private:
+	bool IsTargetFile(const std::string & filename) const;
+	static std::string JoinPath(const std::string & dir, const std::string & name);
+};
+
+#endif /* !DIRWALKER_H_INCLUDED */
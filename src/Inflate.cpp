@@ -0,0 +1,413 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "Inflate.h"
+
+#define INFLATE_MAX_BITS    15
+#define INFLATE_FAST_BITS   9
+#define INFLATE_MAX_LCODES  286
+#define INFLATE_MAX_DCODES  30
+#define INFLATE_FIX_LCODES  288
+
+namespace {
+
+// Canonical Huffman code. Codes up to INFLATE_FAST_BITS long are resolved
+// with a single table lookup, longer ones by walking the code lengths.
+struct Huffman {
+	uint16_t count[INFLATE_MAX_BITS + 1];
+	uint16_t symbol[INFLATE_FIX_LCODES];
+	uint16_t fast[1 << INFLATE_FAST_BITS];  // (length << 9) | symbol, 0 if the code is longer
+};
+
+const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+bool build_huffman(Huffman & h, const uint8_t * lengths, int n)
+{
+	memset(h.count, 0, sizeof(h.count));
+	memset(h.fast, 0, sizeof(h.fast));
+
+	for (int sym = 0; sym < n; sym++) {
+		h.count[lengths[sym]]++;
+	}
+
+	// reject over-subscribed codes; incomplete codes are legal (e.g. a single distance code)
+	int left = 1;
+	for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+		left <<= 1;
+		left -= h.count[len];
+		if (left < 0) {
+			return false;
+		}
+	}
+
+	uint16_t offsets[INFLATE_MAX_BITS + 1];
+	uint16_t next_code[INFLATE_MAX_BITS + 1];
+	offsets[1] = 0;
+	next_code[1] = 0;
+	for (int len = 1; len < INFLATE_MAX_BITS; len++) {
+		offsets[len + 1] = offsets[len] + h.count[len];
+		next_code[len + 1] = (next_code[len] + h.count[len]) << 1;
+	}
+
+	for (int sym = 0; sym < n; sym++) {
+		int len = lengths[sym];
+		if (len == 0) {
+			continue;
+		}
+
+		h.symbol[offsets[len]++] = (uint16_t)sym;
+
+		unsigned int code = next_code[len]++;
+		if (len <= INFLATE_FAST_BITS) {
+			// codes are stored most significant bit first in the LSB-first stream
+			unsigned int reversed = 0;
+			for (int i = 0; i < len; i++) {
+				reversed = (reversed << 1) | ((code >> i) & 1);
+			}
+
+			for (unsigned int i = reversed; i < (1u << INFLATE_FAST_BITS); i += (1u << len)) {
+				h.fast[i] = (uint16_t)((len << 9) | sym);
+			}
+		}
+	}
+	return true;
+}
+
+struct FixedTables {
+	Huffman lencode;
+	Huffman distcode;
+
+	FixedTables() {
+		uint8_t lengths[INFLATE_FIX_LCODES];
+		int sym;
+		for (sym = 0; sym < 144; sym++) {
+			lengths[sym] = 8;
+		}
+		for (; sym < 256; sym++) {
+			lengths[sym] = 9;
+		}
+		for (; sym < 280; sym++) {
+			lengths[sym] = 7;
+		}
+		for (; sym < INFLATE_FIX_LCODES; sym++) {
+			lengths[sym] = 8;
+		}
+		build_huffman(lencode, lengths, INFLATE_FIX_LCODES);
+
+		for (sym = 0; sym < INFLATE_MAX_DCODES; sym++) {
+			lengths[sym] = 5;
+		}
+		build_huffman(distcode, lengths, INFLATE_MAX_DCODES);
+	}
+};
+
+class InflateState
+{
+public:
+	InflateState(const uint8_t * src, size_t src_size, uint8_t * dst, size_t dst_size) :
+		src(src),
+		src_size(src_size),
+		src_pos(0),
+		pad_bytes(0),
+		bitbuf(0),
+		bitcnt(0),
+		dst(dst),
+		dst_size(dst_size),
+		dst_pos(0)
+	{
+	}
+
+	bool Run(size_t & out_size);
+
+private:
+	const uint8_t * src;
+	size_t src_size;
+	size_t src_pos;
+	size_t pad_bytes;   // zero bytes fed past the end of src
+	uint64_t bitbuf;
+	int bitcnt;
+
+	uint8_t * dst;
+	size_t dst_size;
+	size_t dst_pos;
+
+	inline void Refill(void) {
+		while (bitcnt <= 56) {
+			uint64_t c = 0;
+			if (src_pos < src_size) {
+				c = src[src_pos++];
+			}
+			else {
+				pad_bytes++;
+			}
+			bitbuf |= c << bitcnt;
+			bitcnt += 8;
+		}
+	}
+
+	// true once the decoder has consumed bits that are not part of src
+	inline bool Overrun(void) const {
+		return pad_bytes * 8 > (size_t)bitcnt;
+	}
+
+	inline unsigned int Bits(int n) {
+		if (bitcnt < n) {
+			Refill();
+		}
+		unsigned int value = (unsigned int)(bitbuf & ((1u << n) - 1));
+		bitbuf >>= n;
+		bitcnt -= n;
+		return value;
+	}
+
+	int Decode(const Huffman & h);
+	bool Stored(void);
+	bool Codes(const Huffman & lencode, const Huffman & distcode);
+	bool Dynamic(void);
+};
+
+int InflateState::Decode(const Huffman & h)
+{
+	if (bitcnt < INFLATE_MAX_BITS) {
+		Refill();
+	}
+
+	uint16_t entry = h.fast[bitbuf & ((1u << INFLATE_FAST_BITS) - 1)];
+	if (entry != 0) {
+		int len = entry >> 9;
+		bitbuf >>= len;
+		bitcnt -= len;
+		return entry & 0x1ff;
+	}
+
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+		code |= (int)((bitbuf >> (len - 1)) & 1);
+		int count = h.count[len];
+		if (code - first < count) {
+			bitbuf >>= len;
+			bitcnt -= len;
+			return h.symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+bool InflateState::Stored(void)
+{
+	// drop the rest of the current byte, then hand the buffered whole bytes back to src
+	bitbuf >>= (bitcnt & 7);
+	bitcnt &= ~7;
+	size_t buffered = (size_t)(bitcnt / 8);
+	if (pad_bytes > buffered) {
+		return false;
+	}
+	src_pos -= buffered - pad_bytes;
+	pad_bytes = 0;
+	bitbuf = 0;
+	bitcnt = 0;
+
+	if (src_size - src_pos < 4) {
+		return false;
+	}
+	unsigned int len = src[src_pos] | (src[src_pos + 1] << 8);
+	unsigned int nlen = src[src_pos + 2] | (src[src_pos + 3] << 8);
+	src_pos += 4;
+	if (len != (~nlen & 0xffff)) {
+		return false;
+	}
+
+	if (src_size - src_pos < len || dst_size - dst_pos < len) {
+		return false;
+	}
+	memcpy(&dst[dst_pos], &src[src_pos], len);
+	src_pos += len;
+	dst_pos += len;
+	return true;
+}
+
+bool InflateState::Codes(const Huffman & lencode, const Huffman & distcode)
+{
+	for (;;) {
+		int sym = Decode(lencode);
+		if (sym < 0 || Overrun()) {
+			return false;
+		}
+
+		if (sym < 256) {
+			if (dst_pos == dst_size) {
+				return false;
+			}
+			dst[dst_pos++] = (uint8_t)sym;
+		}
+		else if (sym == 256) {
+			return true;
+		}
+		else {
+			sym -= 257;
+			if (sym >= 29) {
+				return false;
+			}
+			size_t len = length_base[sym] + Bits(length_extra[sym]);
+
+			int dist_sym = Decode(distcode);
+			if (dist_sym < 0 || dist_sym >= 30) {
+				return false;
+			}
+			size_t dist = dist_base[dist_sym] + Bits(dist_extra[dist_sym]);
+			if (dist > dst_pos || len > dst_size - dst_pos) {
+				return false;
+			}
+
+			uint8_t * out = &dst[dst_pos];
+			const uint8_t * from = out - dist;
+			if (dist >= len) {
+				memcpy(out, from, len);
+			}
+			else {
+				// overlapping copy repeats the last dist bytes
+				for (size_t i = 0; i < len; i++) {
+					out[i] = from[i];
+				}
+			}
+			dst_pos += len;
+		}
+	}
+}
+
+bool InflateState::Dynamic(void)
+{
+	static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	int nlen = Bits(5) + 257;
+	int ndist = Bits(5) + 1;
+	int ncode = Bits(4) + 4;
+	if (nlen > INFLATE_MAX_LCODES || ndist > INFLATE_MAX_DCODES) {
+		return false;
+	}
+
+	uint8_t lengths[INFLATE_MAX_LCODES + INFLATE_MAX_DCODES];
+	memset(lengths, 0, sizeof(lengths));
+	for (int i = 0; i < ncode; i++) {
+		lengths[order[i]] = (uint8_t)Bits(3);
+	}
+
+	Huffman lencode;
+	Huffman distcode;
+	if (!build_huffman(lencode, lengths, 19)) {
+		return false;
+	}
+
+	int index = 0;
+	while (index < nlen + ndist) {
+		int sym = Decode(lencode);
+		if (sym < 0 || Overrun()) {
+			return false;
+		}
+
+		if (sym < 16) {
+			lengths[index++] = (uint8_t)sym;
+			continue;
+		}
+
+		uint8_t len = 0;
+		int repeat;
+		if (sym == 16) {
+			if (index == 0) {
+				return false;
+			}
+			len = lengths[index - 1];
+			repeat = 3 + Bits(2);
+		}
+		else if (sym == 17) {
+			repeat = 3 + Bits(3);
+		}
+		else {
+			repeat = 11 + Bits(7);
+		}
+
+		if (index + repeat > nlen + ndist) {
+			return false;
+		}
+		while (repeat-- > 0) {
+			lengths[index++] = len;
+		}
+	}
+
+	// the end-of-block code must be present
+	if (lengths[256] == 0) {
+		return false;
+	}
+
+	if (!build_huffman(lencode, lengths, nlen) || !build_huffman(distcode, &lengths[nlen], ndist)) {
+		return false;
+	}
+
+	return Codes(lencode, distcode);
+}
+
+bool InflateState::Run(size_t & out_size)
+{
+	static const FixedTables fixed;
+
+	bool last;
+	do {
+		last = Bits(1) != 0;
+		unsigned int type = Bits(2);
+
+		bool result;
+		switch (type) {
+		case 0:
+			result = Stored();
+			break;
+
+		case 1:
+			result = Codes(fixed.lencode, fixed.distcode);
+			break;
+
+		case 2:
+			result = Dynamic();
+			break;
+
+		default:
+			result = false;
+			break;
+		}
+
+		if (!result || Overrun()) {
+			return false;
+		}
+	} while (!last);
+
+	out_size = dst_pos;
+	return true;
+}
+
+} // namespace
+
+bool Inflate::Decompress(const uint8_t * src, size_t src_size, uint8_t * dst, size_t dst_size, size_t & out_size)
+{
+	InflateState state(src, src_size, dst, dst_size);
+	return state.Run(out_size);
+}
@@ -0,0 +1,21 @@
+#ifndef INFLATE_H_INCLUDED
+#define INFLATE_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+// Self-contained decoder for raw DEFLATE streams (RFC 1951), as stored in
+// ZIP archives. The output size must be known in advance, which is always
+// the case for ZIP members; no zlib dependency is required.
+class Inflate
+{
+public:
+	// Decompresses src into dst. Fails on malformed input or when the
+	// stream does not fit in dst_size bytes.
+	static bool Decompress(const uint8_t * src, size_t src_size, uint8_t * dst, size_t dst_size, size_t & out_size);
+
+private:
+	Inflate();
+};
+
+#endif /* !INFLATE_H_INCLUDED */
@@ -0,0 +1,157 @@
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include "InputScheduler.h"
+
+InputScheduler::InputScheduler() :
+	readahead_window(0),
+	next_prefetch_index(0)
+{
+}
+
+InputScheduler::~InputScheduler()
+{
+}
+
+bool InputScheduler::FileLocation::operator<(const FileLocation & other) const
+{
+	if (device != other.device) {
+		return device < other.device;
+	}
+	if (has_physical != other.has_physical) {
+		return has_physical;
+	}
+	if (position != other.position) {
+		return position < other.position;
+	}
+	return index < other.index;
+}
+
+void InputScheduler::SortByLocation(std::vector<std::string> & filenames) const
+{
+#ifndef _WIN32
+	std::vector<FileLocation> locations;
+	locations.reserve(filenames.size());
+
+	// FIEMAP is tried once per device, network filesystems usually lack it
+	std::set<uint64_t> no_fiemap_devices;
+
+	for (size_t index = 0; index < filenames.size(); index++) {
+		FileLocation location;
+		location.device = 0;
+		location.has_physical = false;
+		location.position = 0;
+		location.index = index;
+
+		struct stat st;
+		if (stat(filenames[index].c_str(), &st) == 0) {
+			location.device = (uint64_t)st.st_dev;
+			location.position = (uint64_t)st.st_ino;
+
+			if (no_fiemap_devices.count(location.device) == 0) {
+				uint64_t physical_offset;
+				if (GetPhysicalOffset(filenames[index], physical_offset)) {
+					location.has_physical = true;
+					location.position = physical_offset;
+				}
+				else {
+					no_fiemap_devices.insert(location.device);
+				}
+			}
+		}
+
+		locations.push_back(location);
+	}
+
+	std::sort(locations.begin(), locations.end());
+
+	std::vector<std::string> sorted_filenames;
+	sorted_filenames.reserve(filenames.size());
+	for (auto itr = locations.begin(); itr != locations.end(); ++itr) {
+		sorted_filenames.push_back(filenames[itr->index]);
+	}
+	filenames.swap(sorted_filenames);
+#endif
+}
+
+void InputScheduler::Prefetch(const std::vector<std::string> & filenames, size_t current_index)
+{
+	if (readahead_window <= 0) {
+		return;
+	}
+
+	if (next_prefetch_index < current_index) {
+		next_prefetch_index = current_index;
+	}
+
+	size_t end_index = std::min(filenames.size(), current_index + (size_t)readahead_window + 1);
+	for (; next_prefetch_index < end_index; next_prefetch_index++) {
+		PrefetchFile(filenames[next_prefetch_index]);
+	}
+}
+
+void InputScheduler::PrefetchFile(const std::string & filename)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd != -1) {
+		// starts asynchronous readahead, pages stay in cache after close
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+#else
+	(void)filename;
+#endif
+}
+
+bool InputScheduler::GetPhysicalOffset(const std::string & filename, uint64_t & physical_offset)
+{
+#if defined(__linux__) && defined(FS_IOC_FIEMAP)
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+
+	// struct fiemap followed by room for a single extent
+	uint64_t request[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t) + 1];
+	memset(request, 0, sizeof(request));
+
+	struct fiemap * map = (struct fiemap *)request;
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+
+	bool result = false;
+	if (ioctl(fd, FS_IOC_FIEMAP, map) == 0) {
+		// files without extents (empty or inlined) go first
+		physical_offset = (map->fm_mapped_extents != 0) ? map->fm_extents[0].fe_physical : 0;
+		result = true;
+	}
+
+	close(fd);
+	return result;
+#else
+	(void)filename;
+	(void)physical_offset;
+	return false;
+#endif
+}
@@ -0,0 +1,49 @@
+
+#ifndef INPUTSCHEDULER_H_INCLUDED
+#define INPUTSCHEDULER_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+// Orders input files by their on-disk location and asks the kernel to
+// prefetch a window of upcoming files while the current one is parsed.
+// Both are hints only: every file is still read through the usual path.
+class InputScheduler
+{
+public:
+	InputScheduler();
+	virtual ~InputScheduler();
+
+	inline int GetReadaheadWindow(void) const {
+		return readahead_window;
+	}
+
+	inline void SetReadaheadWindow(int readahead_window) {
+		this->readahead_window = readahead_window;
+	}
+
+	void SortByLocation(std::vector<std::string> & filenames) const;
+	void Prefetch(const std::vector<std::string> & filenames, size_t current_index);
+
+protected:
+	int readahead_window;
+	size_t next_prefetch_index;
+
+private:
+	struct FileLocation {
+		uint64_t device;
+		bool has_physical;  // physical extent (FIEMAP) or inode number
+		uint64_t position;
+		size_t index;
+
+		bool operator<(const FileLocation & other) const;
+	};
+
+	static void PrefetchFile(const std::string & filename);
+	static bool GetPhysicalOffset(const std::string & filename, uint64_t & physical_offset);
+};
+
+#endif /* !INPUTSCHEDULER_H_INCLUDED */
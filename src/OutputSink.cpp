@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#define close _close
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#endif
+#endif
+
+#include "OutputSink.h"
+#include "cpath.h"
+
+// longest run of chunks gathered into one writev
+#define OUTPUT_MAX_IOV  16
+
+static bool write_file_data(int fd, const void * data, size_t size, off_t offset)
+{
+	const uint8_t * p = (const uint8_t *)data;
+	while (size != 0) {
+#ifdef _WIN32
+		if (_lseek(fd, offset, SEEK_SET) != offset) {
+			return false;
+		}
+		int written = _write(fd, p, (unsigned int)std::min(size, (size_t)0x40000000));
+#else
+		ssize_t written = pwrite(fd, p, size, offset);
+#endif
+		if (written <= 0) {
+			return false;
+		}
+		p += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+#ifndef _WIN32
+// Writes chunks back to back from the current file position, resuming
+// after short writes.
+static bool write_file_chunks(int fd, const OutputChunk * chunks, size_t num_chunks)
+{
+	struct iovec iov[OUTPUT_MAX_IOV];
+	size_t index = 0;
+	while (index < num_chunks) {
+		int iov_count = 0;
+		for (; index < num_chunks && iov_count < OUTPUT_MAX_IOV; index++) {
+			if (chunks[index].size != 0) {
+				iov[iov_count].iov_base = (void *)chunks[index].data;
+				iov[iov_count].iov_len = chunks[index].size;
+				iov_count++;
+			}
+		}
+
+		struct iovec * iov_next = iov;
+		while (iov_count != 0) {
+			ssize_t written = writev(fd, iov_next, iov_count);
+			if (written <= 0) {
+				return false;
+			}
+
+			while (iov_count != 0 && (size_t)written >= iov_next->iov_len) {
+				written -= iov_next->iov_len;
+				iov_next++;
+				iov_count--;
+			}
+			if (iov_count != 0) {
+				iov_next->iov_base = (uint8_t *)iov_next->iov_base + written;
+				iov_next->iov_len -= written;
+			}
+		}
+	}
+	return true;
+}
+
+// Copies a byte range between files inside the kernel where possible.
+// copy_file_range may share extents on reflink-capable filesystems;
+// sendfile and finally pread/pwrite cover older kernels and cross-device
+// copies.
+static bool copy_file_data(int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t size)
+{
+#ifdef __linux__
+#ifdef SYS_copy_file_range
+	while (size != 0) {
+		loff_t in_pos = in_offset;
+		loff_t out_pos = out_offset;
+		ssize_t copied = syscall(SYS_copy_file_range, in_fd, &in_pos, out_fd, &out_pos, size, 0);
+		if (copied <= 0) {
+			break;
+		}
+		in_offset += copied;
+		out_offset += copied;
+		size -= copied;
+	}
+#endif
+
+	// sendfile writes at the current position of the output file
+	if (size != 0 && lseek(out_fd, out_offset, SEEK_SET) == out_offset) {
+		while (size != 0) {
+			off_t in_pos = in_offset;
+			ssize_t copied = sendfile(out_fd, in_fd, &in_pos, size);
+			if (copied <= 0) {
+				break;
+			}
+			in_offset += copied;
+			out_offset += copied;
+			size -= copied;
+		}
+	}
+#endif
+
+	uint8_t buf[0x4000];
+	while (size != 0) {
+		ssize_t read_size = pread(in_fd, buf, std::min(size, sizeof(buf)), in_offset);
+		if (read_size <= 0 || !write_file_data(out_fd, buf, (size_t)read_size, out_offset)) {
+			return false;
+		}
+		in_offset += read_size;
+		out_offset += read_size;
+		size -= read_size;
+	}
+	return true;
+}
+#endif
+
+//============================================================================
+// OutputSink
+//============================================================================
+
+OutputSink::OutputSink() :
+	file_count(0),
+	byte_count(0)
+{
+}
+
+OutputSink::~OutputSink()
+{
+}
+
+bool OutputSink::Finish(void)
+{
+	return true;
+}
+
+void OutputSink::CountFile(const OutputChunk * chunks, size_t num_chunks)
+{
+	file_count++;
+	for (size_t i = 0; i < num_chunks; i++) {
+		byte_count += chunks[i].size;
+	}
+}
+
+std::string OutputSink::JoinPath(const std::string & dir, const std::string & filename)
+{
+	if (dir.empty() || dir == ".") {
+		return filename;
+	}
+
+	char last = dir[dir.size() - 1];
+	if (last == '/' || last == PATH_SEPARATOR_CHAR) {
+		return dir + filename;
+	}
+	return dir + PATH_SEPARATOR_STR + filename;
+}
+
+//============================================================================
+// DirectorySink
+//============================================================================
+
+DirectorySink::DirectorySink() :
+	dir_fd(-1)
+{
+}
+
+DirectorySink::~DirectorySink()
+{
+#ifndef _WIN32
+	if (dir_fd != -1) {
+		close(dir_fd);
+	}
+#endif
+}
+
+int DirectorySink::OpenFile(const std::string & dir, const std::string & filename)
+{
+#ifdef _WIN32
+	std::string path(JoinPath(dir, filename));
+	return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	if (dir_fd == -1 || dir != dir_path) {
+		if (dir_fd != -1) {
+			close(dir_fd);
+			dir_path.clear();
+		}
+
+		dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd == -1) {
+			return -1;
+		}
+		dir_path = dir;
+	}
+
+	return openat(dir_fd, filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+}
+
+bool DirectorySink::WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks)
+{
+	int fd = OpenFile(dir, filename);
+	if (fd == -1) {
+		m_message = "File open error";
+		return false;
+	}
+
+	bool written = true;
+#ifndef _WIN32
+	bool has_source = false;
+	for (size_t i = 0; i < num_chunks; i++) {
+		if (chunks[i].source_fd != -1) {
+			has_source = true;
+			break;
+		}
+	}
+
+	if (!has_source) {
+		written = write_file_chunks(fd, chunks, num_chunks);
+	}
+	else
+#endif
+	{
+		off_t offset = 0;
+		for (size_t i = 0; i < num_chunks && written; i++) {
+#ifndef _WIN32
+			if (chunks[i].source_fd != -1) {
+				written = copy_file_data(chunks[i].source_fd, chunks[i].source_offset, fd, offset, chunks[i].size);
+			}
+			else
+#endif
+			{
+				written = write_file_data(fd, chunks[i].data, chunks[i].size, offset);
+			}
+			offset += chunks[i].size;
+		}
+	}
+
+	written = (close(fd) == 0) && written;
+	if (!written) {
+		m_message = "File write error";
+		return false;
+	}
+
+	CountFile(chunks, num_chunks);
+	return true;
+}
+
+//============================================================================
+// MemorySink
+//============================================================================
+
+MemorySink::MemorySink()
+{
+}
+
+MemorySink::~MemorySink()
+{
+}
+
+bool MemorySink::WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks)
+{
+	files.push_back(File());
+	File & file = files.back();
+	file.path = JoinPath(dir, filename);
+
+	size_t size = 0;
+	for (size_t i = 0; i < num_chunks; i++) {
+		size += chunks[i].size;
+	}
+
+	file.data.reserve(size);
+	for (size_t i = 0; i < num_chunks; i++) {
+		const uint8_t * data = (const uint8_t *)chunks[i].data;
+		file.data.insert(file.data.end(), data, data + chunks[i].size);
+	}
+
+	CountFile(chunks, num_chunks);
+	return true;
+}
+
+//============================================================================
+// TarSink
+//============================================================================
+
+TarSink::TarSink(FILE * stream) :
+	stream(stream),
+	mtime((uint64_t)time(NULL)),
+	finished(false)
+{
+#ifdef _WIN32
+	_setmode(_fileno(stream), _O_BINARY);
+#endif
+}
+
+TarSink::~TarSink()
+{
+}
+
+std::string TarSink::GetMemberName(const std::string & dir, const std::string & filename)
+{
+	std::string path(JoinPath(dir, filename));
+	std::replace(path.begin(), path.end(), '\\', '/');
+
+	// archive members are always relative
+	std::string name;
+	std::string::size_type offset = 0;
+	while (offset <= path.size()) {
+		std::string::size_type separator = path.find('/', offset);
+		if (separator == std::string::npos) {
+			separator = path.size();
+		}
+
+		std::string component(path.substr(offset, separator - offset));
+		if (!component.empty() && component != "." && !(name.empty() && component.size() == 2 && component[1] == ':')) {
+			if (!name.empty()) {
+				name += '/';
+			}
+			name += component;
+		}
+		offset = separator + 1;
+	}
+	return name;
+}
+
+bool TarSink::WriteHeader(const std::string & name, uint64_t size, char typeflag)
+{
+	uint8_t header[BLOCK_SIZE];
+	memset(header, 0, sizeof(header));
+
+	// ustar splits long names at a slash into prefix (155) and name (100)
+	std::string prefix;
+	std::string short_name(name);
+	if (short_name.size() > 100) {
+		std::string::size_type separator = name.find('/', name.size() > 101 ? name.size() - 101 : 0);
+		if (separator != std::string::npos && separator <= 155 && name.size() - separator - 1 <= 100 && separator != 0) {
+			prefix = name.substr(0, separator);
+			short_name = name.substr(separator + 1);
+		}
+		else {
+			// GNU long name record precedes the real header
+			if (!WriteHeader("././@LongLink", name.size() + 1, 'L') ||
+				fwrite(name.c_str(), 1, name.size() + 1, stream) != name.size() + 1 ||
+				!WritePadding(name.size() + 1)) {
+				return false;
+			}
+			short_name = name.substr(0, 100);
+		}
+	}
+
+	memcpy(&header[0], short_name.c_str(), short_name.size());
+	sprintf((char *)&header[100], "%07o", 0644);
+	sprintf((char *)&header[108], "%07o", 0);
+	sprintf((char *)&header[116], "%07o", 0);
+	sprintf((char *)&header[124], "%011llo", (unsigned long long)size);
+	sprintf((char *)&header[136], "%011llo", (unsigned long long)mtime);
+	header[156] = (uint8_t)typeflag;
+	memcpy(&header[257], "ustar", 6);
+	memcpy(&header[263], "00", 2);
+	memcpy(&header[345], prefix.c_str(), prefix.size());
+
+	memset(&header[148], ' ', 8);
+	unsigned int checksum = 0;
+	for (size_t i = 0; i < BLOCK_SIZE; i++) {
+		checksum += header[i];
+	}
+	sprintf((char *)&header[148], "%06o", checksum);
+	header[155] = ' ';
+
+	return fwrite(header, 1, BLOCK_SIZE, stream) == BLOCK_SIZE;
+}
+
+bool TarSink::WritePadding(uint64_t size)
+{
+	static const uint8_t zero[BLOCK_SIZE] = { 0 };
+	size_t padding = (size_t)((BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE);
+	return padding == 0 || fwrite(zero, 1, padding, stream) == padding;
+}
+
+bool TarSink::WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks)
+{
+	uint64_t size = 0;
+	for (size_t i = 0; i < num_chunks; i++) {
+		size += chunks[i].size;
+	}
+
+	if (!WriteHeader(GetMemberName(dir, filename), size, '0')) {
+		m_message = "File write error";
+		return false;
+	}
+
+	for (size_t i = 0; i < num_chunks; i++) {
+		if (chunks[i].size != 0 && fwrite(chunks[i].data, 1, chunks[i].size, stream) != chunks[i].size) {
+			m_message = "File write error";
+			return false;
+		}
+	}
+
+	if (!WritePadding(size)) {
+		m_message = "File write error";
+		return false;
+	}
+
+	CountFile(chunks, num_chunks);
+	return true;
+}
+
+bool TarSink::Finish(void)
+{
+	if (finished) {
+		return true;
+	}
+	finished = true;
+
+	static const uint8_t zero[BLOCK_SIZE * 2] = { 0 };
+	if (fwrite(zero, 1, sizeof(zero), stream) != sizeof(zero) || fflush(stream) != 0) {
+		m_message = "File write error";
+		return false;
+	}
+	return true;
+}
+
+//============================================================================
+// NullSink
+//============================================================================
+
+NullSink::NullSink()
+{
+}
+
+NullSink::~NullSink()
+{
+}
+
+bool NullSink::WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks)
+{
+	(void)dir;
+	(void)filename;
+	CountFile(chunks, num_chunks);
+	return true;
+}
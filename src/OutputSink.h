@@ -0,0 +1,147 @@
+#ifndef OUTPUTSINK_H_INCLUDED
+#define OUTPUTSINK_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cstddef>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+// One piece of an output file. When source_fd is not -1, the same bytes
+// are also available at source_offset of that file, and sinks which can
+// copy between files inside the kernel may use it instead of data.
+struct OutputChunk {
+	const void * data;
+	size_t size;
+	int source_fd;
+	off_t source_offset;
+
+	OutputChunk(const void * data, size_t size, int source_fd = -1, off_t source_offset = 0) :
+		data(data),
+		size(size),
+		source_fd(source_fd),
+		source_offset(source_offset)
+	{
+	}
+};
+
+// Destination of exported files. Every file is handed over whole, as a
+// list of chunks, so that sinks can write it with a single call.
+class OutputSink
+{
+public:
+	OutputSink();
+	virtual ~OutputSink();
+
+	inline uint64_t GetFileCount(void) const {
+		return file_count;
+	}
+
+	inline uint64_t GetByteCount(void) const {
+		return byte_count;
+	}
+
+	inline const std::string & message(void) const {
+		return m_message;
+	}
+
+	// dir is where the file would be placed on a filesystem ("." for the working directory)
+	virtual bool WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks) = 0;
+	virtual bool Finish(void);
+
+protected:
+	uint64_t file_count;
+	uint64_t byte_count;
+
+	std::string m_message;
+
+	void CountFile(const OutputChunk * chunks, size_t num_chunks);
+	static std::string JoinPath(const std::string & dir, const std::string & filename);
+};
+
+// Creates regular files through openat on a cached directory descriptor.
+class DirectorySink : public OutputSink
+{
+public:
+	DirectorySink();
+	virtual ~DirectorySink();
+
+	virtual bool WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks);
+
+private:
+	DirectorySink(const DirectorySink &);
+	DirectorySink & operator=(const DirectorySink &);
+
+	int OpenFile(const std::string & dir, const std::string & filename);
+
+	// reopened only when the target directory changes
+	std::string dir_path;
+	int dir_fd;
+};
+
+// Keeps every file in memory.
+class MemorySink : public OutputSink
+{
+public:
+	struct File {
+		std::string path;
+		std::vector<uint8_t> data;
+	};
+
+	MemorySink();
+	virtual ~MemorySink();
+
+	inline const std::vector<File> & GetFiles(void) const {
+		return files;
+	}
+
+	inline void Clear(void) {
+		files.clear();
+	}
+
+	virtual bool WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks);
+
+protected:
+	std::vector<File> files;
+};
+
+// Streams files as a ustar archive, e.g. to stdout. Finish() writes the
+// end-of-archive marker.
+class TarSink : public OutputSink
+{
+public:
+	explicit TarSink(FILE * stream);
+	virtual ~TarSink();
+
+	virtual bool WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks);
+	virtual bool Finish(void);
+
+protected:
+	static const size_t BLOCK_SIZE = 512;
+
+	FILE * stream;
+	uint64_t mtime;
+	bool finished;
+
+private:
+	TarSink(const TarSink &);
+	TarSink & operator=(const TarSink &);
+
+	bool WriteHeader(const std::string & name, uint64_t size, char typeflag);
+	bool WritePadding(uint64_t size);
+	static std::string GetMemberName(const std::string & dir, const std::string & filename);
+};
+
+// Discards every file, counting files and bytes only.
+class NullSink : public OutputSink
+{
+public:
+	NullSink();
+	virtual ~NullSink();
+
+	virtual bool WriteFile(const std::string & dir, const std::string & filename, const OutputChunk * chunks, size_t num_chunks);
+};
+
+#endif /* !OUTPUTSINK_H_INCLUDED */
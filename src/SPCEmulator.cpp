@@ -0,0 +1,1056 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "SPCEmulator.h"
+#include "SPCFileView.h"
+
+const uint8_t SPCEmulator::ipl_rom[0x40] = {
+	0xcd, 0xef, 0xbd, 0xe8, 0x00, 0xc6, 0x1d, 0xd0, 0xfc, 0x8f, 0xaa, 0xf4, 0x8f, 0xbb, 0xf5, 0x78,
+	0xcc, 0xf4, 0xd0, 0xfb, 0x2f, 0x19, 0xeb, 0xf4, 0xd0, 0xfc, 0x7e, 0xf4, 0xd0, 0x0b, 0xe4, 0xf5,
+	0xcb, 0xf4, 0xd7, 0x00, 0xfc, 0xd0, 0xf3, 0xab, 0x01, 0x10, 0xef, 0x7e, 0xf4, 0x10, 0xeb, 0xba,
+	0xf6, 0xda, 0x00, 0xba, 0xf4, 0xc4, 0xf4, 0xdd, 0x5d, 0xd0, 0xdb, 0x1f, 0x00, 0x00, 0xc0, 0xff
+};
+
+// cycles of each opcode, without the 2 extra cycles of a branch taken
+const uint8_t SPCEmulator::cycle_table[0x100] = {
+	2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 5, 4, 5, 4, 6, 8,
+	2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 6, 5, 2, 2, 4, 6,
+	2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 5, 4, 5, 4, 5, 4,
+	2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 6, 5, 2, 2, 3, 8,
+	2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 4, 4, 5, 4, 6, 6,
+	2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 4, 5, 2, 2, 4, 3,
+	2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 4, 4, 5, 4, 5, 5,
+	2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 5, 5, 2, 2, 3, 6,
+	2, 8, 4, 5, 3, 4, 3, 6, 2, 6, 5, 4, 5, 2, 4, 5,
+	2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 5, 5, 2, 2, 12, 5,
+	3, 8, 4, 5, 3, 4, 3, 6, 2, 6, 4, 4, 5, 2, 4, 4,
+	2, 8, 4, 5, 4, 5, 5, 6, 5, 5, 5, 5, 2, 2, 3, 4,
+	3, 8, 4, 5, 4, 5, 4, 7, 2, 5, 6, 4, 5, 2, 4, 9,
+	2, 8, 4, 5, 5, 6, 6, 7, 4, 5, 5, 5, 2, 2, 6, 3,
+	2, 8, 4, 5, 3, 4, 3, 6, 2, 4, 5, 3, 4, 3, 4, 3,
+	2, 8, 4, 5, 4, 5, 5, 6, 3, 4, 5, 4, 2, 2, 4, 3
+};
+
+SPCEmulator::SPCEmulator() :
+	pc(0),
+	a(0),
+	x(0),
+	y(0),
+	sp(0),
+	flag_n(false),
+	flag_v(false),
+	flag_p(false),
+	flag_b(false),
+	flag_h(false),
+	flag_i(false),
+	flag_z(false),
+	flag_c(false),
+	dp_base(0),
+	ipl_enabled(false),
+	dsp_address(0),
+	timers_cycles(0),
+	halted(true),
+	total_cycles(0)
+{
+	memset(ram, 0, sizeof(ram));
+	memset(dsp, 0, sizeof(dsp));
+	memset(in_ports, 0, sizeof(in_ports));
+	memset(timers, 0, sizeof(timers));
+	memset(keyed_on, 0, sizeof(keyed_on));
+}
+
+SPCEmulator::~SPCEmulator()
+{
+}
+
+void SPCEmulator::Load(const SPCFileView & spc_file)
+{
+	memcpy(ram, spc_file.ram, sizeof(ram));
+	memcpy(dsp, spc_file.dsp, sizeof(dsp));
+
+	// while the IPL ROM is mapped, the image holds the ROM at $ffc0 and
+	// the RAM under it is saved apart
+	uint8_t control = ram[0xf1];
+	ipl_enabled = (control & 0x80) != 0;
+	if (ipl_enabled && spc_file.extra_ram != NULL) {
+		memcpy(&ram[0xffc0], spc_file.extra_ram, 0x40);
+	}
+
+	dsp_address = ram[0xf2];
+	memcpy(in_ports, &ram[0xf4], sizeof(in_ports));
+
+	for (int i = 0; i < 3; i++) {
+		Timer & timer = timers[i];
+		timer.enabled = ((control >> i) & 1) != 0;
+		timer.period = (i == 2) ? 16 : 128;
+		timer.elapsed = 0;
+		timer.target = (ram[0xfa + i] != 0) ? ram[0xfa + i] : 256;
+		timer.divider = 0;
+		timer.counter = ram[0xfd + i] & 15;
+	}
+
+	pc = spc_file.regs.pc;
+	a = spc_file.regs.a;
+	x = spc_file.regs.x;
+	y = spc_file.regs.y;
+	sp = spc_file.regs.sp;
+	SetPSW(spc_file.regs.psw);
+
+	timers_cycles = 0;
+	halted = false;
+	total_cycles = 0;
+	memset(keyed_on, 0, sizeof(keyed_on));
+}
+
+bool SPCEmulator::Run(uint64_t cycles)
+{
+	uint64_t end_cycles = total_cycles + cycles;
+	while (!halted && total_cycles < end_cycles) {
+		total_cycles += Step();
+	}
+	return !halted;
+}
+
+std::vector<uint8_t> SPCEmulator::GetKeyedOnSamples(void) const
+{
+	std::vector<uint8_t> srcns;
+	for (int srcn = 0; srcn < 256; srcn++) {
+		if (keyed_on[srcn]) {
+			srcns.push_back((uint8_t)srcn);
+		}
+	}
+	return srcns;
+}
+
+uint8_t SPCEmulator::ReadIO(uint16_t address)
+{
+	switch (address) {
+	case 0xf2:
+		return dsp_address;
+
+	case 0xf3:
+		return dsp[dsp_address & 0x7f];
+
+	case 0xf4:
+	case 0xf5:
+	case 0xf6:
+	case 0xf7:
+		return in_ports[address - 0xf4];
+
+	case 0xf8:
+	case 0xf9:
+		return ram[address];
+
+	case 0xfd:
+	case 0xfe:
+	case 0xff:
+	{
+		// counters are cleared on read
+		UpdateTimers();
+		Timer & timer = timers[address - 0xfd];
+		uint8_t counter = timer.counter;
+		timer.counter = 0;
+		return counter;
+	}
+
+	default:
+		// TEST, CONTROL and the timer targets are write-only
+		return 0;
+	}
+}
+
+void SPCEmulator::WriteIO(uint16_t address, uint8_t value)
+{
+	ram[address] = value;
+
+	switch (address) {
+	case 0xf1:
+		UpdateTimers();
+		for (int i = 0; i < 3; i++) {
+			Timer & timer = timers[i];
+			bool enabled = ((value >> i) & 1) != 0;
+			if (enabled && !timer.enabled) {
+				timer.divider = 0;
+				timer.counter = 0;
+			}
+			timer.enabled = enabled;
+		}
+		if ((value & 0x10) != 0) {
+			in_ports[0] = in_ports[1] = 0;
+		}
+		if ((value & 0x20) != 0) {
+			in_ports[2] = in_ports[3] = 0;
+		}
+		ipl_enabled = (value & 0x80) != 0;
+		break;
+
+	case 0xf2:
+		dsp_address = value;
+		break;
+
+	case 0xf3:
+		// $80-$ff mirror $00-$7f read-only
+		if (dsp_address < 0x80) {
+			WriteDSP(dsp_address, value);
+		}
+		break;
+
+	case 0xfa:
+	case 0xfb:
+	case 0xfc:
+		UpdateTimers();
+		timers[address - 0xfa].target = (value != 0) ? value : 256;
+		break;
+	}
+}
+
+void SPCEmulator::WriteDSP(uint8_t address, uint8_t value)
+{
+	switch (address) {
+	case 0x4c:
+		// KON
+		for (int voice = 0; voice < 8; voice++) {
+			if ((value & (1 << voice)) != 0) {
+				keyed_on[dsp[voice * 0x10 + 4]] = true;
+			}
+		}
+		dsp[0x7c] &= ~value;
+		break;
+
+	case 0x7c:
+		// any write to ENDX clears it
+		value = 0;
+		break;
+	}
+	dsp[address] = value;
+}
+
+void SPCEmulator::UpdateTimers(void)
+{
+	uint64_t cycles = total_cycles - timers_cycles;
+	timers_cycles = total_cycles;
+
+	for (int i = 0; i < 3; i++) {
+		Timer & timer = timers[i];
+		if (!timer.enabled) {
+			continue;
+		}
+
+		timer.elapsed += cycles;
+		uint64_t ticks = timer.divider + timer.elapsed / timer.period;
+		timer.elapsed %= timer.period;
+		timer.divider = (int)(ticks % timer.target);
+		timer.counter = (uint8_t)((timer.counter + ticks / timer.target) & 15);
+	}
+}
+
+uint8_t SPCEmulator::GetPSW(void) const
+{
+	return (flag_n ? 0x80 : 0) | (flag_v ? 0x40 : 0) | (flag_p ? 0x20 : 0) | (flag_b ? 0x10 : 0) |
+		(flag_h ? 0x08 : 0) | (flag_i ? 0x04 : 0) | (flag_z ? 0x02 : 0) | (flag_c ? 0x01 : 0);
+}
+
+void SPCEmulator::SetPSW(uint8_t psw)
+{
+	flag_n = (psw & 0x80) != 0;
+	flag_v = (psw & 0x40) != 0;
+	flag_p = (psw & 0x20) != 0;
+	flag_b = (psw & 0x10) != 0;
+	flag_h = (psw & 0x08) != 0;
+	flag_i = (psw & 0x04) != 0;
+	flag_z = (psw & 0x02) != 0;
+	flag_c = (psw & 0x01) != 0;
+	dp_base = flag_p ? 0x100 : 0;
+}
+
+// operation: OR, AND, EOR, CMP, ADC, SBC (bits 5-7 of the opcode)
+uint8_t SPCEmulator::Alu(int operation, uint8_t lhs, uint8_t rhs)
+{
+	int result;
+	switch (operation) {
+	case 0:
+		result = lhs | rhs;
+		break;
+
+	case 1:
+		result = lhs & rhs;
+		break;
+
+	case 2:
+		result = lhs ^ rhs;
+		break;
+
+	case 3:
+		flag_c = (lhs >= rhs);
+		SetNZ((uint8_t)(lhs - rhs));
+		return lhs;
+
+	default:
+		// SBC is ADC of the complement
+		if (operation == 5) {
+			rhs = ~rhs;
+		}
+		result = lhs + rhs + (flag_c ? 1 : 0);
+		flag_h = ((lhs ^ rhs ^ result) & 0x10) != 0;
+		flag_v = (~(lhs ^ rhs) & (lhs ^ result) & 0x80) != 0;
+		flag_c = (result > 0xff);
+		break;
+	}
+	SetNZ((uint8_t)result);
+	return (uint8_t)result;
+}
+
+// operation: ASL, ROL, LSR, ROR, DEC, INC (bits 5-7 of the opcode)
+uint8_t SPCEmulator::Shift(int operation, uint8_t value)
+{
+	int carry = flag_c ? 1 : 0;
+	switch (operation) {
+	case 0:
+		flag_c = (value & 0x80) != 0;
+		value <<= 1;
+		break;
+
+	case 1:
+		flag_c = (value & 0x80) != 0;
+		value = (uint8_t)((value << 1) | carry);
+		break;
+
+	case 2:
+		flag_c = (value & 1) != 0;
+		value >>= 1;
+		break;
+
+	case 3:
+		flag_c = (value & 1) != 0;
+		value = (uint8_t)((value >> 1) | (carry << 7));
+		break;
+
+	case 4:
+		value--;
+		break;
+
+	default:
+		value++;
+		break;
+	}
+	SetNZ(value);
+	return value;
+}
+
+int SPCEmulator::Branch(bool condition)
+{
+	int8_t offset = (int8_t)Fetch();
+	if (condition) {
+		pc += offset;
+		return 2;
+	}
+	return 0;
+}
+
+int SPCEmulator::Step(void)
+{
+	uint8_t opcode = Fetch();
+	int cycles = cycle_table[opcode];
+	int column = opcode & 0x0f;
+	bool odd_row = (opcode & 0x10) != 0;
+
+	// OR, AND, EOR, CMP, ADC and SBC share their eight addressing modes
+	if (opcode < 0xc0 && column >= 4 && column <= 9) {
+		int operation = opcode >> 5;
+		uint16_t address = 0;
+		if (column == 9 || (column == 8 && odd_row)) {
+			uint8_t source;
+			if (column == 9 && odd_row) {
+				source = ReadDP(y);
+				address = dp_base | x;
+			}
+			else {
+				source = (column == 9) ? ReadDP(Fetch()) : Fetch();
+				address = dp_base | Fetch();
+			}
+			uint8_t result = Alu(operation, Read(address), source);
+			if (operation != 3) {
+				Write(address, result);
+			}
+			return cycles;
+		}
+
+		uint8_t operand;
+		if (column == 8) {
+			operand = Fetch();
+		}
+		else {
+			switch (column | (odd_row ? 0x10 : 0)) {
+			case 0x04:
+				address = dp_base | Fetch();
+				break;
+			case 0x05:
+				address = Fetch16();
+				break;
+			case 0x06:
+				address = dp_base | x;
+				break;
+			case 0x07:
+				address = ReadDP16((uint8_t)(Fetch() + x));
+				break;
+			case 0x14:
+				address = dp_base | (uint8_t)(Fetch() + x);
+				break;
+			case 0x15:
+				address = Fetch16() + x;
+				break;
+			case 0x16:
+				address = Fetch16() + y;
+				break;
+			default:
+				address = ReadDP16(Fetch()) + y;
+				break;
+			}
+			operand = Read(address);
+		}
+		a = Alu(operation, a, operand);
+		return cycles;
+	}
+
+	// ASL, ROL, LSR, ROR, DEC and INC on d, !a, d+X and A
+	if (opcode < 0xc0 && (column == 0x0b || column == 0x0c)) {
+		int operation = opcode >> 5;
+		if (column == 0x0c && odd_row) {
+			a = Shift(operation, a);
+			return cycles;
+		}
+
+		uint16_t address;
+		if (column == 0x0c) {
+			address = Fetch16();
+		}
+		else {
+			uint8_t offset = Fetch();
+			address = dp_base | (uint8_t)(odd_row ? offset + x : offset);
+		}
+		Write(address, Shift(operation, Read(address)));
+		return cycles;
+	}
+
+	switch (column) {
+	case 0x01:
+		// TCALL n
+		Push((uint8_t)(pc >> 8));
+		Push((uint8_t)pc);
+		pc = Read16((uint16_t)(0xffde - (opcode >> 4) * 2));
+		return cycles;
+
+	case 0x02:
+	{
+		// SET1/CLR1 d.b
+		uint8_t offset = Fetch();
+		uint8_t mask = (uint8_t)(1 << (opcode >> 5));
+		uint8_t value = ReadDP(offset);
+		WriteDP(offset, odd_row ? (value & ~mask) : (value | mask));
+		return cycles;
+	}
+
+	case 0x03:
+	{
+		// BBS/BBC d.b,r
+		uint8_t value = ReadDP(Fetch());
+		bool set = ((value >> (opcode >> 5)) & 1) != 0;
+		return cycles + Branch(set != odd_row);
+	}
+	}
+
+	switch (opcode) {
+	case 0x00:  // NOP
+		break;
+
+	case 0x10:  // BPL
+		cycles += Branch(!flag_n);
+		break;
+
+	case 0x30:  // BMI
+		cycles += Branch(flag_n);
+		break;
+
+	case 0x50:  // BVC
+		cycles += Branch(!flag_v);
+		break;
+
+	case 0x70:  // BVS
+		cycles += Branch(flag_v);
+		break;
+
+	case 0x90:  // BCC
+		cycles += Branch(!flag_c);
+		break;
+
+	case 0xb0:  // BCS
+		cycles += Branch(flag_c);
+		break;
+
+	case 0xd0:  // BNE
+		cycles += Branch(!flag_z);
+		break;
+
+	case 0xf0:  // BEQ
+		cycles += Branch(flag_z);
+		break;
+
+	case 0x2f:  // BRA
+		cycles += Branch(true);
+		break;
+
+	case 0x20:  // CLRP
+		flag_p = false;
+		dp_base = 0;
+		break;
+
+	case 0x40:  // SETP
+		flag_p = true;
+		dp_base = 0x100;
+		break;
+
+	case 0x60:  // CLRC
+		flag_c = false;
+		break;
+
+	case 0x80:  // SETC
+		flag_c = true;
+		break;
+
+	case 0xa0:  // EI
+		flag_i = true;
+		break;
+
+	case 0xc0:  // DI
+		flag_i = false;
+		break;
+
+	case 0xe0:  // CLRV
+		flag_v = false;
+		flag_h = false;
+		break;
+
+	case 0xed:  // NOTC
+		flag_c = !flag_c;
+		break;
+
+	case 0xc4:  // MOV d,A
+		WriteDP(Fetch(), a);
+		break;
+
+	case 0xc5:  // MOV !a,A
+		Write(Fetch16(), a);
+		break;
+
+	case 0xc6:  // MOV (X),A
+		WriteDP(x, a);
+		break;
+
+	case 0xc7:  // MOV [d+X],A
+		Write(ReadDP16((uint8_t)(Fetch() + x)), a);
+		break;
+
+	case 0xd4:  // MOV d+X,A
+		WriteDP((uint8_t)(Fetch() + x), a);
+		break;
+
+	case 0xd5:  // MOV !a+X,A
+		Write((uint16_t)(Fetch16() + x), a);
+		break;
+
+	case 0xd6:  // MOV !a+Y,A
+		Write((uint16_t)(Fetch16() + y), a);
+		break;
+
+	case 0xd7:  // MOV [d]+Y,A
+		Write((uint16_t)(ReadDP16(Fetch()) + y), a);
+		break;
+
+	case 0xaf:  // MOV (X)+,A
+		WriteDP(x++, a);
+		break;
+
+	case 0xc9:  // MOV !a,X
+		Write(Fetch16(), x);
+		break;
+
+	case 0xd8:  // MOV d,X
+		WriteDP(Fetch(), x);
+		break;
+
+	case 0xd9:  // MOV d+Y,X
+		WriteDP((uint8_t)(Fetch() + y), x);
+		break;
+
+	case 0xcb:  // MOV d,Y
+		WriteDP(Fetch(), y);
+		break;
+
+	case 0xcc:  // MOV !a,Y
+		Write(Fetch16(), y);
+		break;
+
+	case 0xdb:  // MOV d+X,Y
+		WriteDP((uint8_t)(Fetch() + x), y);
+		break;
+
+	case 0xe4:  // MOV A,d
+		a = ReadDP(Fetch());
+		SetNZ(a);
+		break;
+
+	case 0xe5:  // MOV A,!a
+		a = Read(Fetch16());
+		SetNZ(a);
+		break;
+
+	case 0xe6:  // MOV A,(X)
+		a = ReadDP(x);
+		SetNZ(a);
+		break;
+
+	case 0xe7:  // MOV A,[d+X]
+		a = Read(ReadDP16((uint8_t)(Fetch() + x)));
+		SetNZ(a);
+		break;
+
+	case 0xe8:  // MOV A,#i
+		a = Fetch();
+		SetNZ(a);
+		break;
+
+	case 0xf4:  // MOV A,d+X
+		a = ReadDP((uint8_t)(Fetch() + x));
+		SetNZ(a);
+		break;
+
+	case 0xf5:  // MOV A,!a+X
+		a = Read((uint16_t)(Fetch16() + x));
+		SetNZ(a);
+		break;
+
+	case 0xf6:  // MOV A,!a+Y
+		a = Read((uint16_t)(Fetch16() + y));
+		SetNZ(a);
+		break;
+
+	case 0xf7:  // MOV A,[d]+Y
+		a = Read((uint16_t)(ReadDP16(Fetch()) + y));
+		SetNZ(a);
+		break;
+
+	case 0xbf:  // MOV A,(X)+
+		a = ReadDP(x++);
+		SetNZ(a);
+		break;
+
+	case 0xe9:  // MOV X,!a
+		x = Read(Fetch16());
+		SetNZ(x);
+		break;
+
+	case 0xf8:  // MOV X,d
+		x = ReadDP(Fetch());
+		SetNZ(x);
+		break;
+
+	case 0xf9:  // MOV X,d+Y
+		x = ReadDP((uint8_t)(Fetch() + y));
+		SetNZ(x);
+		break;
+
+	case 0xcd:  // MOV X,#i
+		x = Fetch();
+		SetNZ(x);
+		break;
+
+	case 0xeb:  // MOV Y,d
+		y = ReadDP(Fetch());
+		SetNZ(y);
+		break;
+
+	case 0xec:  // MOV Y,!a
+		y = Read(Fetch16());
+		SetNZ(y);
+		break;
+
+	case 0xfb:  // MOV Y,d+X
+		y = ReadDP((uint8_t)(Fetch() + x));
+		SetNZ(y);
+		break;
+
+	case 0x8d:  // MOV Y,#i
+		y = Fetch();
+		SetNZ(y);
+		break;
+
+	case 0x5d:  // MOV X,A
+		x = a;
+		SetNZ(x);
+		break;
+
+	case 0x7d:  // MOV A,X
+		a = x;
+		SetNZ(a);
+		break;
+
+	case 0xdd:  // MOV A,Y
+		a = y;
+		SetNZ(a);
+		break;
+
+	case 0xfd:  // MOV Y,A
+		y = a;
+		SetNZ(y);
+		break;
+
+	case 0x9d:  // MOV X,SP
+		x = sp;
+		SetNZ(x);
+		break;
+
+	case 0xbd:  // MOV SP,X
+		sp = x;
+		break;
+
+	case 0xfa:  // MOV dd,ds
+	{
+		uint8_t value = ReadDP(Fetch());
+		WriteDP(Fetch(), value);
+		break;
+	}
+
+	case 0x8f:  // MOV d,#i
+	{
+		uint8_t value = Fetch();
+		WriteDP(Fetch(), value);
+		break;
+	}
+
+	case 0xc8:  // CMP X,#i
+		Alu(3, x, Fetch());
+		break;
+
+	case 0x1e:  // CMP X,!a
+		Alu(3, x, Read(Fetch16()));
+		break;
+
+	case 0x3e:  // CMP X,d
+		Alu(3, x, ReadDP(Fetch()));
+		break;
+
+	case 0xad:  // CMP Y,#i
+		Alu(3, y, Fetch());
+		break;
+
+	case 0x5e:  // CMP Y,!a
+		Alu(3, y, Read(Fetch16()));
+		break;
+
+	case 0x7e:  // CMP Y,d
+		Alu(3, y, ReadDP(Fetch()));
+		break;
+
+	case 0x1d:  // DEC X
+		SetNZ(--x);
+		break;
+
+	case 0x3d:  // INC X
+		SetNZ(++x);
+		break;
+
+	case 0xdc:  // DEC Y
+		SetNZ(--y);
+		break;
+
+	case 0xfc:  // INC Y
+		SetNZ(++y);
+		break;
+
+	case 0x1a:  // DECW d
+	case 0x3a:  // INCW d
+	{
+		uint8_t offset = Fetch();
+		uint16_t value = ReadDP16(offset) + ((opcode == 0x3a) ? 1 : -1);
+		WriteDP(offset, (uint8_t)value);
+		WriteDP((uint8_t)(offset + 1), (uint8_t)(value >> 8));
+		SetNZ16(value);
+		break;
+	}
+
+	case 0x5a:  // CMPW YA,d
+	{
+		uint16_t ya = (y << 8) | a;
+		uint16_t value = ReadDP16(Fetch());
+		flag_c = (ya >= value);
+		SetNZ16((uint16_t)(ya - value));
+		break;
+	}
+
+	case 0x7a:  // ADDW YA,d
+	case 0x9a:  // SUBW YA,d
+	{
+		int ya = (y << 8) | a;
+		int value = ReadDP16(Fetch());
+		int result;
+		if (opcode == 0x7a) {
+			result = ya + value;
+			flag_c = (result > 0xffff);
+			flag_h = ((ya ^ value ^ result) & 0x1000) != 0;
+			flag_v = (~(ya ^ value) & (ya ^ result) & 0x8000) != 0;
+		}
+		else {
+			result = ya - value;
+			flag_c = (result >= 0);
+			flag_h = ((ya ^ value ^ result) & 0x1000) == 0;
+			flag_v = ((ya ^ value) & (ya ^ result) & 0x8000) != 0;
+		}
+		a = (uint8_t)result;
+		y = (uint8_t)(result >> 8);
+		SetNZ16((uint16_t)result);
+		break;
+	}
+
+	case 0xba:  // MOVW YA,d
+	{
+		uint16_t value = ReadDP16(Fetch());
+		a = (uint8_t)value;
+		y = (uint8_t)(value >> 8);
+		SetNZ16(value);
+		break;
+	}
+
+	case 0xda:  // MOVW d,YA
+	{
+		uint8_t offset = Fetch();
+		WriteDP(offset, a);
+		WriteDP((uint8_t)(offset + 1), y);
+		break;
+	}
+
+	case 0xcf:  // MUL YA
+	{
+		uint16_t result = y * a;
+		a = (uint8_t)result;
+		y = (uint8_t)(result >> 8);
+		SetNZ(y);
+		break;
+	}
+
+	case 0x9e:  // DIV YA,X
+	{
+		// the hardware algorithm, which also gives defined results for
+		// quotients over 511 and a division by zero
+		int ya = (y << 8) | a;
+		flag_v = (y >= x);
+		flag_h = ((y & 15) >= (x & 15));
+		if (y < (x << 1)) {
+			a = (uint8_t)(ya / x);
+			y = (uint8_t)(ya % x);
+		}
+		else {
+			a = (uint8_t)(255 - (ya - (x << 9)) / (256 - x));
+			y = (uint8_t)(x + (ya - (x << 9)) % (256 - x));
+		}
+		SetNZ(a);
+		break;
+	}
+
+	case 0xdf:  // DAA
+		if (flag_c || a > 0x99) {
+			a += 0x60;
+			flag_c = true;
+		}
+		if (flag_h || (a & 15) > 9) {
+			a += 6;
+		}
+		SetNZ(a);
+		break;
+
+	case 0xbe:  // DAS
+		if (!flag_c || a > 0x99) {
+			a -= 0x60;
+			flag_c = false;
+		}
+		if (!flag_h || (a & 15) > 9) {
+			a -= 6;
+		}
+		SetNZ(a);
+		break;
+
+	case 0x9f:  // XCN
+		a = (uint8_t)((a >> 4) | (a << 4));
+		SetNZ(a);
+		break;
+
+	case 0x0e:  // TSET1 !a
+	case 0x4e:  // TCLR1 !a
+	{
+		uint16_t address = Fetch16();
+		uint8_t value = Read(address);
+		SetNZ((uint8_t)(a - value));
+		Write(address, (opcode == 0x0e) ? (value | a) : (value & ~a));
+		break;
+	}
+
+	case 0x0a:  // OR1 C,m.b
+	case 0x2a:  // OR1 C,/m.b
+	case 0x4a:  // AND1 C,m.b
+	case 0x6a:  // AND1 C,/m.b
+	case 0x8a:  // EOR1 C,m.b
+	case 0xaa:  // MOV1 C,m.b
+	case 0xca:  // MOV1 m.b,C
+	case 0xea:  // NOT1 m.b
+	{
+		uint16_t operand = Fetch16();
+		uint16_t address = operand & 0x1fff;
+		int bit = operand >> 13;
+		uint8_t value = Read(address);
+		bool set = ((value >> bit) & 1) != 0;
+		switch (opcode) {
+		case 0x0a:
+			flag_c = flag_c || set;
+			break;
+		case 0x2a:
+			flag_c = flag_c || !set;
+			break;
+		case 0x4a:
+			flag_c = flag_c && set;
+			break;
+		case 0x6a:
+			flag_c = flag_c && !set;
+			break;
+		case 0x8a:
+			flag_c = flag_c != set;
+			break;
+		case 0xaa:
+			flag_c = set;
+			break;
+		case 0xca:
+			Write(address, (uint8_t)((value & ~(1 << bit)) | ((flag_c ? 1 : 0) << bit)));
+			break;
+		default:
+			Write(address, (uint8_t)(value ^ (1 << bit)));
+			break;
+		}
+		break;
+	}
+
+	case 0x2e:  // CBNE d,r
+	{
+		uint8_t value = ReadDP(Fetch());
+		cycles += Branch(a != value);
+		break;
+	}
+
+	case 0xde:  // CBNE d+X,r
+	{
+		uint8_t value = ReadDP((uint8_t)(Fetch() + x));
+		cycles += Branch(a != value);
+		break;
+	}
+
+	case 0x6e:  // DBNZ d,r
+	{
+		uint8_t offset = Fetch();
+		uint8_t value = ReadDP(offset) - 1;
+		WriteDP(offset, value);
+		cycles += Branch(value != 0);
+		break;
+	}
+
+	case 0xfe:  // DBNZ Y,r
+		cycles += Branch(--y != 0);
+		break;
+
+	case 0x0d:  // PUSH PSW
+		Push(GetPSW());
+		break;
+
+	case 0x2d:  // PUSH A
+		Push(a);
+		break;
+
+	case 0x4d:  // PUSH X
+		Push(x);
+		break;
+
+	case 0x6d:  // PUSH Y
+		Push(y);
+		break;
+
+	case 0x8e:  // POP PSW
+		SetPSW(Pop());
+		break;
+
+	case 0xae:  // POP A
+		a = Pop();
+		break;
+
+	case 0xce:  // POP X
+		x = Pop();
+		break;
+
+	case 0xee:  // POP Y
+		y = Pop();
+		break;
+
+	case 0x1f:  // JMP [!a+X]
+		pc = Read16((uint16_t)(Fetch16() + x));
+		break;
+
+	case 0x5f:  // JMP !a
+		pc = Fetch16();
+		break;
+
+	case 0x3f:  // CALL !a
+	{
+		uint16_t address = Fetch16();
+		Push((uint8_t)(pc >> 8));
+		Push((uint8_t)pc);
+		pc = address;
+		break;
+	}
+
+	case 0x4f:  // PCALL u
+	{
+		uint8_t offset = Fetch();
+		Push((uint8_t)(pc >> 8));
+		Push((uint8_t)pc);
+		pc = 0xff00 | offset;
+		break;
+	}
+
+	case 0x0f:  // BRK
+		Push((uint8_t)(pc >> 8));
+		Push((uint8_t)pc);
+		Push(GetPSW());
+		flag_b = true;
+		flag_i = false;
+		pc = Read16(0xffde);
+		break;
+
+	case 0x6f:  // RET
+	{
+		uint8_t low = Pop();
+		pc = low | (Pop() << 8);
+		break;
+	}
+
+	case 0x7f:  // RETI
+	{
+		SetPSW(Pop());
+		uint8_t low = Pop();
+		pc = low | (Pop() << 8);
+		break;
+	}
+
+	default:
+		// SLEEP and STOP; nothing can wake the CPU up from here
+		halted = true;
+		break;
+	}
+	return cycles;
+}
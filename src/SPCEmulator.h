@@ -0,0 +1,165 @@
+#ifndef SPCEMULATOR_H_INCLUDED
+#define SPCEMULATOR_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <vector>
+
+class SPCFileView;
+
+// Headless SPC700 with its timers and the S-DSP register file, to run a
+// snapshot ahead as fast as possible. No sound is made: voices are not
+// synthesized, the DSP only remembers the SRCN of every voice keyed on.
+// That is all a sound driver needs to go on playing its song, as long as
+// it does not wait on the envelope (ENVX/OUTX) of a voice.
+class SPCEmulator
+{
+public:
+	static const uint32_t CLOCK_RATE = 1024000;    // CPU cycles per second
+
+	SPCEmulator();
+	virtual ~SPCEmulator();
+
+	void Load(const SPCFileView & spc_file);
+
+	// Runs for the given number of cycles, or until SLEEP/STOP (or an
+	// unknown state) halts the CPU; returns false once it has halted.
+	bool Run(uint64_t cycles);
+
+	inline uint64_t GetCycles(void) const {
+		return total_cycles;
+	}
+
+	inline bool IsKeyedOn(uint8_t srcn) const {
+		return keyed_on[srcn];
+	}
+
+	// SRCNs keyed on since Load(), in ascending order
+	std::vector<uint8_t> GetKeyedOnSamples(void) const;
+
+private:
+	SPCEmulator(const SPCEmulator &);
+	SPCEmulator & operator=(const SPCEmulator &);
+
+	struct Timer {
+		bool enabled;
+		int period;     // cycles per stage 1 tick
+		uint64_t elapsed;
+		int target;     // 1-256
+		int divider;
+		uint8_t counter;
+	};
+
+	inline uint8_t Read(uint16_t address) {
+		if ((address & 0xfff0) == 0x00f0) {
+			return ReadIO(address);
+		}
+		if (address >= 0xffc0 && ipl_enabled) {
+			return ipl_rom[address - 0xffc0];
+		}
+		return ram[address];
+	}
+
+	// writes to the IPL ROM area go to the RAM under it
+	inline void Write(uint16_t address, uint8_t value) {
+		if ((address & 0xfff0) == 0x00f0) {
+			WriteIO(address, value);
+		}
+		else {
+			ram[address] = value;
+		}
+	}
+
+	inline uint16_t Read16(uint16_t address) {
+		return Read(address) | (Read((uint16_t)(address + 1)) << 8);
+	}
+
+	inline uint8_t ReadDP(uint8_t offset) {
+		return Read(dp_base | offset);
+	}
+
+	inline void WriteDP(uint8_t offset, uint8_t value) {
+		Write(dp_base | offset, value);
+	}
+
+	// the high byte wraps around within the direct page
+	inline uint16_t ReadDP16(uint8_t offset) {
+		return ReadDP(offset) | (ReadDP((uint8_t)(offset + 1)) << 8);
+	}
+
+	inline uint8_t Fetch(void) {
+		return Read(pc++);
+	}
+
+	inline uint16_t Fetch16(void) {
+		uint16_t value = Read16(pc);
+		pc += 2;
+		return value;
+	}
+
+	inline void Push(uint8_t value) {
+		ram[0x100 | sp--] = value;
+	}
+
+	inline uint8_t Pop(void) {
+		return ram[0x100 | ++sp];
+	}
+
+	inline void SetNZ(uint8_t value) {
+		flag_n = (value & 0x80) != 0;
+		flag_z = (value == 0);
+	}
+
+	inline void SetNZ16(uint16_t value) {
+		flag_n = (value & 0x8000) != 0;
+		flag_z = (value == 0);
+	}
+
+	uint8_t ReadIO(uint16_t address);
+	void WriteIO(uint16_t address, uint8_t value);
+	void WriteDSP(uint8_t address, uint8_t value);
+	// the timers are brought up to date only when the CPU accesses them
+	void UpdateTimers(void);
+
+	uint8_t GetPSW(void) const;
+	void SetPSW(uint8_t psw);
+
+	uint8_t Alu(int operation, uint8_t lhs, uint8_t rhs);
+	uint8_t Shift(int operation, uint8_t value);
+	int Branch(bool condition);
+	int Step(void);
+
+	static const uint8_t ipl_rom[0x40];
+	static const uint8_t cycle_table[0x100];
+
+	uint8_t ram[0x10000];
+	uint8_t dsp[0x80];
+
+	uint16_t pc;
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	uint8_t sp;
+	bool flag_n;
+	bool flag_v;
+	bool flag_p;
+	bool flag_b;
+	bool flag_h;
+	bool flag_i;
+	bool flag_z;
+	bool flag_c;
+	uint16_t dp_base;
+
+	bool ipl_enabled;
+	uint8_t dsp_address;
+	uint8_t in_ports[4];
+	Timer timers[3];
+	uint64_t timers_cycles;
+
+	bool halted;
+	uint64_t total_cycles;
+	bool keyed_on[256];
+};
+
+#endif /* !SPCEMULATOR_H_INCLUDED */
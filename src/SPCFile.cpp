@@ -13,6 +13,22 @@
 #include <map>
 #include <iterator>
 #include <algorithm>
+#include <atomic>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "SPCFile.h"
 #include "cpath.h"
@@ -28,14 +44,29 @@
 
 #define XID6_TICK_UNIT          64000
 
+#ifndef _WIN32
+static bool write_all(int fd, const uint8_t * data, size_t size, off_t offset)
+{
+	while (size != 0) {
+		ssize_t written = pwrite(fd, data, size, offset);
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+#endif
+
 #define ALIGN32(x)  (((x) + 3) & ~3)
 
 SPCFile::SPCFile() :
-	samp_dir_length(0)
+	samp_dir_length(0),
+	load_mode(LOAD_FULL)
 {
-	memset(ram, 0xff, 0x10000);
-	memset(dsp, 0xff, 0x80);
-	memset(extra_ram, 0xff, 0x40);
+	Reset();
 }
 
 SPCFile::~SPCFile()
@@ -47,13 +78,14 @@ bool SPCFile::IsSPCFile(const std::string& filename)
 	FILE *fp = NULL;
 	uint8_t header[SPC_HEADER_SIZE];
 
-	off_t off_spc_size = path_getfilesize(filename.c_str());
-	if (off_spc_size == -1 || off_spc_size < SPC_MIN_SIZE) {
+	fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) {
 		return false;
 	}
 
-	fp = fopen(filename.c_str(), "rb");
-	if (fp == NULL) {
+	off_t off_spc_size = file_getsize(fp);
+	if (off_spc_size == -1 || off_spc_size < SPC_MIN_SIZE) {
+		fclose(fp);
 		return false;
 	}
 
@@ -62,8 +94,7 @@ bool SPCFile::IsSPCFile(const std::string& filename)
 		return false;
 	}
 
-	if (memcmp(header, SPC_SIGNATURE_HEAD, strlen(SPC_SIGNATURE_HEAD)) != 0 ||
-		header[0x21] != 0x1a || header[0x22] != 0x1a) {
+	if (!IsSPCFile(header, (size_t)off_spc_size)) {
 		fclose(fp);
 		return false;
 	}
@@ -72,112 +103,238 @@ bool SPCFile::IsSPCFile(const std::string& filename)
 	return true;
 }
 
-SPCFile * SPCFile::Load(const std::string& filename)
+bool SPCFile::IsSPCFile(const uint8_t * data, size_t size)
 {
-	char * endptr;
+	if (size < SPC_MIN_SIZE) {
+		return false;
+	}
 
-	off_t off_spc_size = path_getfilesize(filename.c_str());
-	if (off_spc_size == -1 || off_spc_size < SPC_MIN_SIZE) {
+	if (memcmp(data, SPC_SIGNATURE_HEAD, strlen(SPC_SIGNATURE_HEAD)) != 0 ||
+		data[0x21] != 0x1a || data[0x22] != 0x1a) {
+		return false;
+	}
+
+	return true;
+}
+
+SPCFile * SPCFile::Load(const std::string& filename, LoadMode mode)
+{
+	SPCFile * spc = new SPCFile();
+	if (!LoadInto(filename, *spc, mode)) {
+		delete spc;
 		return NULL;
 	}
-	size_t spc_size = (size_t) off_spc_size;
+	return spc;
+}
 
+SPCFile * SPCFile::LoadFromMemory(const uint8_t * data, size_t size, LoadMode mode)
+{
+	SPCFile * spc = new SPCFile();
+	if (!LoadFromMemoryInto(data, size, *spc, mode)) {
+		delete spc;
+		return NULL;
+	}
+	return spc;
+}
+
+bool SPCFile::LoadInto(const std::string& filename, SPCFile & spc, LoadMode mode)
+{
 	FILE * fp = fopen(filename.c_str(), "rb");
 	if (fp == NULL) {
-		return NULL;
+		return false;
 	}
 
+	off_t off_spc_size = file_getsize(fp);
+	if (off_spc_size == -1 || off_spc_size < SPC_MIN_SIZE) {
+		fclose(fp);
+		return false;
+	}
+	size_t spc_size = (size_t) off_spc_size;
+
 	// read header
 	uint8_t header[SPC_HEADER_SIZE];
 	if (fread(header, 1, SPC_HEADER_SIZE, fp) != SPC_HEADER_SIZE) {
 		fclose(fp);
-		return NULL;
+		return false;
 	}
-	rewind(fp);
 
 	// signature
-	if (memcmp(header, SPC_SIGNATURE_HEAD, strlen(SPC_SIGNATURE_HEAD)) != 0 ||
-		header[0x21] != 0x1a || header[0x22] != 0x1a) {
+	if (!IsSPCFile(header, spc_size)) {
 		fclose(fp);
-		return NULL;
+		return false;
 	}
 
-	// read whole file
-	uint8_t * data = new uint8_t[spc_size];
-	if (fread(data, 1, spc_size, fp) != spc_size) {
-		delete[] data;
-		fclose(fp);
-		return NULL;
+	if (mode == LOAD_TAGS_ONLY) {
+		// jump over RAM and DSP registers, only the xid6 chunk is needed
+		spc.load_buffer.clear();
+
+		uint8_t xid6_header[8];
+		if (spc_size > SPC_MIN_SIZE + 8 &&
+			fseek(fp, SPC_MIN_SIZE, SEEK_SET) == 0 &&
+			fread(xid6_header, 1, 8, fp) == 8 &&
+			memcmp(xid6_header, "xid6", 4) == 0) {
+			uint32_t xid6_whole_size = xid6_header[4] | (xid6_header[5] << 8) | (xid6_header[6] << 16) | (xid6_header[7] << 24);
+			size_t xid6_size = std::min<size_t>(8 + (size_t)xid6_whole_size, spc_size - SPC_MIN_SIZE);
+
+			spc.load_buffer.resize(xid6_size);
+			memcpy(&spc.load_buffer[0], xid6_header, 8);
+			// an empty chunk has nothing past the header to read
+			if (xid6_size > 8 && fread(&spc.load_buffer[8], 1, xid6_size - 8, fp) != xid6_size - 8) {
+				fclose(fp);
+				return false;
+			}
+		}
 	}
+	else {
+		// read RAM, DSP registers and extra RAM straight into the object
+		uint8_t reserved[0x40];
+		if (fread(spc.ram, 1, 0x10000, fp) != 0x10000 ||
+			fread(spc.dsp, 1, 0x80, fp) != 0x80 ||
+			fread(reserved, 1, 0x40, fp) != 0x40 ||
+			fread(spc.extra_ram, 1, 0x40, fp) != 0x40) {
+			fclose(fp);
+			spc.Reset();
+			return false;
+		}
 
-	// create new SPC object
-	SPCFile * spc = new SPCFile();
+		// read trailing Extended ID666 into the reusable buffer
+		spc.load_buffer.resize(spc_size - SPC_MIN_SIZE);
+		if (spc.load_buffer.size() != 0) {
+			if (fread(&spc.load_buffer[0], 1, spc.load_buffer.size(), fp) != spc.load_buffer.size()) {
+				fclose(fp);
+				spc.Reset();
+				return false;
+			}
+		}
+	}
 
-	// SPC700 registers
-	spc->regs.pc = header[0x25] | (header[0x26] << 8);
-	spc->regs.a = header[0x27];
-	spc->regs.x = header[0x28];
-	spc->regs.y = header[0x29];
-	spc->regs.psw = header[0x2a];
-	spc->regs.sp = header[0x2b];
+	fclose(fp);
+
+	// SPC700 registers and ID666 tags
+	ParseHeader(header, spc.regs, spc.tags);
+
+	// Parse Extended ID666 if available
+	if (spc.load_buffer.size() != 0) {
+		ParseXID6(&spc.load_buffer[0], spc.load_buffer.size(), spc.tags);
+	}
+
+	// Parse sample dir
+	if (mode != LOAD_TAGS_ONLY) {
+		spc.ParseSampDir();
+	}
+
+	spc.load_mode = mode;
+	return true;
+}
+
+bool SPCFile::LoadFromMemoryInto(const uint8_t * data, size_t size, SPCFile & spc, LoadMode mode)
+{
+	// signature
+	if (!IsSPCFile(data, size)) {
+		return false;
+	}
+
+	// SPC700 registers and ID666 tags
+	ParseHeader(data, spc.regs, spc.tags);
+
+	// Parse Extended ID666 if available
+	ParseXID6(&data[SPC_MIN_SIZE], size - SPC_MIN_SIZE, spc.tags);
+
+	spc.load_mode = mode;
+	if (mode == LOAD_TAGS_ONLY) {
+		return true;
+	}
 
 	// RAM
-	memcpy(spc->ram, &data[0x100], 0x10000);
+	memcpy(spc.ram, &data[0x100], 0x10000);
 	
 	// DSP registers
-	memcpy(spc->dsp, &data[0x10100], 0x80);
+	memcpy(spc.dsp, &data[0x10100], 0x80);
 
 	// Extra RAM
-	memcpy(spc->extra_ram, &data[0x101c0], 0x40);
+	memcpy(spc.extra_ram, &data[0x101c0], 0x40);
+
+	// Parse sample dir
+	spc.ParseSampDir();
+
+	return true;
+}
+
+void SPCFile::Reset()
+{
+	memset(&regs, 0, sizeof(regs));
+	memset(ram, 0xff, 0x10000);
+	memset(dsp, 0xff, 0x80);
+	memset(extra_ram, 0xff, 0x40);
+	tags.clear();
+
+	for (int samp = 0; samp < 256; samp++) {
+		samples[samp] = SPCSampDir();
+	}
+	samp_dir_length = 0;
+	load_mode = LOAD_FULL;
+}
+
+void SPCFile::ParseHeader(const uint8_t * header, SPCRegisters & regs, XID6TagMap & tags)
+{
+	char * endptr;
+
+	// SPC700 registers
+	regs.pc = header[0x25] | (header[0x26] << 8);
+	regs.a = header[0x27];
+	regs.x = header[0x28];
+	regs.y = header[0x29];
+	regs.psw = header[0x2a];
+	regs.sp = header[0x2b];
 
 	// Parse [ID666](http://vspcplay.raphnet.net/spc_file_format.txt) if available.
-	spc->tags.clear();
+	tags.clear();
 	if (header[0x23] == 0x1a) {
 		char s[256];
 		uint32_t u;
 
 		memcpy(s, &header[0x2e], 32);
 		s[32] = '\0';
-		spc->SetStringTag(XID6_SONG_NAME, s);
+		SetStringTag(tags, XID6_SONG_NAME, s);
 
 		memcpy(s, &header[0x4e], 32);
 		s[32] = '\0';
-		spc->SetStringTag(XID6_GAME_NAME, s);
+		SetStringTag(tags, XID6_GAME_NAME, s);
 
 		memcpy(s, &header[0x6e], 16);
 		s[16] = '\0';
-		spc->SetStringTag(XID6_DUMPER_NAME, s);
+		SetStringTag(tags, XID6_DUMPER_NAME, s);
 
 		memcpy(s, &header[0x7e], 32);
 		s[32] = '\0';
-		spc->SetStringTag(XID6_COMMENT, s);
+		SetStringTag(tags, XID6_COMMENT, s);
 
 		bool has_id666_song_length = false;
 		if (header[0xd2] < 0x30) {
 			// binary format
 			u = header[0x9e] | (header[0x9f] << 8) | (header[0xa0] << 16) | (header[0xa1] << 24);
 			if (u != 0) {
-				spc->SetIntegerTag(XID6_DUMPED_DATE, u, 4);
+				SetIntegerTag(tags, XID6_DUMPED_DATE, u, 4);
 			}
 
 			u = header[0xa9] | (header[0xaa] << 8) | (header[0xab] << 16);
 			if (u != 0) {
-				spc->SetIntegerTag(XID6_INTRO_LENGTH, XID6TicksToMilliSeconds(u) / 1000, 4);
+				SetIntegerTag(tags, XID6_INTRO_LENGTH, XID6TicksToMilliSeconds(u) / 1000, 4);
 				has_id666_song_length = true;
 			}
 
 			u = header[0xac] | (header[0xad] << 8) | (header[0xae] << 16) | (header[0xaf] << 24);
 			if (has_id666_song_length || u != 0) {
-				spc->SetIntegerTag(XID6_FADE_LENGTH, XID6TicksToMilliSeconds(u), 4);
+				SetIntegerTag(tags, XID6_FADE_LENGTH, XID6TicksToMilliSeconds(u), 4);
 			}
 
 			memcpy(s, &header[0xb0], 32);
 			s[32] = '\0';
-			spc->SetStringTag(XID6_ARTIST_NAME, s);
+			SetStringTag(tags, XID6_ARTIST_NAME, s);
 
 			// [0xd0] Default channel disables (0 = enable, 1 = disable)
 
-			spc->SetIntegerTag(XID6_EMULATOR, header[0xd1], 1);
+			SetIntegerTag(tags, XID6_EMULATOR, header[0xd1], 1);
 		}
 		else {
 			// text format
@@ -190,7 +347,7 @@ SPCFile * SPCFile::Load(const std::string& filename)
 
 				// MM/DD/YYYY is expected (according to SPC File Format v0.30)
 				if (ParseDateString(s, year, month, day)) {
-					spc->SetIntegerTag(XID6_DUMPED_DATE, year * 10000 + month * 100 + day, 4);
+					SetIntegerTag(tags, XID6_DUMPED_DATE, year * 10000 + month * 100 + day, 4);
 				}
 				else {
 					fprintf(stderr, "Warning: Unable to parse ID666 dumped date\n");
@@ -202,7 +359,7 @@ SPCFile * SPCFile::Load(const std::string& filename)
 			if (strcmp(s, "") != 0) {
 				u = strtoul(s, &endptr, 10);
 				if (*endptr == '\0') {
-					spc->SetIntegerTag(XID6_INTRO_LENGTH, XID6TicksToMilliSeconds(u) / 1000, 4);
+					SetIntegerTag(tags, XID6_INTRO_LENGTH, XID6TicksToMilliSeconds(u) / 1000, 4);
 				}
 				else {
 					fprintf(stderr, "Warning: Unable to parse ID666 playback length\n");
@@ -214,7 +371,7 @@ SPCFile * SPCFile::Load(const std::string& filename)
 			if (strcmp(s, "") != 0) {
 				u = strtoul(s, &endptr, 10);
 				if (*endptr == '\0') {
-					spc->SetIntegerTag(XID6_FADE_LENGTH, u * XID6TicksToMilliSeconds(u), 4);
+					SetIntegerTag(tags, XID6_FADE_LENGTH, u * XID6TicksToMilliSeconds(u), 4);
 				}
 				else {
 					fprintf(stderr, "Warning: Unable to parse ID666 fade length\n");
@@ -223,7 +380,7 @@ SPCFile * SPCFile::Load(const std::string& filename)
 
 			memcpy(s, &header[0xb1], 32);
 			s[32] = '\0';
-			spc->SetStringTag(XID6_ARTIST_NAME, s);
+			SetStringTag(tags, XID6_ARTIST_NAME, s);
 
 			// [0xd1] Default channel disables (0 = enable, 1 = disable)
 
@@ -232,7 +389,7 @@ SPCFile * SPCFile::Load(const std::string& filename)
 			if (strcmp(s, "") != 0) {
 				u = strtoul(s, &endptr, 10);
 				if (*endptr == '\0') {
-					spc->SetIntegerTag(XID6_EMULATOR, u, 1);
+					SetIntegerTag(tags, XID6_EMULATOR, u, 1);
 				}
 				else {
 					fprintf(stderr, "Warning: Unable to parse ID666 emulator id\n");
@@ -240,66 +397,174 @@ SPCFile * SPCFile::Load(const std::string& filename)
 			}
 		}
 	}
+}
 
-	// Parse Extended ID666 if available
-	const size_t xid6_start_offset = 0x10200;
-	size_t xid6_offset = xid6_start_offset;
-	if (spc_size > xid6_offset + 8 && memcmp(&data[xid6_offset], "xid6", 4) == 0) {
+void SPCFile::ParseXID6(const uint8_t * xid6, size_t size, XID6TagMap & tags)
+{
+	size_t xid6_offset = 0;
+	if (size > 8 && memcmp(xid6, "xid6", 4) == 0) {
 		// get xid6 chunk size
-		uint32_t xid6_whole_size = data[xid6_offset + 4] | (data[xid6_offset + 5] << 8) | (data[xid6_offset + 6] << 16) | (data[xid6_offset + 7] << 24);
+		uint32_t xid6_whole_size = xid6[4] | (xid6[5] << 8) | (xid6[6] << 16) | (xid6[7] << 24);
 
 		// skip the xid6 header
 		xid6_offset += 8;
 
 		// determine the end offset
-		if (xid6_offset + xid6_whole_size > spc_size) {
-			xid6_whole_size = (uint32_t)(spc_size - xid6_offset);
+		if (xid6_offset + xid6_whole_size > size) {
+			xid6_whole_size = (uint32_t)(size - xid6_offset);
 		}
 		const size_t xid6_end_offset = xid6_offset + xid6_whole_size;
 
 		// read each sub-chunks
 		while (xid6_offset + 4 <= xid6_end_offset) {
-			XID6ItemId xid6_id = (XID6ItemId)data[xid6_offset];
-			XID6TypeId xid6_type = (XID6TypeId)data[xid6_offset + 1];
-			uint16_t xid6_length = data[xid6_offset + 2] | (data[xid6_offset + 3] << 8);
+			XID6ItemId xid6_id = (XID6ItemId)xid6[xid6_offset];
+			XID6TypeId xid6_type = (XID6TypeId)xid6[xid6_offset + 1];
+			uint16_t xid6_length = xid6[xid6_offset + 2] | (xid6[xid6_offset + 3] << 8);
 
 			if (xid6_type == XID6_TYPE_LENGTH) {
-				spc->SetTagValue(xid6_id, xid6_type, &data[xid6_offset + 2], 2);
+				SetTagValue(tags, xid6_id, xid6_type, &xid6[xid6_offset + 2], 2);
 				xid6_offset += 4;
 			}
 			else {
 				xid6_offset += 4;
 
 				if (xid6_offset + xid6_length <= xid6_end_offset) {
-					spc->SetTagValue(xid6_id, xid6_type, &data[xid6_offset], xid6_length);
+					SetTagValue(tags, xid6_id, xid6_type, &xid6[xid6_offset], xid6_length);
 				}
 
 				xid6_offset += ALIGN32(xid6_length);
 			}
 		}
 	}
+}
 
-	// Parse sample dir
-	spc->ParseSampDir();
+bool SPCFile::Save(const std::string& filename) const
+{
+	// RAM, DSP registers and samples may still hold a previous file
+	if (load_mode == LOAD_TAGS_ONLY) {
+		return false;
+	}
 
-	delete[] data;
-	fclose(fp);
+	// the image is assembled in memory and written once
+	std::vector<uint8_t> image(SPC_MIN_SIZE);
+	BuildHeader(&image[0]);
+	memcpy(&image[0x100], ram, 0x10000);
+	memcpy(&image[0x10100], dsp, 0x80);
+	memset(&image[0x10180], 0, 0x40);
+	memcpy(&image[0x101c0], extra_ram, 0x40);
 
-	return spc;
+	if (IsXID6Required()) {
+		std::vector<uint8_t> xid6 = GetXID6Block();
+		image.insert(image.end(), xid6.begin(), xid6.end());
+	}
+
+	// write to a temporary file next to the target, then rename it over the target,
+	// so that readers never see a partially written file; the serial keeps
+	// the names of threads saving at the same time apart
+	static std::atomic<unsigned int> temp_serial(0);
+	char temp_suffix[64];
+	sprintf(temp_suffix, ".tmp%lu.%u", (unsigned long)getpid(), temp_serial.fetch_add(1));
+	std::string temp_filename(filename + temp_suffix);
+
+#ifdef _WIN32
+	FILE * spc_file = fopen(temp_filename.c_str(), "wb");
+	if (spc_file == NULL) {
+		return false;
+	}
+
+	bool written = fwrite(&image[0], 1, image.size(), spc_file) == image.size();
+	written = (fflush(spc_file) == 0 && _commit(_fileno(spc_file)) == 0) && written;
+	fclose(spc_file);
+
+	if (!written || !MoveFileExA(temp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		remove(temp_filename.c_str());
+		return false;
+	}
+#else
+	int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if (fd == -1) {
+		return false;
+	}
+
+	// keep the permissions of the file being replaced
+	struct stat st;
+	if (stat(filename.c_str(), &st) == 0) {
+		fchmod(fd, st.st_mode & 07777);
+	}
+
+	bool written = write_all(fd, &image[0], image.size(), 0);
+	written = (fsync(fd) == 0) && written;
+	written = (close(fd) == 0) && written;
+
+	if (!written || rename(temp_filename.c_str(), filename.c_str()) != 0) {
+		unlink(temp_filename.c_str());
+		return false;
+	}
+#endif
+
+	return true;
 }
 
-bool SPCFile::Save(const std::string& filename) const
+bool SPCFile::SaveTags(const std::string& filename) const
 {
-	FILE * spc_file = fopen(filename.c_str(), "wb");
+	uint8_t header[0x100];
+	BuildHeader(header);
+
+	std::vector<uint8_t> xid6;
+	if (IsXID6Required()) {
+		xid6 = GetXID6Block();
+	}
+
+	// only the header and the trailing xid6 block change; RAM and DSP stay on disk as they are
+#ifdef _WIN32
+	FILE * spc_file = fopen(filename.c_str(), "r+b");
 	if (spc_file == NULL) {
 		return false;
 	}
 
-	uint8_t header[0x100];
-	memset(header, 0, 0x100);
+	uint8_t old_header[0x100];
+	if (file_getsize(spc_file) < SPC_MIN_SIZE || fread(old_header, 1, 0x100, spc_file) != 0x100 || !IsSPCFile(old_header, SPC_MIN_SIZE)) {
+		fclose(spc_file);
+		return false;
+	}
 
-	uint8_t reserved[0x40];
-	memset(reserved, 0, 0x40);
+	bool written = fseek(spc_file, 0, SEEK_SET) == 0 && fwrite(header, 1, 0x100, spc_file) == 0x100;
+	if (written && !xid6.empty()) {
+		written = fseek(spc_file, SPC_MIN_SIZE, SEEK_SET) == 0 && fwrite(&xid6[0], 1, xid6.size(), spc_file) == xid6.size();
+	}
+	written = (fflush(spc_file) == 0) && written;
+	written = written && _chsize_s(_fileno(spc_file), SPC_MIN_SIZE + xid6.size()) == 0;
+	fclose(spc_file);
+	return written;
+#else
+	int fd = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+
+	struct stat st;
+	uint8_t old_header[0x100];
+	if (fstat(fd, &st) != 0 || st.st_size < SPC_MIN_SIZE ||
+		pread(fd, old_header, 0x100, 0) != 0x100 || !IsSPCFile(old_header, SPC_MIN_SIZE)) {
+		close(fd);
+		return false;
+	}
+
+	bool written = write_all(fd, header, 0x100, 0);
+	if (written && !xid6.empty()) {
+		written = write_all(fd, &xid6[0], xid6.size(), SPC_MIN_SIZE);
+	}
+	if (written && (size_t)st.st_size != SPC_MIN_SIZE + xid6.size()) {
+		written = ftruncate(fd, SPC_MIN_SIZE + xid6.size()) == 0;
+	}
+	written = (close(fd) == 0) && written;
+	return written;
+#endif
+}
+
+void SPCFile::BuildHeader(uint8_t * header) const
+{
+	memset(header, 0, 0x100);
 
 	// signature and version
 	memcpy(header, SPC_SIGNATURE, strlen(SPC_SIGNATURE));
@@ -382,60 +647,18 @@ bool SPCFile::Save(const std::string& filename) const
 			header[0xd2] = '0';
 		}
 	}
+}
 
-	// write file header
-	if (fwrite(header, 1, 0x100, spc_file) != 0x100) {
-		fclose(spc_file);
-		return false;
-	}
-
-	// write RAM
-	if (fwrite(ram, 1, 0x10000, spc_file) != 0x10000) {
-		fclose(spc_file);
-		return false;
-	}
-
-	// write DSP registers
-	if (fwrite(dsp, 1, 0x80, spc_file) != 0x80) {
-		fclose(spc_file);
-		return false;
-	}
-
-	// write reserved area
-	if (fwrite(reserved, 1, 0x40, spc_file) != 0x40) {
-		fclose(spc_file);
-		return false;
-	}
-
-	// write extra RAM
-	if (fwrite(extra_ram, 1, 0x40, spc_file) != 0x40) {
-		fclose(spc_file);
-		return false;
-	}
-
-	// determine if Extended ID666 is required
-	bool xid6_required = false;
+bool SPCFile::IsXID6Required() const
+{
 	for (auto itr = tags.begin(); itr != tags.end(); ++itr) {
 		const XID6ItemId id = (*itr).first;
 
 		if (DoesTagRequireXID6(id)) {
-			xid6_required = true;
-			break;
-		}
-	}
-
-	// write Extended ID666
-	if (xid6_required) {
-		std::vector<uint8_t> xid6 = GetXID6Block();
-
-		if (fwrite(&xid6[0], 1, xid6.size(), spc_file) != xid6.size()) {
-			fclose(spc_file);
-			return false;
+			return true;
 		}
 	}
-
-	fclose(spc_file);
-	return true;
+	return false;
 }
 
 std::vector<uint8_t> SPCFile::GetXID6Block() const
@@ -587,6 +810,11 @@ bool SPCFile::DoesTagRequireXID6(XID6ItemId id) const
 }
 
 int SPCFile::GetIntegerTag(XID6ItemId id) const
+{
+	return GetIntegerTag(tags, id);
+}
+
+int SPCFile::GetIntegerTag(const XID6TagMap & tags, XID6ItemId id)
 {
 	if (tags.count(id) != 0) {
 		size_t size = std::min<size_t>(tags.at(id).value.size(), 4);
@@ -604,6 +832,11 @@ int SPCFile::GetIntegerTag(XID6ItemId id) const
 }
 
 std::string SPCFile::GetStringTag(XID6ItemId id) const
+{
+	return GetStringTag(tags, id);
+}
+
+std::string SPCFile::GetStringTag(const XID6TagMap & tags, XID6ItemId id)
 {
 	if (tags.count(id) != 0) {
 		return &tags.at(id).value[0];
@@ -620,6 +853,11 @@ void SPCFile::SetLengthTag(XID6ItemId id, uint16_t value)
 }
 
 void SPCFile::SetIntegerTag(XID6ItemId id, uint32_t value, size_t size)
+{
+	SetIntegerTag(tags, id, value, size);
+}
+
+void SPCFile::SetIntegerTag(XID6TagMap & tags, XID6ItemId id, uint32_t value, size_t size)
 {
 	std::vector<char> data;
 
@@ -635,6 +873,11 @@ void SPCFile::SetIntegerTag(XID6ItemId id, uint32_t value, size_t size)
 }
 
 void SPCFile::SetStringTag(XID6ItemId id, const std::string & str)
+{
+	SetStringTag(tags, id, str);
+}
+
+void SPCFile::SetStringTag(XID6TagMap & tags, XID6ItemId id, const std::string & str)
 {
 	if (str.empty()) {
 		tags.erase(id);
@@ -1281,9 +1524,18 @@ std::map<std::string, std::string> SPCFile::ExportPSFTag(bool unofficial_tags) c
 }
 
 void SPCFile::ParseSampDir()
+{
+	samp_dir_length = ParseSampDir(ram, dsp, samples);
+}
+
+int SPCFile::ParseSampDir(const uint8_t * ram, const uint8_t * dsp, SPCSampDir samples[])
 {
 	uint16_t dir = dsp[0x5d] << 8;
 
+	// directory entries often share samples, or point into another sample
+	BRRChainMemo memo;
+
+	int samp_dir_length;
 	size_t current_dir = dir;
 	for (samp_dir_length = 0; samp_dir_length < 256; samp_dir_length++) {
 		// address out of range
@@ -1293,8 +1545,15 @@ void SPCFile::ParseSampDir()
 
 		SPCSampDir & sample = samples[samp_dir_length];
 		current_dir += sample.read(&ram[current_dir], 0x10000 - current_dir);
-		sample.parse_brr(&ram[sample.start_address], 0x10000 - sample.start_address);
+		sample.parse_brr(ram, memo);
 	}
+
+	// entries out of the directory may still hold the previous file
+	for (int samp = samp_dir_length; samp < 256; samp++) {
+		samples[samp] = SPCSampDir();
+	}
+
+	return samp_dir_length;
 }
 
 bool SPCFile::ParseDateString(const std::string & str, int & year, int & month, int & day)
@@ -1326,7 +1585,7 @@ bool SPCFile::ParseDateString(const std::string & str, int & year, int & month,
 	return (year >= 0 && month >= 1 && month <= 12 && day >= 1 && day <= 31);
 }
 
-void SPCFile::SetTagValue(XID6ItemId id, XID6TypeId type, const uint8_t *binary, size_t size)
+void SPCFile::SetTagValue(XID6TagMap & tags, XID6ItemId id, XID6TypeId type, const uint8_t *binary, size_t size)
 {
 	std::vector<char> data;
 	data.reserve(size);
@@ -59,6 +59,18 @@ public:
 		std::vector<char> value;
 	};
 
+	typedef std::map<XID6ItemId, XID6TagItem> XID6TagMap;
+
+	enum LoadMode {
+		LOAD_FULL = 0,      // header, RAM, DSP registers, tags and sample directory
+		LOAD_TAGS_ONLY = 1  // header and ID666/XID6 tags only, RAM and samples are left untouched
+	};
+
+	// what the last load filled in; Reset() counts as a full (blank) image
+	inline LoadMode GetLoadMode() const {
+		return load_mode;
+	}
+
 	struct SPCRegisters {
 		uint16_t pc;
 		uint8_t a;
@@ -71,14 +83,22 @@ public:
 	uint8_t ram[0x10000];
 	uint8_t dsp[0x80];
 	uint8_t extra_ram[0x40];
-	std::map<XID6ItemId, XID6TagItem> tags;
+	XID6TagMap tags;
 
 	SPCSampDir samples[256];
 	int samp_dir_length;
 
 	static bool IsSPCFile(const std::string& filename);
-	static SPCFile * Load(const std::string& filename);
+	static bool IsSPCFile(const uint8_t * data, size_t size);
+	static SPCFile * Load(const std::string& filename, LoadMode mode = LOAD_FULL);
+	static SPCFile * LoadFromMemory(const uint8_t * data, size_t size, LoadMode mode = LOAD_FULL);
+	static bool LoadInto(const std::string& filename, SPCFile & spc, LoadMode mode = LOAD_FULL);
+	static bool LoadFromMemoryInto(const uint8_t * data, size_t size, SPCFile & spc, LoadMode mode = LOAD_FULL);
+	void Reset();
+	// Fails after a LOAD_TAGS_ONLY load, whose RAM belongs to no file.
 	bool Save(const std::string& filename) const;
+	// Rewrites only the header and the xid6 block of an existing SPC file.
+	bool SaveTags(const std::string& filename) const;
 
 	std::vector<uint8_t> GetXID6Block() const;
 
@@ -96,6 +116,13 @@ public:
 	static std::string XID6TicksToTimeString(uint32_t ticks, bool padding);
 	static uint32_t TimeStringToXID6Ticks(const std::string & str, bool * p_valid_format);
 
+	static void ParseHeader(const uint8_t * header, SPCRegisters & regs, XID6TagMap & tags);
+	static void ParseXID6(const uint8_t * xid6, size_t size, XID6TagMap & tags);
+	static int ParseSampDir(const uint8_t * ram, const uint8_t * dsp, SPCSampDir samples[]);
+
+	static int GetIntegerTag(const XID6TagMap & tags, XID6ItemId id);
+	static std::string GetStringTag(const XID6TagMap & tags, XID6ItemId id);
+
 	static std::string ID666IdToEmulatorName(ID666EmulatorId id);
 	static ID666EmulatorId EmulatorNameToID666Id(const std::string & name);
 
@@ -106,9 +133,16 @@ private:
 	SPCFile(const SPCFile&);
 	SPCFile& operator=(const SPCFile&);
 
+	std::vector<uint8_t> load_buffer;
+	LoadMode load_mode;
+
 	void ParseSampDir();
+	void BuildHeader(uint8_t * header) const;
+	bool IsXID6Required() const;
 	static bool ParseDateString(const std::string & str, int & year, int & month, int & day);
-	void SetTagValue(XID6ItemId id, XID6TypeId type, const uint8_t * binary, size_t size);
+	static void SetIntegerTag(XID6TagMap & tags, XID6ItemId id, uint32_t value, size_t size);
+	static void SetStringTag(XID6TagMap & tags, XID6ItemId id, const std::string & str);
+	static void SetTagValue(XID6TagMap & tags, XID6ItemId id, XID6TypeId type, const uint8_t * binary, size_t size);
 };
 
 #endif /* !SPCFILE_H_INCLUDED */
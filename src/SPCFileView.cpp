@@ -0,0 +1,217 @@
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "SPCFileView.h"
+
+SPCFileView::SPCFileView() :
+	ram(NULL),
+	dsp(NULL),
+	extra_ram(NULL),
+	samp_dir_length(0),
+	map_base(NULL),
+	map_size(0),
+	file_fd(-1)
+{
+	memset(&regs, 0, sizeof(regs));
+}
+
+SPCFileView::SPCFileView(const SPCFile & spc_file) :
+	regs(spc_file.regs),
+	ram(spc_file.ram),
+	dsp(spc_file.dsp),
+	extra_ram(spc_file.extra_ram),
+	tags(spc_file.tags),
+	samp_dir_length(spc_file.samp_dir_length),
+	map_base(NULL),
+	map_size(0),
+	file_fd(-1)
+{
+	samples.Assign(spc_file.ram, spc_file.samples, spc_file.samp_dir_length);
+}
+
+SPCFileView::~SPCFileView()
+{
+	Unmap();
+}
+
+SPCFileView * SPCFileView::Open(const std::string & filename)
+{
+	SPCFileView * view = new SPCFileView();
+	if (!OpenInto(filename, *view)) {
+		delete view;
+		return NULL;
+	}
+	return view;
+}
+
+SPCFileView * SPCFileView::Open(const uint8_t * data, size_t size)
+{
+	SPCFileView * view = new SPCFileView();
+	if (!OpenInto(data, size, *view)) {
+		delete view;
+		return NULL;
+	}
+	return view;
+}
+
+bool SPCFileView::OpenInto(const std::string & filename, SPCFileView & view)
+{
+	void * base;
+	size_t size;
+
+	view.Reset();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < 0x100 || (ULONGLONG)file_size.QuadPart > (SIZE_MAX >> 1)) {
+		CloseHandle(file);
+		return false;
+	}
+	size = (size_t)file_size.QuadPart;
+
+	// sniff the signature before mapping anything
+	uint8_t header[0x100];
+	DWORD read_size;
+	if (!ReadFile(file, header, sizeof(header), &read_size, NULL) || read_size != sizeof(header) ||
+		!SPCFile::IsSPCFile(header, size)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return false;
+	}
+
+	base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (base == NULL) {
+		return false;
+	}
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 0x100) {
+		close(fd);
+		return false;
+	}
+	size = (size_t)st.st_size;
+
+	// sniff the signature before mapping anything
+	uint8_t header[0x100];
+	if (pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+		!SPCFile::IsSPCFile(header, size)) {
+		close(fd);
+		return false;
+	}
+
+	base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	// kept open for in-kernel copies of sample data
+	view.file_fd = fd;
+#endif
+
+	view.map_base = base;
+	view.map_size = size;
+	view.Attach((const uint8_t *)base, size);
+	return true;
+}
+
+bool SPCFileView::OpenInto(const uint8_t * data, size_t size, SPCFileView & view)
+{
+	view.Reset();
+
+	if (!SPCFile::IsSPCFile(data, size)) {
+		return false;
+	}
+
+	view.Attach(data, size);
+	return true;
+}
+
+void SPCFileView::Reset()
+{
+	Unmap();
+
+	memset(&regs, 0, sizeof(regs));
+	ram = NULL;
+	dsp = NULL;
+	extra_ram = NULL;
+	tags.clear();
+	samples.Clear();
+	samp_dir_length = 0;
+}
+
+int SPCFileView::GetIntegerTag(SPCFile::XID6ItemId id) const
+{
+	return SPCFile::GetIntegerTag(tags, id);
+}
+
+std::string SPCFileView::GetStringTag(SPCFile::XID6ItemId id) const
+{
+	return SPCFile::GetStringTag(tags, id);
+}
+
+void SPCFileView::Attach(const uint8_t * data, size_t size)
+{
+	// SPC700 registers and ID666 tags
+	SPCFile::ParseHeader(data, regs, tags);
+
+	ram = &data[0x100];
+	dsp = &data[0x10100];
+	extra_ram = &data[0x101c0];
+
+	// Parse Extended ID666 if available
+	SPCFile::ParseXID6(&data[0x10200], size - 0x10200, tags);
+
+	// Sample dir entries are parsed when they are first read
+	samples.Attach(ram, dsp[0x5d] << 8);
+	samp_dir_length = samples.GetLength();
+}
+
+void SPCFileView::Unmap()
+{
+	if (map_base != NULL) {
+#ifdef _WIN32
+		UnmapViewOfFile(map_base);
+#else
+		munmap(map_base, map_size);
+#endif
+		map_base = NULL;
+		map_size = 0;
+	}
+
+#ifndef _WIN32
+	if (file_fd != -1) {
+		close(file_fd);
+		file_fd = -1;
+	}
+#endif
+}
@@ -0,0 +1,63 @@
+
+#ifndef SPCFILEVIEW_H_INCLUDED
+#define SPCFILEVIEW_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <string>
+
+#include "SPCFile.h"
+#include "SPCSampDir.h"
+
+// Read-only view of an SPC image. ram/dsp/extra_ram point straight into
+// the backing storage (a memory-mapped file, a caller-owned buffer, or the
+// arrays of an SPCFile), so that no copy of the 64 KB image is made.
+// The backing storage must outlive the view unless it is a mapped file.
+class SPCFileView
+{
+public:
+	SPCFileView();
+	explicit SPCFileView(const SPCFile & spc_file);
+	virtual ~SPCFileView();
+
+	SPCFile::SPCRegisters regs;
+
+	const uint8_t * ram;
+	const uint8_t * dsp;
+	const uint8_t * extra_ram;
+	SPCFile::XID6TagMap tags;
+
+	// parsed on first access of each entry
+	SPCSampDirTable samples;
+	int samp_dir_length;
+
+	static SPCFileView * Open(const std::string & filename);
+	static SPCFileView * Open(const uint8_t * data, size_t size);
+	static bool OpenInto(const std::string & filename, SPCFileView & view);
+	static bool OpenInto(const uint8_t * data, size_t size, SPCFileView & view);
+	void Reset();
+
+	int GetIntegerTag(SPCFile::XID6ItemId id) const;
+	std::string GetStringTag(SPCFile::XID6ItemId id) const;
+
+	// Descriptor of the mapped SPC file (POSIX only), or -1 for any other
+	// backing storage. It stays open until Reset(); ram[0] lies at file
+	// offset 0x100, so samples can be copied from it without touching ram.
+	inline int GetFileDescriptor(void) const {
+		return file_fd;
+	}
+
+private:
+	SPCFileView(const SPCFileView&);
+	SPCFileView& operator=(const SPCFileView&);
+
+	void Attach(const uint8_t * data, size_t size);
+	void Unmap();
+
+	void * map_base;
+	size_t map_size;
+	int file_fd;
+};
+
+#endif /* !SPCFILEVIEW_H_INCLUDED */
@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "SPCMemoryMap.h"
+#include "SPCFileView.h"
+
+SPCMemoryMap::SPCMemoryMap() :
+	dir(0),
+	echo_enabled(false),
+	echo_start(0),
+	echo_size(0)
+{
+	memset(owners, 0, sizeof(owners));
+}
+
+SPCMemoryMap::~SPCMemoryMap()
+{
+}
+
+void SPCMemoryMap::Reset(const SPCFileView & spc_file)
+{
+	memset(owners, 0, sizeof(owners));
+
+	dir = spc_file.dsp[0x5d] << 8;
+
+	uint8_t flg = spc_file.dsp[0x6c];
+	uint8_t edl = spc_file.dsp[0x7d] & 15;
+	echo_enabled = ((flg & 0x20) == 0);
+	echo_start = spc_file.dsp[0x6d] << 8;
+	echo_size = (edl != 0) ? (2048 * edl) : 4;
+
+	if (echo_enabled) {
+		Mark(echo_start, echo_size, OWNER_ECHO);
+	}
+}
+
+void SPCMemoryMap::AddDirectory(int length)
+{
+	Mark(dir, length * 4, OWNER_DIR);
+}
+
+void SPCMemoryMap::AddSample(const SPCSampDir & sample)
+{
+	Mark(sample.start_address, (uint32_t)sample.compressed_size(), 1 << (sample.start_address % SPCSampDir::BRR_CHUNK_SIZE));
+}
+
+bool SPCMemoryMap::OverlapsEcho(const SPCSampDir & sample) const
+{
+	if (sample.start_address >= sample.end_address) {
+		return false;
+	}
+
+	// the buffer wraps around at the end of RAM like the DSP does
+	return ((owners[sample.start_address] | owners[sample.end_address - 1]) & OWNER_ECHO) != 0;
+}
+
+bool SPCMemoryMap::IsAligned(const SPCSampDir & sample) const
+{
+	if (sample.start_address >= sample.end_address) {
+		return true;
+	}
+
+	uint16_t alignment = 1 << (sample.start_address % SPCSampDir::BRR_CHUNK_SIZE);
+	uint16_t covering = (owners[sample.start_address] | owners[sample.end_address - 1]) & OWNER_BRR_MASK;
+	return (covering & ~alignment) == 0;
+}
+
+bool SPCMemoryMap::IsFree(uint32_t start_address, uint32_t size, uint16_t owner_mask) const
+{
+	for (uint32_t offset = 0; offset < size; offset++) {
+		if ((owners[(start_address + offset) & 0xffff] & owner_mask) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::vector<SPCMemoryMap::Region> SPCMemoryMap::GetRegions(void) const
+{
+	std::vector<Region> regions;
+
+	uint32_t start_address = 0;
+	for (uint32_t address = 1; address <= 0x10000; address++) {
+		if (address == 0x10000 || owners[address] != owners[start_address]) {
+			Region region;
+			region.start_address = start_address;
+			region.end_address = address;
+			region.owners = owners[start_address];
+			regions.push_back(region);
+
+			start_address = address;
+		}
+	}
+	return regions;
+}
+
+void SPCMemoryMap::GetOwnerBits(uint16_t owner_mask, uint64_t bits[0x10000 / 64]) const
+{
+	for (uint32_t word = 0; word < 0x10000 / 64; word++) {
+		const uint16_t * word_owners = &owners[word * 64];
+		uint64_t word_bits = 0;
+		for (int bit = 0; bit < 64; bit++) {
+			word_bits |= (uint64_t)((word_owners[bit] & owner_mask) != 0) << bit;
+		}
+		bits[word] = word_bits;
+	}
+}
+
+void SPCMemoryMap::Mark(uint32_t start_address, uint32_t size, uint16_t owner)
+{
+	for (uint32_t offset = 0; offset < size; offset++) {
+		owners[(start_address + offset) & 0xffff] |= owner;
+	}
+}
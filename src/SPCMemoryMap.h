@@ -0,0 +1,76 @@
+#ifndef SPCMEMORYMAP_H_INCLUDED
+#define SPCMEMORYMAP_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <vector>
+
+#include "SPCSampDir.h"
+
+class SPCFileView;
+
+// What each byte of the 64 KB RAM holds, computed once per file for sample
+// validation: the echo buffer (from FLG/ESA/EDL), the sample directory and
+// the chains of accepted samples. Overlap, alignment and echo checks of a
+// sample then look at its first and last byte only.
+class SPCMemoryMap
+{
+public:
+	// one bit per BRR alignment (address % 9) of the chains covering a byte
+	static const uint16_t OWNER_BRR_MASK = 0x01ff;
+	static const uint16_t OWNER_ECHO = 0x0200;
+	static const uint16_t OWNER_DIR = 0x0400;
+
+	struct Region {
+		uint32_t start_address;
+		uint32_t end_address;   // exclusive, may be 0x10000
+		uint16_t owners;
+	};
+
+	SPCMemoryMap();
+	virtual ~SPCMemoryMap();
+
+	inline uint16_t GetDir(void) const {
+		return dir;
+	}
+
+	inline bool IsEchoEnabled(void) const {
+		return echo_enabled;
+	}
+
+	inline uint16_t GetOwners(uint16_t address) const {
+		return owners[address];
+	}
+
+	void Reset(const SPCFileView & spc_file);
+	void AddDirectory(int length);
+	void AddSample(const SPCSampDir & sample);
+
+	// the first or last byte lies in the echo buffer
+	bool OverlapsEcho(const SPCSampDir & sample) const;
+	// every added chain holding the first or last byte starts at the same alignment
+	bool IsAligned(const SPCSampDir & sample) const;
+	// no byte in [start_address, start_address + size) has any of the owners
+	bool IsFree(uint32_t start_address, uint32_t size, uint16_t owner_mask) const;
+
+	std::vector<Region> GetRegions(void) const;
+	// bit (address % 64) of bits[address / 64] tells whether any of the owners holds the byte
+	void GetOwnerBits(uint16_t owner_mask, uint64_t bits[0x10000 / 64]) const;
+
+protected:
+	uint16_t dir;
+	bool echo_enabled;
+	uint16_t echo_start;
+	uint16_t echo_size;
+
+private:
+	SPCMemoryMap(const SPCMemoryMap &);
+	SPCMemoryMap & operator=(const SPCMemoryMap &);
+
+	void Mark(uint32_t start_address, uint32_t size, uint16_t owner);
+
+	uint16_t owners[0x10000];
+};
+
+#endif /* !SPCMEMORYMAP_H_INCLUDED */
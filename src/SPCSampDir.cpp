@@ -1,5 +1,6 @@
 
 #include <stdint.h>
+#include <string.h>
 
 #include <vector>
 
@@ -13,6 +14,157 @@ static inline int32_t sclamp16(int32_t x) {
 	return ((x > 32767) ? 32767 : (x < -32768) ? -32768 : x);
 }
 
+// Block header scan: one bit per byte of 64 blocks for the end flag and
+// for range > 12. find_brr_end picks the end flags out at the block heads;
+// BRRScanner uses both.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define BRR_SCAN_SSE2
+#define BRR_SCAN_AVX2_RUNTIME
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BRR_SCAN_SSE2
+#ifdef __AVX2__
+#define BRR_SCAN_AVX2
+#endif
+#endif
+
+#ifdef BRR_SCAN_SSE2
+#include <emmintrin.h>
+#if defined(BRR_SCAN_AVX2) || defined(BRR_SCAN_AVX2_RUNTIME)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+typedef void (*brr_scan_func)(const uint8_t * brr, uint64_t end_bits[9], uint64_t range_bits[9]);
+
+static inline int count_trailing_zeros(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#elif defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	int n = 0;
+	while ((x & 1) == 0) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static void brr_scan_sse2(const uint8_t * brr, uint64_t end_bits[9], uint64_t range_bits[9])
+{
+	const __m128i min_invalid_range = _mm_set1_epi8((char)0xd0);
+	for (int word = 0; word < 9; word++) {
+		uint64_t ends = 0;
+		uint64_t ranges = 0;
+		for (int i = 0; i < 4; i++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&brr[word * 64 + i * 16]);
+			// bit 0 of each byte into its sign bit
+			ends |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_slli_epi16(v, 7)) << (i * 16);
+			ranges |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, min_invalid_range), v)) << (i * 16);
+		}
+		end_bits[word] = ends;
+		range_bits[word] = ranges;
+	}
+}
+
+#if defined(BRR_SCAN_AVX2) || defined(BRR_SCAN_AVX2_RUNTIME)
+#ifdef BRR_SCAN_AVX2_RUNTIME
+__attribute__((target("avx2")))
+#endif
+static void brr_scan_avx2(const uint8_t * brr, uint64_t end_bits[9], uint64_t range_bits[9])
+{
+	const __m256i min_invalid_range = _mm256_set1_epi8((char)0xd0);
+	for (int word = 0; word < 9; word++) {
+		uint64_t ends = 0;
+		uint64_t ranges = 0;
+		for (int i = 0; i < 2; i++) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)&brr[word * 64 + i * 32]);
+			ends |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(v, 7)) << (i * 32);
+			ranges |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, min_invalid_range), v)) << (i * 32);
+		}
+		end_bits[word] = ends;
+		range_bits[word] = ranges;
+	}
+}
+#endif
+
+static brr_scan_func select_brr_scan()
+{
+#if defined(BRR_SCAN_AVX2)
+	return brr_scan_avx2;
+#else
+#if defined(BRR_SCAN_AVX2_RUNTIME)
+	if (__builtin_cpu_supports("avx2")) {
+		return brr_scan_avx2;
+	}
+#endif
+	return brr_scan_sse2;
+#endif
+}
+#endif
+
+// Decodes the 16 samples of one BRR block, carrying the filter history in prev.
+static inline void decode_brr_block(const uint8_t * brr_chunk, int32_t prev[2], int16_t * pcm)
+{
+	uint8_t flags = brr_chunk[0];
+	uint8_t filter = (flags >> 2) & 3;
+	uint8_t range = flags >> 4;
+	bool valid_range = (range <= 0x0c);
+
+	int32_t S1 = prev[0];
+	int32_t S2 = prev[1];
+
+	for (int byte_index = 0; byte_index < 8; byte_index++)
+	{
+		int8_t sample1 = brr_chunk[1 + byte_index];
+		int8_t sample2 = sample1 << 4;
+		sample1 >>= 4;
+		sample2 >>= 4;
+
+		for (int nybble = 0; nybble < 2; nybble++)
+		{
+			int32_t out;
+			
+			out = nybble ? (int32_t)sample2 : (int32_t)sample1;
+			out = valid_range ? ((out << range) >> 1) : (out & ~0x7FF);
+
+			switch (filter)
+			{
+			case 0: // Direct
+				break;
+
+			case 1: // 15/16
+				out += S1 + ((-S1) >> 4);
+				break;
+
+			case 2: // 61/32 - 15/16
+				out += (S1 << 1) + ((-((S1 << 1) + S1)) >> 5) - S2 + (S2 >> 4);
+				break;
+
+			case 3: // 115/64 - 13/16
+				out += (S1 << 1) + ((-(S1 + (S1 << 2) + (S1 << 3))) >> 6) - S2 + (((S2 << 1) + S2) >> 4);
+				break;
+			}
+
+			out = sclip15(sclamp16(out));
+
+			S2 = S1;
+			S1 = out;
+
+			*pcm++ = (int16_t)(out << 1);
+		}
+	}
+
+	prev[0] = S1;
+	prev[1] = S2;
+}
+
 SPCSampDir::SPCSampDir() :
 	start_address(0),
 	loop_address(0),
@@ -37,6 +189,27 @@ size_t SPCSampDir::read(const uint8_t * data, size_t size)
 }
 
 void SPCSampDir::parse_brr(const uint8_t * brr, size_t available_size)
+{
+	size_t num_blocks = available_size / BRR_CHUNK_SIZE;
+	size_t end_block = find_brr_end(brr, num_blocks);
+
+	size_t brr_size;
+	bool valid_end;
+	if (end_block < num_blocks) {
+		looped = (brr[end_block * BRR_CHUNK_SIZE] & 2) != 0;
+		valid_end = true;
+		brr_size = (end_block + 1) * BRR_CHUNK_SIZE;
+	}
+	else {
+		looped = false;
+		valid_end = false;
+		brr_size = num_blocks * BRR_CHUNK_SIZE;
+	}
+	end_address = (uint16_t)(start_address + brr_size);
+	valid = valid_end && valid_addresses();
+}
+
+void SPCSampDir::parse_brr_scalar(const uint8_t * brr, size_t available_size)
 {
 	bool valid_range = true;
 	bool valid_end = false;
@@ -70,6 +243,83 @@ void SPCSampDir::parse_brr(const uint8_t * brr, size_t available_size)
 	valid = valid_end && valid_addresses();
 }
 
+size_t SPCSampDir::find_brr_end(const uint8_t * brr, size_t num_blocks)
+{
+	size_t block = 0;
+
+#ifdef BRR_SCAN_SSE2
+	// bit i of word w marks the header byte of a block within 64 blocks (576 bytes)
+	static const uint64_t block_heads[9] = {
+		0x8040201008040201ULL, 0x4020100804020100ULL, 0x2010080402010080ULL,
+		0x1008040201008040ULL, 0x0804020100804020ULL, 0x0402010080402010ULL,
+		0x0201008040201008ULL, 0x0100804020100804ULL, 0x0080402010080402ULL,
+	};
+	static const brr_scan_func scan = select_brr_scan();
+
+	for (; block + 64 <= num_blocks; block += 64) {
+		uint64_t end_bits[9];
+		uint64_t range_bits[9];
+		scan(&brr[block * BRR_CHUNK_SIZE], end_bits, range_bits);
+
+		for (int word = 0; word < 9; word++) {
+			uint64_t ends = end_bits[word] & block_heads[word];
+			if (ends != 0) {
+				return block + (word * 64 + count_trailing_zeros(ends)) / BRR_CHUNK_SIZE;
+			}
+		}
+	}
+#endif
+
+	for (; block < num_blocks; block++) {
+		if ((brr[block * BRR_CHUNK_SIZE] & 1) != 0) {
+			break;
+		}
+	}
+	return block;
+}
+
+void SPCSampDir::scan_brr_headers(const uint8_t * data, size_t size, uint64_t * end_bits, uint64_t * range_bits)
+{
+	size_t offset = 0;
+
+#ifdef BRR_SCAN_SSE2
+	static const brr_scan_func scan = select_brr_scan();
+
+	// 576 bytes fill 9 words exactly
+	for (; offset + 64 * BRR_CHUNK_SIZE <= size; offset += 64 * BRR_CHUNK_SIZE) {
+		scan(&data[offset], &end_bits[offset / 64], &range_bits[offset / 64]);
+	}
+#endif
+
+	size_t num_words = (size + 63) / 64;
+	for (size_t word = offset / 64; word < num_words; word++) {
+		end_bits[word] = 0;
+		range_bits[word] = 0;
+	}
+
+	for (; offset < size; offset++) {
+		uint64_t bit = (uint64_t)1 << (offset % 64);
+		if ((data[offset] & 1) != 0) {
+			end_bits[offset / 64] |= bit;
+		}
+		if ((data[offset] >> 4) > 0x0c) {
+			range_bits[offset / 64] |= bit;
+		}
+	}
+}
+
+void SPCSampDir::parse_brr(const uint8_t * ram, BRRChainMemo & memo)
+{
+	uint32_t chain_end;
+	bool chain_looped;
+	bool valid_end;
+	memo.Walk(ram, start_address, chain_end, chain_looped, valid_end);
+
+	looped = chain_looped;
+	end_address = (uint16_t)chain_end;
+	valid = valid_end && valid_addresses();
+}
+
 std::vector<int16_t> SPCSampDir::decode_brr(const uint8_t * brr, size_t size, bool * ptr_looped)
 {
 	std::vector<int16_t> raw_samples;
@@ -82,66 +332,192 @@ std::vector<int16_t> SPCSampDir::decode_brr(const uint8_t * brr, size_t size, bo
 		uint8_t flags = brr_chunk[0];
 		bool chunk_end = (flags & 1) != 0;
 		bool chunk_loop = (flags & 2) != 0;
-		uint8_t filter = (flags >> 2) & 3;
-		uint8_t range = flags >> 4;
-		bool valid_range = (range <= 0x0c);
 
-		int32_t S1 = prev[0];
-		int32_t S2 = prev[1];
+		raw_samples.resize(raw_samples.size() + 16);
+		decode_brr_block(brr_chunk, prev, &raw_samples[raw_samples.size() - 16]);
 
-		for (int byte_index = 0; byte_index < 8; byte_index++)
-		{
-			int8_t sample1 = brr_chunk[1 + byte_index];
-			int8_t sample2 = sample1 << 4;
-			sample1 >>= 4;
-			sample2 >>= 4;
+		decoded_size += BRR_CHUNK_SIZE;
 
-			for (int nybble = 0; nybble < 2; nybble++)
-			{
-				int32_t out;
-				
-				out = nybble ? (int32_t)sample2 : (int32_t)sample1;
-				out = valid_range ? ((out << range) >> 1) : (out & ~0x7FF);
+		if (chunk_end) {
+			if (ptr_looped != NULL) {
+				*ptr_looped = chunk_loop;
+			}
+			break;
+		}
+	}
 
-				switch (filter)
-				{
-				case 0: // Direct
-					break;
+	return raw_samples;
+}
 
-				case 1: // 15/16
-					out += S1 + ((-S1) >> 4);
-					break;
+BRRChainMemo::BRRChainMemo()
+{
+	Reset();
+}
 
-				case 2: // 61/32 - 15/16
-					out += (S1 << 1) + ((-((S1 << 1) + S1)) >> 5) - S2 + (S2 >> 4);
-					break;
+BRRChainMemo::~BRRChainMemo()
+{
+}
 
-				case 3: // 115/64 - 13/16
-					out += (S1 << 1) + ((-(S1 + (S1 << 2) + (S1 << 3))) >> 6) - S2 + (((S2 << 1) + S2) >> 4);
-					break;
-				}
+void BRRChainMemo::Reset()
+{
+	memset(visited, 0, sizeof(visited));
+	chains.clear();
+}
 
-				out = sclip15(sclamp16(out));
+const BRRChainMemo::Chain * BRRChainMemo::FindChain(uint32_t block_address) const
+{
+	// recent chains are the likeliest to be shared
+	for (auto itr_chain = chains.rbegin(); itr_chain != chains.rend(); ++itr_chain) {
+		if (block_address >= itr_chain->start_address && block_address < itr_chain->end_address &&
+			(block_address - itr_chain->start_address) % SPCSampDir::BRR_CHUNK_SIZE == 0) {
+			return &*itr_chain;
+		}
+	}
+	return NULL;
+}
 
-				S2 = S1;
-				S1 = out;
+void BRRChainMemo::Walk(const uint8_t * ram, uint32_t start_address, uint32_t & end_address, bool & looped, bool & valid_end)
+{
+	const Chain * known_chain = NULL;
+	uint32_t address = start_address;
 
-				raw_samples.push_back(out << 1);
-			}
+	looped = false;
+	valid_end = false;
+	while (address + SPCSampDir::BRR_CHUNK_SIZE <= 0x10000) {
+		// scan up to 64 blocks at once, stopping short of a known chain
+		size_t window = (0x10000 - address) / SPCSampDir::BRR_CHUNK_SIZE;
+		if (window > 64) {
+			window = 64;
+		}
+		size_t fresh_blocks = 0;
+		while (fresh_blocks < window && !IsVisited(address + (uint32_t)fresh_blocks * SPCSampDir::BRR_CHUNK_SIZE)) {
+			fresh_blocks++;
 		}
 
-		prev[0] = S1;
-		prev[1] = S2;
-
-		decoded_size += BRR_CHUNK_SIZE;
+		size_t end_block = SPCSampDir::find_brr_end(&ram[address], fresh_blocks);
+		if (end_block < fresh_blocks) {
+			address += (uint32_t)end_block * SPCSampDir::BRR_CHUNK_SIZE;
+			looped = (ram[address] & 2) != 0;
+			valid_end = true;
+			address += SPCSampDir::BRR_CHUNK_SIZE;
+			break;
+		}
 
-		if (chunk_end) {
-			if (ptr_looped != NULL) {
-				*ptr_looped = chunk_loop;
-			}
+		address += (uint32_t)fresh_blocks * SPCSampDir::BRR_CHUNK_SIZE;
+		if (fresh_blocks < window) {
+			known_chain = FindChain(address);
 			break;
 		}
 	}
 
-	return raw_samples;
+	uint32_t walked_end = address;
+	if (known_chain != NULL) {
+		end_address = known_chain->end_address;
+		looped = known_chain->looped;
+		valid_end = known_chain->valid_end;
+	}
+	else {
+		end_address = address;
+	}
+
+	if (walked_end == start_address) {
+		return;
+	}
+
+	for (uint32_t block = start_address; block < walked_end; block += SPCSampDir::BRR_CHUNK_SIZE) {
+		SetVisited(block);
+	}
+
+	Chain chain;
+	chain.start_address = start_address;
+	chain.end_address = end_address;
+	chain.looped = looped;
+	chain.valid_end = valid_end;
+	chains.push_back(chain);
+}
+
+SPCSampDirTable::SPCSampDirTable() :
+	ram(NULL),
+	dir(0),
+	length(0),
+	memo_ready(false)
+{
+	memset(parsed, 1, sizeof(parsed));
+}
+
+SPCSampDirTable::~SPCSampDirTable()
+{
+}
+
+void SPCSampDirTable::Attach(const uint8_t * ram, uint16_t dir)
+{
+	this->ram = ram;
+	this->dir = dir;
+
+	// 4 bytes per entry, up to the end of RAM
+	length = (int)((0x10000 - dir) / 4);
+	if (length > 256) {
+		length = 256;
+	}
+
+	for (int srcn = 0; srcn < 256; srcn++) {
+		parsed[srcn] = (srcn >= length);
+		if (parsed[srcn]) {
+			entries[srcn] = SPCSampDir();
+		}
+	}
+	memo_ready = false;
+	pcm_cache.clear();
+}
+
+void SPCSampDirTable::Assign(const uint8_t * ram, const SPCSampDir samples[], int length)
+{
+	this->ram = ram;
+	dir = 0;
+	this->length = length;
+
+	for (int srcn = 0; srcn < 256; srcn++) {
+		entries[srcn] = (srcn < length) ? samples[srcn] : SPCSampDir();
+	}
+	memset(parsed, 1, sizeof(parsed));
+	memo_ready = false;
+	pcm_cache.clear();
+}
+
+void SPCSampDirTable::Clear()
+{
+	Assign(NULL, NULL, 0);
+}
+
+void SPCSampDirTable::ReadEntry(size_t srcn) const
+{
+	size_t entry_address = dir + srcn * 4;
+	entries[srcn].read(&ram[entry_address], 0x10000 - entry_address);
+}
+
+const SPCSampDir & SPCSampDirTable::Parse(size_t srcn) const
+{
+	// the memo is only cleared once a file actually needs it
+	if (!memo_ready) {
+		memo.Reset();
+		memo_ready = true;
+	}
+
+	SPCSampDir & sample = entries[srcn];
+	ReadEntry(srcn);
+	sample.parse_brr(ram, memo);
+	parsed[srcn] = true;
+	return sample;
+}
+
+const std::vector<int16_t> & SPCSampDirTable::GetPCM(size_t srcn) const
+{
+	const SPCSampDir & sample = (*this)[srcn];
+
+	uint32_t key = GetPCMKey(sample);
+	auto itr_pcm = pcm_cache.find(key);
+	if (itr_pcm == pcm_cache.end()) {
+		itr_pcm = pcm_cache.insert(std::make_pair(key, SPCSampDir::decode_brr(&ram[sample.start_address], sample.compressed_size()))).first;
+	}
+	return itr_pcm->second;
 }
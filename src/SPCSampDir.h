@@ -6,6 +6,9 @@
 #include <cstddef>
 
 #include <vector>
+#include <map>
+
+class BRRChainMemo;
 
 class SPCSampDir {
 public:
@@ -71,8 +74,105 @@ public:
 
 	size_t read(const uint8_t * data, size_t size);
 	void parse_brr(const uint8_t * brr, size_t available_size);
+	// reference implementation of parse_brr, one block header at a time
+	void parse_brr_scalar(const uint8_t * brr, size_t available_size);
+	// same result as parse_brr(&ram[start_address], 0x10000 - start_address)
+	void parse_brr(const uint8_t * ram, BRRChainMemo & memo);
+
+	// Index of the first of num_blocks blocks with the end flag, or
+	// num_blocks if none has it (SIMD on x86).
+	static size_t find_brr_end(const uint8_t * brr, size_t num_blocks);
+
+	// Sets bit (i % 64) of word (i / 64) for each byte i of data that would
+	// have the end flag, or a range above 12, as a block header. Both arrays
+	// hold (size + 63) / 64 words.
+	static void scan_brr_headers(const uint8_t * data, size_t size, uint64_t * end_bits, uint64_t * range_bits);
 
 	static std::vector<int16_t> decode_brr(const uint8_t * brr, size_t size, bool * ptr_looped = NULL);
 };
 
+// Remembers the BRR chains walked in one 64 KB RAM image. The end of a
+// chain depends only on the blocks from its start onwards, so a walk that
+// reaches a block of a known chain takes over that chain's result, and
+// every block is examined at most once per image.
+class BRRChainMemo {
+public:
+	BRRChainMemo();
+	virtual ~BRRChainMemo();
+
+	void Reset();
+	void Walk(const uint8_t * ram, uint32_t start_address, uint32_t & end_address, bool & looped, bool & valid_end);
+
+private:
+	struct Chain {
+		uint32_t start_address;
+		uint32_t end_address;   // may be 0x10000
+		bool looped;
+		bool valid_end;
+	};
+
+	inline bool IsVisited(uint32_t address) const {
+		return (visited[address >> 3] & (1 << (address & 7))) != 0;
+	}
+
+	inline void SetVisited(uint32_t address) {
+		visited[address >> 3] |= (uint8_t)(1 << (address & 7));
+	}
+
+	const Chain * FindChain(uint32_t block_address) const;
+
+	uint8_t visited[0x10000 / 8];   // block heads of known chains
+	std::vector<Chain> chains;
+};
+
+// Sample directory of one RAM image. Entries and their BRR chains are
+// parsed on first access, so reading a few SRCNs does not pay for all 256.
+// Not thread-safe: reading an unparsed entry updates the table.
+class SPCSampDirTable {
+public:
+	SPCSampDirTable();
+	virtual ~SPCSampDirTable();
+
+	// number of entries in the directory (256 unless it runs past the end of RAM)
+	inline int GetLength() const {
+		return length;
+	}
+
+	inline const SPCSampDir & operator[](size_t srcn) const {
+		if (!parsed[srcn]) {
+			return Parse(srcn);
+		}
+		return entries[srcn];
+	}
+
+	// Decoded PCM of an entry's chain, kept until the table is reset and
+	// shared by entries with the same chain.
+	const std::vector<int16_t> & GetPCM(size_t srcn) const;
+
+	void Attach(const uint8_t * ram, uint16_t dir);
+	void Assign(const uint8_t * ram, const SPCSampDir samples[], int length);
+	void Clear();
+
+private:
+	SPCSampDirTable(const SPCSampDirTable &);
+	SPCSampDirTable & operator=(const SPCSampDirTable &);
+
+	const SPCSampDir & Parse(size_t srcn) const;
+	void ReadEntry(size_t srcn) const;
+
+	static inline uint32_t GetPCMKey(const SPCSampDir & sample) {
+		return ((uint32_t)sample.start_address << 16) | sample.end_address;
+	}
+
+	const uint8_t * ram;
+	uint16_t dir;
+	int length;
+
+	mutable SPCSampDir entries[256];
+	mutable bool parsed[256];
+	mutable BRRChainMemo memo;
+	mutable bool memo_ready;
+	mutable std::map<uint32_t, std::vector<int16_t> > pcm_cache;
+};
+
 #endif /* !SPCSAMPDIR_H_INCLUDED */
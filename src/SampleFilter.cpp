@@ -0,0 +1,475 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <string>
+#include <vector>
+
+#include "SampleFilter.h"
+
+static const char * const field_names[SampleFilter::NUM_FIELDS] = {
+	"srcn",
+	"start",
+	"loop",
+	"end",
+	"size",
+	"blocks",
+	"samples",
+	"loop_sample",
+	"looped",
+	"valid",
+	"aligned",
+	"overlaps_echo",
+	"voice",
+	"sounding"
+};
+
+// Recursive descent over the expression text, emitting the program as it
+// goes. Every rule leaves exactly one value on the stack.
+class SampleFilterCompiler
+{
+public:
+	SampleFilterCompiler(SampleFilter & filter, const std::string & expression) :
+		filter(filter),
+		text(expression.c_str()),
+		depth(0),
+		nesting(0)
+	{
+	}
+
+	bool Compile(void)
+	{
+		if (!ParseOr()) {
+			return false;
+		}
+
+		SkipSpaces();
+		if (*text != '\0') {
+			return Fail("Unexpected \"" + GetToken() + "\"");
+		}
+		return true;
+	}
+
+	std::string message;
+
+private:
+	static const int MAX_NESTING = 64;
+
+	void SkipSpaces(void)
+	{
+		while (isspace((unsigned char)*text)) {
+			text++;
+		}
+	}
+
+	bool Accept(const char * token)
+	{
+		SkipSpaces();
+		size_t length = strlen(token);
+		if (strncmp(text, token, length) != 0) {
+			return false;
+		}
+
+		// keywords must not run into a longer identifier
+		if (isalpha((unsigned char)token[0]) && (isalnum((unsigned char)text[length]) || text[length] == '_')) {
+			return false;
+		}
+
+		text += length;
+		return true;
+	}
+
+	std::string GetToken(void)
+	{
+		SkipSpaces();
+		if (*text == '\0') {
+			return "end of expression";
+		}
+
+		const char * end = text + 1;
+		if (isalnum((unsigned char)*text) || *text == '_' || *text == '$') {
+			while (isalnum((unsigned char)*end) || *end == '_') {
+				end++;
+			}
+		}
+		return std::string(text, end);
+	}
+
+	bool Fail(const std::string & message)
+	{
+		this->message = message;
+		return false;
+	}
+
+	bool Emit(SampleFilter::OpCode op, int32_t operand = 0, int32_t count = 0)
+	{
+		// loads push, binary operators pop one, the rest keep the depth
+		if (op == SampleFilter::OP_PUSH || op == SampleFilter::OP_LOAD) {
+			if (++depth > SampleFilter::MAX_STACK_DEPTH) {
+				return Fail("Expression is too complex");
+			}
+		}
+		else if (op >= SampleFilter::OP_EQ && op <= SampleFilter::OP_GE) {
+			depth--;
+		}
+
+		SampleFilter::Instruction instruction;
+		instruction.op = op;
+		instruction.operand = operand;
+		instruction.count = count;
+		filter.program.push_back(instruction);
+		return true;
+	}
+
+	bool ParseOr(void)
+	{
+		if (!ParseAnd()) {
+			return false;
+		}
+
+		while (Accept("||")) {
+			size_t jump = filter.program.size();
+			Emit(SampleFilter::OP_OR);
+			depth--;
+			if (!ParseAnd() || !Emit(SampleFilter::OP_TEST)) {
+				return false;
+			}
+			filter.program[jump].operand = (int32_t)filter.program.size();
+		}
+		return true;
+	}
+
+	bool ParseAnd(void)
+	{
+		if (!ParseComparison()) {
+			return false;
+		}
+
+		while (Accept("&&")) {
+			size_t jump = filter.program.size();
+			Emit(SampleFilter::OP_AND);
+			depth--;
+			if (!ParseComparison() || !Emit(SampleFilter::OP_TEST)) {
+				return false;
+			}
+			filter.program[jump].operand = (int32_t)filter.program.size();
+		}
+		return true;
+	}
+
+	bool ParseComparison(void)
+	{
+		if (!ParseUnary()) {
+			return false;
+		}
+
+		// two-character operators first
+		static const struct {
+			const char * token;
+			SampleFilter::OpCode op;
+		} operators[] = {
+			{ "==", SampleFilter::OP_EQ },
+			{ "!=", SampleFilter::OP_NE },
+			{ "<=", SampleFilter::OP_LE },
+			{ ">=", SampleFilter::OP_GE },
+			{ "<", SampleFilter::OP_LT },
+			{ ">", SampleFilter::OP_GT },
+		};
+		for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+			if (Accept(operators[i].token)) {
+				return ParseUnary() && Emit(operators[i].op);
+			}
+		}
+
+		if (Accept("in")) {
+			return ParseList();
+		}
+		return true;
+	}
+
+	bool ParseList(void)
+	{
+		if (!Accept("[")) {
+			return Fail("Expected \"[\" after \"in\", found \"" + GetToken() + "\"");
+		}
+
+		int32_t first_range = (int32_t)filter.ranges.size();
+		do {
+			SampleFilter::Range range;
+			if (!ParseNumber(range.first)) {
+				return false;
+			}
+			range.last = range.first;
+			if (Accept("..") && !ParseNumber(range.last)) {
+				return false;
+			}
+			if (range.first > range.last) {
+				return Fail("Empty range in list");
+			}
+			filter.ranges.push_back(range);
+		} while (Accept(","));
+
+		if (!Accept("]")) {
+			return Fail("Expected \"]\", found \"" + GetToken() + "\"");
+		}
+		return Emit(SampleFilter::OP_IN, first_range, (int32_t)filter.ranges.size() - first_range);
+	}
+
+	bool ParseUnary(void)
+	{
+		if (++nesting > MAX_NESTING) {
+			return Fail("Expression is too complex");
+		}
+
+		bool result;
+		if (Accept("!")) {
+			result = ParseUnary() && Emit(SampleFilter::OP_NOT);
+		}
+		else {
+			result = ParsePrimary();
+		}
+
+		nesting--;
+		return result;
+	}
+
+	bool ParsePrimary(void)
+	{
+		SkipSpaces();
+		if (*text == '\0') {
+			return Fail("Unexpected end of expression");
+		}
+
+		if (Accept("(")) {
+			if (!ParseOr()) {
+				return false;
+			}
+			if (!Accept(")")) {
+				return Fail("Expected \")\", found \"" + GetToken() + "\"");
+			}
+			return true;
+		}
+
+		if (isdigit((unsigned char)*text) || *text == '$') {
+			int32_t value;
+			return ParseNumber(value) && Emit(SampleFilter::OP_PUSH, value);
+		}
+
+		if (Accept("true")) {
+			return Emit(SampleFilter::OP_PUSH, 1);
+		}
+		if (Accept("false")) {
+			return Emit(SampleFilter::OP_PUSH, 0);
+		}
+
+		std::string name(GetToken());
+		for (int field = 0; field < SampleFilter::NUM_FIELDS; field++) {
+			if (name == field_names[field]) {
+				text += name.size();
+				return Emit(SampleFilter::OP_LOAD, field);
+			}
+		}
+
+		if (isalpha((unsigned char)name[0]) || name[0] == '_') {
+			return Fail("Unknown field \"" + name + "\"");
+		}
+		return Fail("Unexpected \"" + name + "\"");
+	}
+
+	bool ParseNumber(int32_t & value)
+	{
+		SkipSpaces();
+
+		int radix = 10;
+		const char * digits = text;
+		if (*digits == '$') {
+			radix = 16;
+			digits++;
+		}
+		else if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+			radix = 16;
+			digits += 2;
+		}
+
+		if (!isxdigit((unsigned char)*digits)) {
+			return Fail("Expected a number, found \"" + GetToken() + "\"");
+		}
+
+		char * endptr;
+		unsigned long number = strtoul(digits, &endptr, radix);
+		if (isalnum((unsigned char)*endptr) || *endptr == '_') {
+			return Fail("Number format error \"" + GetToken() + "\"");
+		}
+		if (number > 0x7fffffff) {
+			return Fail("Number out of range \"" + GetToken() + "\"");
+		}
+
+		value = (int32_t)number;
+		text = endptr;
+		return true;
+	}
+
+	SampleFilter & filter;
+	const char * text;
+	int depth;
+	int nesting;
+};
+
+SampleFilter::SampleFilter()
+{
+	Clear();
+}
+
+SampleFilter::~SampleFilter()
+{
+}
+
+bool SampleFilter::Compile(const std::string & expression)
+{
+	Clear();
+
+	SampleFilterCompiler compiler(*this, expression);
+	if (!compiler.Compile()) {
+		Clear();
+		m_message = compiler.message;
+		return false;
+	}
+
+	FindCandidates();
+	m_message.clear();
+	return true;
+}
+
+void SampleFilter::Clear(void)
+{
+	program.clear();
+	ranges.clear();
+	for (int srcn = 0; srcn < 256; srcn++) {
+		candidates[srcn] = true;
+	}
+}
+
+void SampleFilter::FindCandidates(void)
+{
+	if (program.size() < 2 || program[0].op != OP_LOAD || program[0].operand != FIELD_SRCN || program[1].op != OP_IN) {
+		return;
+	}
+
+	// a false test must reach the end through && alone: `srcn in [...] && a
+	// && b` qualifies, `srcn in [...] && a || b` does not
+	size_t target = 2;
+	while (target < program.size() && program[target].op == OP_AND) {
+		target = (size_t)program[target].operand;
+	}
+	if (target != program.size()) {
+		return;
+	}
+
+	for (int srcn = 0; srcn < 256; srcn++) {
+		bool found = false;
+		for (int32_t i = 0; i < program[1].count && !found; i++) {
+			const Range & range = ranges[program[1].operand + i];
+			found = (srcn >= range.first && srcn <= range.last);
+		}
+		candidates[srcn] = found;
+	}
+}
+
+bool SampleFilter::Evaluate(FieldSource & fields) const
+{
+	if (program.empty()) {
+		return true;
+	}
+
+	int32_t stack[MAX_STACK_DEPTH];
+	int sp = 0;
+	for (size_t pc = 0; pc < program.size(); pc++) {
+		const Instruction & instruction = program[pc];
+		switch (instruction.op) {
+		case OP_PUSH:
+			stack[sp++] = instruction.operand;
+			break;
+
+		case OP_LOAD:
+			stack[sp++] = fields.GetField((Field)instruction.operand);
+			break;
+
+		case OP_NOT:
+			stack[sp - 1] = (stack[sp - 1] == 0);
+			break;
+
+		case OP_TEST:
+			stack[sp - 1] = (stack[sp - 1] != 0);
+			break;
+
+		case OP_EQ:
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] == stack[sp]);
+			break;
+
+		case OP_NE:
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] != stack[sp]);
+			break;
+
+		case OP_LT:
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] < stack[sp]);
+			break;
+
+		case OP_LE:
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] <= stack[sp]);
+			break;
+
+		case OP_GT:
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] > stack[sp]);
+			break;
+
+		case OP_GE:
+			sp--;
+			stack[sp - 1] = (stack[sp - 1] >= stack[sp]);
+			break;
+
+		case OP_IN:
+		{
+			int32_t value = stack[sp - 1];
+			bool found = false;
+			for (int32_t i = 0; i < instruction.count && !found; i++) {
+				const Range & range = ranges[instruction.operand + i];
+				found = (value >= range.first && value <= range.last);
+			}
+			stack[sp - 1] = found;
+			break;
+		}
+
+		case OP_AND:
+			// a false left side is the result, the right side is skipped
+			if (stack[sp - 1] == 0) {
+				pc = instruction.operand - 1;
+			}
+			else {
+				sp--;
+			}
+			break;
+
+		case OP_OR:
+			if (stack[sp - 1] != 0) {
+				stack[sp - 1] = 1;
+				pc = instruction.operand - 1;
+			}
+			else {
+				sp--;
+			}
+			break;
+		}
+	}
+	return stack[0] != 0;
+}
+
+const char * SampleFilter::GetFieldName(Field field)
+{
+	return (field >= 0 && field < NUM_FIELDS) ? field_names[field] : NULL;
+}
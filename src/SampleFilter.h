@@ -0,0 +1,117 @@
+#ifndef SAMPLEFILTER_H_INCLUDED
+#define SAMPLEFILTER_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+// A sample selection expression, such as
+//   looped && size >= 288 && !overlaps_echo
+//   srcn in [1, 2, $10..$20] || voice
+// compiled once into a small stack program and then evaluated for each
+// directory entry. Fields are asked for only when the program reaches
+// them, so `srcn in [...] && valid` checks nothing for other SRCNs.
+//
+// Operands are integers (booleans are 0 and 1): fields, decimal or hex
+// ($ff, 0xff) numbers, true and false. Operators, from the loosest:
+// ||, &&, comparisons (== != < <= > >=) and `in [a, b..c]`, then !.
+class SampleFilter
+{
+public:
+	enum Field {
+		FIELD_SRCN = 0,
+		FIELD_START,            // SA
+		FIELD_LOOP,             // LSA
+		FIELD_END,              // EA
+		FIELD_SIZE,             // bytes of BRR data
+		FIELD_BLOCKS,
+		FIELD_SAMPLES,          // decoded sample count
+		FIELD_LOOP_SAMPLE,      // loop point in samples
+		FIELD_LOOPED,
+		FIELD_VALID,            // passes the checks that --force skips
+		FIELD_ALIGNED,          // no conflict with the samples accepted so far
+		FIELD_OVERLAPS_ECHO,
+		FIELD_VOICE,            // the SRCN of one of the eight voices
+		FIELD_SOUNDING,         // ... of a voice with a non-zero envelope
+		NUM_FIELDS
+	};
+
+	// values of the fields of the entry being evaluated
+	class FieldSource
+	{
+	public:
+		virtual ~FieldSource() {
+		}
+
+		virtual int32_t GetField(Field field) = 0;
+	};
+
+	SampleFilter();
+	virtual ~SampleFilter();
+
+	inline const std::string & message(void) const {
+		return m_message;
+	}
+
+	// nothing compiled: every sample passes
+	inline bool IsEmpty(void) const {
+		return program.empty();
+	}
+
+	// false for a SRCN ruled out by a leading `srcn in [...] &&`, for which
+	// Evaluate would fail without looking at anything else
+	inline bool IsCandidate(uint8_t srcn) const {
+		return candidates[srcn];
+	}
+
+	bool Compile(const std::string & expression);
+	void Clear(void);
+	bool Evaluate(FieldSource & fields) const;
+
+	static const char * GetFieldName(Field field);
+
+protected:
+	std::string m_message;
+
+private:
+	friend class SampleFilterCompiler;
+
+	static const int MAX_STACK_DEPTH = 32;
+
+	enum OpCode {
+		OP_PUSH,        // operand: value
+		OP_LOAD,        // operand: field
+		OP_NOT,
+		OP_TEST,        // x != 0
+		OP_EQ,
+		OP_NE,
+		OP_LT,
+		OP_LE,
+		OP_GT,
+		OP_GE,
+		OP_IN,          // operand: first range, count: number of ranges
+		OP_AND,         // operand: where to jump if the left side is false
+		OP_OR           // operand: where to jump if the left side is true
+	};
+
+	struct Instruction {
+		OpCode op;
+		int32_t operand;
+		int32_t count;
+	};
+
+	struct Range {
+		int32_t first;
+		int32_t last;
+	};
+
+	void FindCandidates(void);
+
+	std::vector<Instruction> program;
+	std::vector<Range> ranges;
+	bool candidates[256];
+};
+
+#endif /* !SAMPLEFILTER_H_INCLUDED */
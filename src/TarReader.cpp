@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "TarReader.h"
+#include "cpath.h"
+
+#ifdef WIN32
+#define strcasecmp _stricmp
+#endif
+
+// ustar header layout
+#define TAR_NAME_OFFSET     0
+#define TAR_NAME_SIZE       100
+#define TAR_SIZE_OFFSET     124
+#define TAR_SIZE_SIZE       12
+#define TAR_CHKSUM_OFFSET   148
+#define TAR_CHKSUM_SIZE     8
+#define TAR_TYPEFLAG_OFFSET 156
+#define TAR_MAGIC_OFFSET    257
+#define TAR_PREFIX_OFFSET   345
+#define TAR_PREFIX_SIZE     155
+
+// longest name accepted from GNU long name and pax records
+#define TAR_MAX_LONG_NAME   0x10000
+
+TarReader::TarReader() :
+	fp(NULL),
+	close_fp(false),
+	end_of_archive(true),
+	extension(),
+	max_file_size(UINT64_MAX)
+{
+}
+
+TarReader::~TarReader()
+{
+	Close();
+}
+
+bool TarReader::Open(const std::string & filename)
+{
+	Close();
+
+	if (filename == "-") {
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		fp = stdin;
+		close_fp = false;
+	}
+	else {
+		fp = fopen(filename.c_str(), "rb");
+		if (fp == NULL) {
+			m_message = "Unable to open";
+			return false;
+		}
+		close_fp = true;
+	}
+
+	end_of_archive = false;
+	m_message.clear();
+	return true;
+}
+
+void TarReader::Close(void)
+{
+	if (fp != NULL && close_fp) {
+		fclose(fp);
+	}
+	fp = NULL;
+	close_fp = false;
+	end_of_archive = true;
+}
+
+bool TarReader::Next(std::string & name, std::vector<uint8_t> & data, std::string & error)
+{
+	uint8_t block[BLOCK_SIZE];
+	std::string long_name;
+	std::string pax_path;
+
+	while (!end_of_archive) {
+		if (!ReadBlock(block)) {
+			// a truncated end-of-archive marker is tolerated, like most tar implementations do
+			end_of_archive = true;
+			break;
+		}
+
+		bool zero_block = true;
+		for (size_t i = 0; i < BLOCK_SIZE; i++) {
+			if (block[i] != 0) {
+				zero_block = false;
+				break;
+			}
+		}
+		if (zero_block) {
+			end_of_archive = true;
+			break;
+		}
+
+		if (!VerifyChecksum(block)) {
+			m_message = "Tar header checksum error";
+			end_of_archive = true;
+			return false;
+		}
+
+		uint64_t size;
+		if (!ParseNumber(&block[TAR_SIZE_OFFSET], TAR_SIZE_SIZE, size)) {
+			m_message = "Tar header format error";
+			end_of_archive = true;
+			return false;
+		}
+
+		char typeflag = (char)block[TAR_TYPEFLAG_OFFSET];
+		switch (typeflag) {
+		case 'L':
+		case 'x':
+		{
+			if (size > TAR_MAX_LONG_NAME) {
+				m_message = "Tar extended header too large";
+				end_of_archive = true;
+				return false;
+			}
+
+			std::vector<uint8_t> records;
+			if (!ReadData(size, records)) {
+				end_of_archive = true;
+				return false;
+			}
+
+			if (typeflag == 'L') {
+				long_name = GetFieldString(records.empty() ? NULL : &records[0], records.size());
+			}
+			else {
+				ParsePaxPath(records, pax_path);
+			}
+			continue;
+		}
+
+		case '0':
+		case '\0':
+		case '7':
+			break;
+
+		default:
+			// directories, links, devices and global headers carry no member data of interest
+			if (!SkipData(size)) {
+				end_of_archive = true;
+				return false;
+			}
+			long_name.clear();
+			pax_path.clear();
+			continue;
+		}
+
+		if (!pax_path.empty()) {
+			name = pax_path;
+		}
+		else if (!long_name.empty()) {
+			name = long_name;
+		}
+		else {
+			name = GetFieldString(&block[TAR_NAME_OFFSET], TAR_NAME_SIZE);
+			if (memcmp(&block[TAR_MAGIC_OFFSET], "ustar", 5) == 0 && block[TAR_PREFIX_OFFSET] != 0) {
+				name = GetFieldString(&block[TAR_PREFIX_OFFSET], TAR_PREFIX_SIZE) + "/" + name;
+			}
+		}
+		long_name.clear();
+		pax_path.clear();
+
+		if (!IsTargetFile(name)) {
+			if (!SkipData(size)) {
+				end_of_archive = true;
+				return false;
+			}
+			continue;
+		}
+
+		// the header size is not trusted with an allocation
+		if (size > max_file_size) {
+			if (!SkipData(size)) {
+				end_of_archive = true;
+				return false;
+			}
+			data.clear();
+			error = "File too large";
+			return true;
+		}
+
+		if (!ReadData(size, data)) {
+			end_of_archive = true;
+			return false;
+		}
+		error.clear();
+		return true;
+	}
+
+	m_message.clear();
+	return false;
+}
+
+bool TarReader::IsTargetFile(const std::string & name) const
+{
+	if (extension.empty()) {
+		return true;
+	}
+	return strcasecmp(path_findext(name.c_str()), extension.c_str()) == 0;
+}
+
+bool TarReader::ReadBlock(uint8_t * block)
+{
+	return fread(block, 1, BLOCK_SIZE, fp) == BLOCK_SIZE;
+}
+
+bool TarReader::ReadData(uint64_t size, std::vector<uint8_t> & data)
+{
+	if (size > (uint64_t)SIZE_MAX - BLOCK_SIZE) {
+		m_message = "Tar member too large";
+		return false;
+	}
+
+	// the member and its block padding are read in one go
+	size_t padded_size = (size_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+	data.resize(padded_size);
+	if (padded_size != 0 && fread(&data[0], 1, padded_size, fp) != padded_size) {
+		m_message = "Unexpected end of tar archive";
+		return false;
+	}
+	data.resize((size_t)size);
+	return true;
+}
+
+bool TarReader::SkipData(uint64_t size)
+{
+	uint8_t block[BLOCK_SIZE];
+	uint64_t num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	// stdin cannot seek, so the data is simply drained
+	for (uint64_t i = 0; i < num_blocks; i++) {
+		if (!ReadBlock(block)) {
+			m_message = "Unexpected end of tar archive";
+			return false;
+		}
+	}
+	return true;
+}
+
+bool TarReader::VerifyChecksum(const uint8_t * block)
+{
+	uint64_t stored_checksum;
+	if (!ParseNumber(&block[TAR_CHKSUM_OFFSET], TAR_CHKSUM_SIZE, stored_checksum)) {
+		return false;
+	}
+
+	// the checksum field itself counts as spaces; some old writers summed signed chars
+	uint32_t unsigned_sum = 0;
+	int32_t signed_sum = 0;
+	for (size_t i = 0; i < BLOCK_SIZE; i++) {
+		uint8_t c = block[i];
+		if (i >= TAR_CHKSUM_OFFSET && i < TAR_CHKSUM_OFFSET + TAR_CHKSUM_SIZE) {
+			c = ' ';
+		}
+		unsigned_sum += c;
+		signed_sum += (int8_t)c;
+	}
+
+	return stored_checksum == unsigned_sum || (int64_t)stored_checksum == signed_sum;
+}
+
+bool TarReader::ParseNumber(const uint8_t * field, size_t length, uint64_t & value)
+{
+	value = 0;
+
+	// GNU base-256 extension for values which do not fit in octal digits
+	if ((field[0] & 0x80) != 0) {
+		if ((field[0] & 0x40) != 0) {
+			return false;
+		}
+
+		value = field[0] & 0x3f;
+		for (size_t i = 1; i < length; i++) {
+			if ((value >> 56) != 0) {
+				return false;
+			}
+			value = (value << 8) | field[i];
+		}
+		return true;
+	}
+
+	size_t i = 0;
+	while (i < length && (field[i] == ' ' || field[i] == '\0')) {
+		i++;
+	}
+
+	for (; i < length; i++) {
+		if (field[i] == ' ' || field[i] == '\0') {
+			break;
+		}
+		if (field[i] < '0' || field[i] > '7') {
+			return false;
+		}
+		value = (value << 3) | (field[i] - '0');
+	}
+	return true;
+}
+
+std::string TarReader::GetFieldString(const uint8_t * field, size_t length)
+{
+	if (field == NULL) {
+		return std::string();
+	}
+
+	const uint8_t * end = (const uint8_t *)memchr(field, '\0', length);
+	if (end != NULL) {
+		length = end - field;
+	}
+	return std::string((const char *)field, length);
+}
+
+bool TarReader::ParsePaxPath(const std::vector<uint8_t> & records, std::string & path)
+{
+	// each record is "<length> <key>=<value>\n", where length covers the whole record
+	size_t offset = 0;
+	while (offset < records.size()) {
+		size_t record_length = 0;
+		size_t i = offset;
+		while (i < records.size() && records[i] >= '0' && records[i] <= '9') {
+			record_length = record_length * 10 + (records[i] - '0');
+			i++;
+		}
+
+		if (i >= records.size() || records[i] != ' ' || record_length == 0 || record_length > records.size() - offset) {
+			return false;
+		}
+		i++;
+		if (i > offset + record_length) {
+			return false;
+		}
+
+		std::string record((const char *)&records[i], offset + record_length - i);
+		if (!record.empty() && record[record.size() - 1] == '\n') {
+			record.erase(record.size() - 1);
+		}
+
+		std::string::size_type separator = record.find('=');
+		if (separator != std::string::npos && record.compare(0, separator, "path") == 0) {
+			path = record.substr(separator + 1);
+		}
+
+		offset += record_length;
+	}
+	return true;
+}
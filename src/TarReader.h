@@ -0,0 +1,72 @@
+#ifndef TARREADER_H_INCLUDED
+#define TARREADER_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Sequential reader for POSIX ustar archives (including GNU long names and
+// pax path records). The archive is consumed strictly front to back, so it
+// works on pipes such as stdin without extracting anything to disk.
+class TarReader
+{
+public:
+	TarReader();
+	virtual ~TarReader();
+
+	inline const std::string & GetExtension(void) const {
+		return extension;
+	}
+
+	// case-insensitive filter such as ".spc", empty string matches any member
+	inline void SetExtension(const std::string & extension) {
+		this->extension = extension;
+	}
+
+	// larger members are skipped and reported instead of read into memory
+	inline void SetMaxFileSize(uint64_t max_file_size) {
+		this->max_file_size = max_file_size;
+	}
+
+	inline const std::string & message(void) const {
+		return m_message;
+	}
+
+	// "-" reads the archive from stdin
+	bool Open(const std::string & filename);
+	void Close(void);
+
+	// Reads the next regular file member. Returns false at the end of the
+	// archive, or on error with a non-empty message(); a member which could
+	// not be read is reported through a non-empty error.
+	bool Next(std::string & name, std::vector<uint8_t> & data, std::string & error);
+
+protected:
+	static const size_t BLOCK_SIZE = 512;
+
+	FILE * fp;
+	bool close_fp;
+	bool end_of_archive;
+	std::string extension;
+	uint64_t max_file_size;
+
+	std::string m_message;
+
+private:
+	TarReader(const TarReader &);
+	TarReader & operator=(const TarReader &);
+
+	bool IsTargetFile(const std::string & name) const;
+	bool ReadBlock(uint8_t * block);
+	bool ReadData(uint64_t size, std::vector<uint8_t> & data);
+	bool SkipData(uint64_t size);
+
+	static bool VerifyChecksum(const uint8_t * block);
+	static bool ParseNumber(const uint8_t * field, size_t length, uint64_t & value);
+	static std::string GetFieldString(const uint8_t * field, size_t length);
+	static bool ParsePaxPath(const std::vector<uint8_t> & records, std::string & path);
+};
+
+#endif /* !TARREADER_H_INCLUDED */
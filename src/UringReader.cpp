@@ -0,0 +1,519 @@
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#if defined(IO_URING_OP_SUPPORTED) && defined(STATX_SIZE)
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#include "UringReader.h"
+
+// io_uring_enter calls in a row which may consume no entry of a full
+// submission queue before GetSQE gives up
+#define URING_MAX_SUBMIT_RETRIES 16
+
+enum UringReaderOp {
+	URING_OP_OPEN = 0,
+	URING_OP_STATX = 1,
+	URING_OP_READ = 2
+};
+
+struct UringReader::Request {
+	size_t slot;
+	size_t index;
+	bool done;
+	int pending;  // submitted operations not yet completed
+	int fd;
+	int error;
+	uint64_t file_size;
+	size_t read_size;
+#ifdef HAVE_IO_URING
+	struct statx stx;
+#endif
+	std::vector<uint8_t> data;
+};
+
+UringReader::UringReader() :
+	filenames(NULL),
+	max_file_size(UINT64_MAX),
+	next_submit_index(0),
+	next_deliver_index(0),
+	sqe_tail(0),
+	to_submit(0),
+	ring_fd(-1),
+	sq_ring(NULL),
+	sq_ring_size(0),
+	cq_ring(NULL),
+	cq_ring_size(0),
+	sqes(NULL),
+	sqes_size(0),
+	sq_head(NULL),
+	sq_tail(NULL),
+	sq_mask(0),
+	sq_entries(0),
+	sq_array(NULL),
+	cq_head(NULL),
+	cq_tail(NULL),
+	cq_mask(0),
+	cqes(NULL)
+{
+}
+
+UringReader::~UringReader()
+{
+	Stop();
+}
+
+bool UringReader::Start(const std::vector<std::string> & filenames, int queue_depth)
+{
+	Stop();
+
+#ifdef HAVE_IO_URING
+	if (queue_depth < 1) {
+		queue_depth = 1;
+	}
+
+	// every file has at most two operations (open + statx) in flight
+	if (!SetupRing((unsigned int)queue_depth * 2)) {
+		Stop();
+		return false;
+	}
+
+	this->filenames = &filenames;
+	next_submit_index = 0;
+	next_deliver_index = 0;
+
+	requests.resize((size_t)queue_depth);
+	for (size_t slot = 0; slot < requests.size(); slot++) {
+		requests[slot] = new Request();
+		requests[slot]->slot = slot;
+		requests[slot]->done = false;
+		requests[slot]->pending = 0;
+		requests[slot]->fd = -1;
+	}
+
+	FillQueue();
+	return Submit(false);
+#else
+	(void)filenames;
+	(void)queue_depth;
+	return false;
+#endif
+}
+
+bool UringReader::Next(size_t & index, std::vector<uint8_t> & data, int & error)
+{
+	if (!IsRunning() || next_deliver_index >= filenames->size()) {
+		return false;
+	}
+
+	Request & request = *requests[next_deliver_index % requests.size()];
+	while (!request.done) {
+		if (!Submit(true)) {
+			return false;
+		}
+	}
+
+	index = request.index;
+	error = request.error;
+	data.swap(request.data);
+	request.done = false;
+	next_deliver_index++;
+
+	// keep the ring busy while the caller parses this file
+	FillQueue();
+	Submit(false);
+	return true;
+}
+
+void UringReader::Stop()
+{
+#ifdef HAVE_IO_URING
+	if (ring_fd != -1) {
+		// buffers must not be released while the kernel may still write them
+		bool busy = true;
+		while (busy) {
+			busy = false;
+			for (auto itr = requests.begin(); itr != requests.end(); ++itr) {
+				if ((*itr)->pending != 0) {
+					busy = true;
+					break;
+				}
+			}
+
+			if (busy && !Submit(true)) {
+				break;
+			}
+		}
+	}
+
+	for (auto itr = requests.begin(); itr != requests.end(); ++itr) {
+		if ((*itr)->fd != -1) {
+			close((*itr)->fd);
+		}
+		delete *itr;
+	}
+	requests.clear();
+
+	if (sqes != NULL) {
+		munmap(sqes, sqes_size);
+	}
+	if (cq_ring != NULL && cq_ring != sq_ring) {
+		munmap(cq_ring, cq_ring_size);
+	}
+	if (sq_ring != NULL) {
+		munmap(sq_ring, sq_ring_size);
+	}
+	if (ring_fd != -1) {
+		close(ring_fd);
+	}
+#endif
+
+	filenames = NULL;
+	sqe_tail = 0;
+	to_submit = 0;
+	ring_fd = -1;
+	sq_ring = NULL;
+	cq_ring = NULL;
+	sqes = NULL;
+}
+
+bool UringReader::SetupRing(unsigned int entries)
+{
+#ifdef HAVE_IO_URING
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (ring_fd < 0) {
+		ring_fd = -1;
+		return false;
+	}
+
+	// make sure that every operation we need is implemented by this kernel
+	const int probe_ops = 256;
+	std::vector<uint8_t> probe_buffer(sizeof(struct io_uring_probe) + probe_ops * sizeof(struct io_uring_probe_op));
+	struct io_uring_probe * probe = (struct io_uring_probe *)&probe_buffer[0];
+	if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, probe_ops) < 0) {
+		return false;
+	}
+
+	const int required_ops[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ };
+	for (size_t i = 0; i < sizeof(required_ops) / sizeof(required_ops[0]); i++) {
+		int op = required_ops[i];
+		if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+			return false;
+		}
+	}
+
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+	}
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		sq_ring = NULL;
+		return false;
+	}
+
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		cq_ring = sq_ring;
+	}
+	else {
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			cq_ring = NULL;
+			return false;
+		}
+	}
+
+	sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		sqes = NULL;
+		return false;
+	}
+
+	uint8_t * sq = (uint8_t *)sq_ring;
+	sq_head = (unsigned int *)(sq + params.sq_off.head);
+	sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+	sq_entries = params.sq_entries;
+	sq_array = (unsigned int *)(sq + params.sq_off.array);
+	sqe_tail = *sq_tail;
+
+	uint8_t * cq = (uint8_t *)cq_ring;
+	cq_head = (unsigned int *)(cq + params.cq_off.head);
+	cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+	cqes = cq + params.cq_off.cqes;
+	return true;
+#else
+	(void)entries;
+	return false;
+#endif
+}
+
+void UringReader::FillQueue()
+{
+	while (next_submit_index < filenames->size() && next_submit_index < next_deliver_index + requests.size()) {
+		Request & request = *requests[next_submit_index % requests.size()];
+		request.index = next_submit_index;
+		request.done = false;
+		request.fd = -1;
+		request.error = 0;
+		request.file_size = 0;
+		request.read_size = 0;
+
+		// open and statx do not depend on each other, both go out at once;
+		// the extra count keeps an early completion from finishing the
+		// request before the second operation is queued
+		request.pending++;
+		PrepOpen(request);
+		PrepStatx(request);
+		next_submit_index++;
+
+		if (--request.pending == 0) {
+			FinishOpen(request);
+		}
+	}
+}
+
+bool UringReader::Submit(bool wait)
+{
+#ifdef HAVE_IO_URING
+	__atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+
+	unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	int result = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, wait ? 1 : 0, flags, NULL, 0);
+	if (result < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			return false;
+		}
+	}
+	else {
+		to_submit -= (unsigned int)result;
+	}
+
+	unsigned int head = *cq_head;
+	unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		const struct io_uring_cqe * cqe = &((const struct io_uring_cqe *)cqes)[head & cq_mask];
+		uint64_t user_data = cqe->user_data;
+		int32_t res = cqe->res;
+		head++;
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+		HandleCompletion(user_data, res);
+		tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	}
+	return true;
+#else
+	(void)wait;
+	return false;
+#endif
+}
+
+void UringReader::HandleCompletion(uint64_t user_data, int32_t result)
+{
+	Request & request = *requests[(size_t)(user_data >> 2)];
+	request.pending--;
+
+	switch ((UringReaderOp)(user_data & 3)) {
+	case URING_OP_OPEN:
+		if (result >= 0) {
+			request.fd = result;
+		}
+		else if (request.error == 0) {
+			request.error = -result;
+		}
+
+		if (request.pending == 0) {
+			FinishOpen(request);
+		}
+		break;
+
+	case URING_OP_STATX:
+#ifdef HAVE_IO_URING
+		if (result >= 0) {
+			request.file_size = request.stx.stx_size;
+		}
+		else if (request.error == 0) {
+			request.error = -result;
+		}
+#endif
+
+		if (request.pending == 0) {
+			FinishOpen(request);
+		}
+		break;
+
+	case URING_OP_READ:
+		if (result < 0) {
+			request.error = -result;
+			FinishRequest(request);
+		}
+		else if (result == 0) {
+			// file shrank after statx
+			request.data.resize(request.read_size);
+			FinishRequest(request);
+		}
+		else {
+			request.read_size += (size_t)result;
+			if (request.read_size < request.data.size()) {
+				PrepRead(request);
+			}
+			else {
+				FinishRequest(request);
+			}
+		}
+		break;
+	}
+}
+
+void UringReader::FinishOpen(Request & request)
+{
+	if (request.error == 0 && request.file_size > max_file_size) {
+		request.error = EFBIG;
+	}
+
+	if (request.error != 0 || request.file_size == 0) {
+		request.data.clear();
+		FinishRequest(request);
+		return;
+	}
+
+	request.data.resize((size_t)request.file_size);
+	request.read_size = 0;
+	PrepRead(request);
+}
+
+void UringReader::FinishRequest(Request & request)
+{
+#ifdef HAVE_IO_URING
+	if (request.fd != -1) {
+		close(request.fd);
+		request.fd = -1;
+	}
+#endif
+
+	if (request.error != 0) {
+		request.data.clear();
+	}
+	request.done = true;
+}
+
+void * UringReader::GetSQE()
+{
+#ifdef HAVE_IO_URING
+	// the ring holds two entries per request, so this only waits when
+	// the kernel has not consumed an earlier batch yet
+	int retries = 0;
+	while (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+		if (!Submit(false) || ++retries > URING_MAX_SUBMIT_RETRIES) {
+			return NULL;
+		}
+	}
+
+	unsigned int sqe_index = sqe_tail & sq_mask;
+	struct io_uring_sqe * sqe = &((struct io_uring_sqe *)sqes)[sqe_index];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[sqe_index] = sqe_index;
+	sqe_tail++;
+	to_submit++;
+	return sqe;
+#else
+	return NULL;
+#endif
+}
+
+void UringReader::CancelPrep(Request & request)
+{
+	// the operation never reached the ring, so no completion will come for it
+	request.pending--;
+	if (request.error == 0) {
+		request.error = EIO;
+	}
+	if (request.pending == 0) {
+		FinishOpen(request);
+	}
+}
+
+void UringReader::PrepOpen(Request & request)
+{
+#ifdef HAVE_IO_URING
+	request.pending++;
+	struct io_uring_sqe * sqe = (struct io_uring_sqe *)GetSQE();
+	if (sqe == NULL) {
+		CancelPrep(request);
+		return;
+	}
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uint64_t)(uintptr_t)(*filenames)[request.index].c_str();
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+	sqe->user_data = ((uint64_t)request.slot << 2) | URING_OP_OPEN;
+#else
+	(void)request;
+#endif
+}
+
+void UringReader::PrepStatx(Request & request)
+{
+#ifdef HAVE_IO_URING
+	request.pending++;
+	struct io_uring_sqe * sqe = (struct io_uring_sqe *)GetSQE();
+	if (sqe == NULL) {
+		CancelPrep(request);
+		return;
+	}
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uint64_t)(uintptr_t)(*filenames)[request.index].c_str();
+	sqe->len = STATX_SIZE;
+	sqe->off = (uint64_t)(uintptr_t)&request.stx;
+	sqe->user_data = ((uint64_t)request.slot << 2) | URING_OP_STATX;
+#else
+	(void)request;
+#endif
+}
+
+void UringReader::PrepRead(Request & request)
+{
+#ifdef HAVE_IO_URING
+	size_t remaining = request.data.size() - request.read_size;
+
+	request.pending++;
+	struct io_uring_sqe * sqe = (struct io_uring_sqe *)GetSQE();
+	if (sqe == NULL) {
+		CancelPrep(request);
+		return;
+	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = request.fd;
+	sqe->addr = (uint64_t)(uintptr_t)&request.data[request.read_size];
+	sqe->len = (uint32_t)std::min<size_t>(remaining, 0x40000000);
+	sqe->off = (uint64_t)request.read_size;
+	sqe->user_data = ((uint64_t)request.slot << 2) | URING_OP_READ;
+#else
+	(void)request;
+#endif
+}
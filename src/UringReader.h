@@ -0,0 +1,81 @@
+
+#ifndef URINGREADER_H_INCLUDED
+#define URINGREADER_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+// Reads a list of whole files through Linux io_uring, keeping up to
+// queue_depth open/statx/read requests in flight. Files are handed out
+// in list order regardless of completion order. Start() fails when
+// io_uring is not available, and callers fall back to their regular
+// synchronous input path.
+class UringReader
+{
+public:
+	UringReader();
+	virtual ~UringReader();
+
+	inline bool IsRunning(void) const {
+		return ring_fd != -1;
+	}
+
+	inline void SetMaxFileSize(uint64_t max_file_size) {
+		this->max_file_size = max_file_size;
+	}
+
+	bool Start(const std::vector<std::string> & filenames, int queue_depth);
+	bool Next(size_t & index, std::vector<uint8_t> & data, int & error);
+	void Stop();
+
+private:
+	UringReader(const UringReader&);
+	UringReader& operator=(const UringReader&);
+
+	struct Request;
+
+	bool SetupRing(unsigned int entries);
+	void FillQueue();
+	bool Submit(bool wait);
+	void HandleCompletion(uint64_t user_data, int32_t result);
+	void FinishOpen(Request & request);
+	void FinishRequest(Request & request);
+
+	void * GetSQE();
+	void CancelPrep(Request & request);
+	void PrepOpen(Request & request);
+	void PrepStatx(Request & request);
+	void PrepRead(Request & request);
+
+	const std::vector<std::string> * filenames;
+	uint64_t max_file_size;
+
+	std::vector<Request *> requests;
+	size_t next_submit_index;
+	size_t next_deliver_index;
+	unsigned int sqe_tail;
+	unsigned int to_submit;
+
+	int ring_fd;
+	void * sq_ring;
+	size_t sq_ring_size;
+	void * cq_ring;
+	size_t cq_ring_size;
+	void * sqes;
+	size_t sqes_size;
+
+	unsigned int * sq_head;
+	unsigned int * sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int * sq_array;
+	unsigned int * cq_head;
+	unsigned int * cq_tail;
+	unsigned int cq_mask;
+	void * cqes;
+};
+
+#endif /* !URINGREADER_H_INCLUDED */
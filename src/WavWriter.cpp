@@ -1,50 +1,91 @@
-
+#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <string>
 #include <vector>
-#include <iterator>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
 
 #include "WavWriter.h"
+#include "OutputSink.h"
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WAVWRITER_BIG_ENDIAN
+#endif
 
-static void write16(std::vector<uint8_t> & data, uint16_t value)
+static inline uint8_t * write16(uint8_t * p, uint16_t value)
 {
-	data.push_back(value & 0xff);
-	data.push_back((value >> 8) & 0xff);
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	return p + 2;
 }
 
-static void write32(std::vector<uint8_t> & data, uint32_t value)
+static inline uint8_t * write32(uint8_t * p, uint32_t value)
 {
-	data.push_back(value & 0xff);
-	data.push_back((value >> 8) & 0xff);
-	data.push_back((value >> 16) & 0xff);
-	data.push_back((value >> 24) & 0xff);
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = (value >> 16) & 0xff;
+	p[3] = (value >> 24) & 0xff;
+	return p + 4;
 }
 
-static void write(std::vector<uint8_t> & data, const char * value, size_t size)
+static inline uint8_t * write(uint8_t * p, const char * value, size_t size)
 {
-	for (size_t i = 0; i < size; i++) {
-		data.push_back(value[i]);
-	}
+	memcpy(p, value, size);
+	return p + size;
 }
 
 WavWriter::WavWriter() :
 	channels(1),
 	samplerate(44100),
 	bitwidth(16),
+	pcm(NULL),
+	pcm_count(0),
+	loop_sample(0),
+	looped(false)
+{
+}
+
+WavWriter::WavWriter(std::vector<int16_t> && samples) :
+	channels(1),
+	samplerate(44100),
+	bitwidth(16),
+	samples(std::move(samples)),
+	loop_sample(0),
+	looped(false)
+{
+	pcm = this->samples.empty() ? NULL : &this->samples[0];
+	pcm_count = this->samples.size();
+}
+
+WavWriter::WavWriter(const std::vector<int16_t> & samples) :
+	channels(1),
+	samplerate(44100),
+	bitwidth(16),
+	samples(samples),
 	loop_sample(0),
 	looped(false)
 {
+	pcm = this->samples.empty() ? NULL : &this->samples[0];
+	pcm_count = this->samples.size();
 }
 
-WavWriter::WavWriter(std::vector<int16_t> samples) :
+WavWriter::WavWriter(const int16_t * samples, size_t count) :
 	channels(1),
 	samplerate(44100),
 	bitwidth(16),
+	pcm(samples),
+	pcm_count(count),
 	loop_sample(0),
 	looped(false)
 {
-	this->samples.assign(samples.begin(), samples.end());
 }
 
 WavWriter::~WavWriter()
@@ -53,102 +94,199 @@ WavWriter::~WavWriter()
 
 void WavWriter::AddSample(int16_t sample)
 {
+	OwnSamples();
 	samples.push_back(sample);
+	pcm = &samples[0];
+	pcm_count = samples.size();
 }
 
-void WavWriter::AddSample(std::vector<int16_t> samples)
+void WavWriter::AddSample(const int16_t * samples, size_t count)
 {
-	std::copy(samples.begin(), samples.end(), std::back_inserter(this->samples));
+	OwnSamples();
+	this->samples.insert(this->samples.end(), samples, samples + count);
+	pcm = this->samples.empty() ? NULL : &this->samples[0];
+	pcm_count = this->samples.size();
 }
 
-bool WavWriter::WriteFile(const std::string & filename)
+void WavWriter::AddSample(const std::vector<int16_t> & samples)
 {
-	int16_t bytes_per_sample = bitwidth / 8;
-	if (bitwidth != 16) {
-		m_message = "Unsupported bitwidth";
-		return false;
+	AddSample(samples.empty() ? NULL : &samples[0], samples.size());
+}
+
+void WavWriter::OwnSamples()
+{
+	// a borrowed buffer is copied once before it can grow
+	if (pcm_count != 0 && (samples.empty() || pcm != &samples[0])) {
+		samples.assign(pcm, pcm + pcm_count);
 	}
+}
 
+bool WavWriter::WriteFile(const std::string & filename)
+{
 	FILE * wav_file = fopen(filename.c_str(), "wb");
 	if (wav_file == NULL) {
 		m_message = "File open error";
 		return false;
 	}
 
-	std::vector<uint8_t> header;
-	header.reserve(36);
-	write(header, "RIFF", 4);
-	write32(header, 0); // 0x04: put actual file size later
-	write(header, "WAVE", 4);
-	write(header, "fmt ", 4);
-	write32(header, 16);
-	write16(header, 1);
-	write16(header, channels);
-	write32(header, samplerate);
-	write32(header, samplerate * bytes_per_sample * channels);
-	write16(header, bytes_per_sample * channels);
-	write16(header, bitwidth);
-
-	std::vector<uint8_t> data_chunk;
-	data_chunk.reserve(8 + samples.size() * 2);
-	write(data_chunk, "data", 4);
-	write32(data_chunk, (uint32_t)(samples.size() * 2));
-	for (auto itr_sample = samples.begin(); itr_sample != samples.end(); ++itr_sample) {
-		int16_t sample = *itr_sample;
-		write16(data_chunk, sample);
+#ifdef _WIN32
+	bool result = WriteFile(_fileno(wav_file));
+#else
+	bool result = WriteFile(fileno(wav_file));
+#endif
+	fclose(wav_file);
+	return result;
+}
+
+bool WavWriter::WriteFile(int fd)
+{
+	uint8_t header[HEADER_SIZE];
+	uint8_t smpl_chunk[SMPL_CHUNK_SIZE];
+	size_t smpl_chunk_size;
+	if (!BuildChunks(header, smpl_chunk, smpl_chunk_size)) {
+		return false;
 	}
 
-	std::vector<uint8_t> smpl_chunk;
-	// add loop point info (smpl chunk) if needed... details:
-	// en: http://www.blitter.com/~russtopia/MIDI/~jglatt/tech/wave.htm
-	// ja: http://co-coa.sakura.ne.jp/index.php?Sound%20Programming%2FWave%20File%20Format
-	if (looped) {
-		smpl_chunk.reserve(8 + 60);
-		write(smpl_chunk, "smpl", 4);
-		write32(smpl_chunk, 60); // chunk size
-		write32(smpl_chunk, 0);  // manufacturer
-		write32(smpl_chunk, 0);  // product
-		write32(smpl_chunk, 1000000000 / samplerate); // sample period
-		write32(smpl_chunk, 60); // MIDI uniti note (C5)
-		write32(smpl_chunk, 0);  // MIDI pitch fraction
-		write32(smpl_chunk, 0);  // SMPTE format
-		write32(smpl_chunk, 0);  // SMPTE offset
-		write32(smpl_chunk, 1);  // sample loops
-		write32(smpl_chunk, 0);  // sampler data
-		write32(smpl_chunk, 0);  // cue point ID
-		write32(smpl_chunk, 0);  // type (loop forward)
-		write32(smpl_chunk, loop_sample); // start sample #
-		write32(smpl_chunk, (uint32_t)samples.size() / channels); // end sample #
-		write32(smpl_chunk, 0);  // fraction
-		write32(smpl_chunk, 0);  // playcount
+	const uint8_t * pcm_bytes = (const uint8_t *)pcm;
+#ifdef WAVWRITER_BIG_ENDIAN
+	std::vector<uint8_t> swapped(pcm_count * 2);
+	for (size_t i = 0; i < pcm_count; i++) {
+		write16(&swapped[i * 2], (uint16_t)pcm[i]);
 	}
+	pcm_bytes = swapped.empty() ? NULL : &swapped[0];
+#endif
 
-	uint32_t whole_size = (uint32_t)(header.size() + data_chunk.size() + smpl_chunk.size() - 8);
-	header[4] = whole_size & 0xff;
-	header[5] = (whole_size >> 8) & 0xff;
-	header[6] = (whole_size >> 16) & 0xff;
-	header[7] = (whole_size >> 24) & 0xff;
+	const uint8_t * parts[3] = { header, pcm_bytes, smpl_chunk };
+	size_t sizes[3] = { HEADER_SIZE, pcm_count * 2, smpl_chunk_size };
 
-	if (fwrite(&header[0], header.size(), 1, wav_file) != 1) {
-		m_message = "File write error";
-		fclose(wav_file);
-		return false;
+#ifdef _WIN32
+	for (int i = 0; i < 3; i++) {
+		const uint8_t * p = parts[i];
+		size_t size = sizes[i];
+		while (size != 0) {
+			int written = _write(fd, p, (unsigned int)size);
+			if (written <= 0) {
+				m_message = "File write error";
+				return false;
+			}
+			p += written;
+			size -= written;
+		}
 	}
-
-	if (fwrite(&data_chunk[0], data_chunk.size(), 1, wav_file) != 1) {
-		m_message = "File write error";
-		fclose(wav_file);
-		return false;
+#else
+	struct iovec iov[3];
+	int iov_count = 0;
+	for (int i = 0; i < 3; i++) {
+		if (sizes[i] != 0) {
+			iov[iov_count].iov_base = (void *)parts[i];
+			iov[iov_count].iov_len = sizes[i];
+			iov_count++;
+		}
 	}
 
-	if (smpl_chunk.size() != 0) {
-		if (fwrite(&smpl_chunk[0], smpl_chunk.size(), 1, wav_file) != 1) {
+	// a short write resumes from where it stopped
+	struct iovec * iov_next = iov;
+	while (iov_count != 0) {
+		ssize_t written = writev(fd, iov_next, iov_count);
+		if (written <= 0) {
 			m_message = "File write error";
-			fclose(wav_file);
 			return false;
 		}
+
+		while (iov_count != 0 && (size_t)written >= iov_next->iov_len) {
+			written -= iov_next->iov_len;
+			iov_next++;
+			iov_count--;
+		}
+		if (iov_count != 0) {
+			iov_next->iov_base = (uint8_t *)iov_next->iov_base + written;
+			iov_next->iov_len -= written;
+		}
 	}
+#endif
 
-	fclose(wav_file);
+	return true;
+}
+
+bool WavWriter::WriteTo(OutputSink & sink, const std::string & dir, const std::string & filename)
+{
+	uint8_t header[HEADER_SIZE];
+	uint8_t smpl_chunk[SMPL_CHUNK_SIZE];
+	size_t smpl_chunk_size;
+	if (!BuildChunks(header, smpl_chunk, smpl_chunk_size)) {
+		return false;
+	}
+
+	const uint8_t * pcm_bytes = (const uint8_t *)pcm;
+#ifdef WAVWRITER_BIG_ENDIAN
+	std::vector<uint8_t> swapped(pcm_count * 2);
+	for (size_t i = 0; i < pcm_count; i++) {
+		write16(&swapped[i * 2], (uint16_t)pcm[i]);
+	}
+	pcm_bytes = swapped.empty() ? NULL : &swapped[0];
+#endif
+
+	OutputChunk chunks[3] = {
+		OutputChunk(header, HEADER_SIZE),
+		OutputChunk(pcm_bytes, pcm_count * 2),
+		OutputChunk(smpl_chunk, smpl_chunk_size),
+	};
+	if (!sink.WriteFile(dir, filename, chunks, 3)) {
+		m_message = sink.message();
+		return false;
+	}
+	return true;
+}
+
+bool WavWriter::BuildChunks(uint8_t * header, uint8_t * smpl_chunk, size_t & smpl_chunk_size)
+{
+	int16_t bytes_per_sample = bitwidth / 8;
+	if (bitwidth != 16) {
+		m_message = "Unsupported bitwidth";
+		return false;
+	}
+
+	smpl_chunk_size = looped ? SMPL_CHUNK_SIZE : 0;
+	uint32_t data_size = (uint32_t)(pcm_count * 2);
+	uint32_t whole_size = (uint32_t)(HEADER_SIZE + data_size + smpl_chunk_size - 8);
+
+	uint8_t * p = header;
+	p = write(p, "RIFF", 4);
+	p = write32(p, whole_size);
+	p = write(p, "WAVE", 4);
+	p = write(p, "fmt ", 4);
+	p = write32(p, 16);
+	p = write16(p, 1);
+	p = write16(p, channels);
+	p = write32(p, samplerate);
+	p = write32(p, samplerate * bytes_per_sample * channels);
+	p = write16(p, bytes_per_sample * channels);
+	p = write16(p, bitwidth);
+	p = write(p, "data", 4);
+	p = write32(p, data_size);
+
+	// add loop point info (smpl chunk) if needed... details:
+	// en: http://www.blitter.com/~russtopia/MIDI/~jglatt/tech/wave.htm
+	// ja: http://co-coa.sakura.ne.jp/index.php?Sound%20Programming%2FWave%20File%20Format
+	if (looped) {
+		p = smpl_chunk;
+		p = write(p, "smpl", 4);
+		p = write32(p, 60); // chunk size
+		p = write32(p, 0);  // manufacturer
+		p = write32(p, 0);  // product
+		p = write32(p, 1000000000 / samplerate); // sample period
+		p = write32(p, 60); // MIDI uniti note (C5)
+		p = write32(p, 0);  // MIDI pitch fraction
+		p = write32(p, 0);  // SMPTE format
+		p = write32(p, 0);  // SMPTE offset
+		p = write32(p, 1);  // sample loops
+		p = write32(p, 0);  // sampler data
+		p = write32(p, 0);  // cue point ID
+		p = write32(p, 0);  // type (loop forward)
+		p = write32(p, loop_sample); // start sample #
+		p = write32(p, (uint32_t)pcm_count / channels); // end sample #
+		p = write32(p, 0);  // fraction
+		p = write32(p, 0);  // playcount
+	}
 	return true;
 }
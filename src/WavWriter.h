@@ -3,18 +3,32 @@
 #define WAVWRITER_H
 
 #include <stdint.h>
+#include <cstddef>
 
+#include <string>
 #include <vector>
 
+class OutputSink;
+
+// Writes 16-bit PCM as a RIFF WAVE file. The header and the optional smpl
+// chunk have fixed sizes, so the whole file is emitted in one gathered
+// write straight from the sample buffer (on little-endian hosts).
 class WavWriter
 {
 public:
 	WavWriter();
-	WavWriter(std::vector<int16_t> samples);
+	WavWriter(std::vector<int16_t> && samples);
+	WavWriter(const std::vector<int16_t> & samples);
+	// refers to the caller's buffer, which must outlive the writer (no copy is made)
+	WavWriter(const int16_t * samples, size_t count);
 	virtual ~WavWriter();
 
-	const std::vector<int16_t> & GetSamples() const {
-		return samples;
+	inline const int16_t * GetSamples() const {
+		return pcm;
+	}
+
+	inline size_t GetSampleCount() const {
+		return pcm_count;
 	}
 
 	inline int32_t GetLoopSample() const {
@@ -35,19 +49,34 @@ public:
 	}
 
 	void AddSample(int16_t sample);
-	void AddSample(std::vector<int16_t> samples);
+	void AddSample(const int16_t * samples, size_t count);
+	void AddSample(const std::vector<int16_t> & samples);
 	bool WriteFile(const std::string & filename);
+	bool WriteFile(int fd);
+	bool WriteTo(OutputSink & sink, const std::string & dir, const std::string & filename);
 
 	int16_t channels;
 	int32_t samplerate;
 	int16_t bitwidth;
 
 protected:
+	static const size_t HEADER_SIZE = 44;
+	static const size_t SMPL_CHUNK_SIZE = 68;
+
 	std::string m_message;
 
 	std::vector<int16_t> samples;
+	const int16_t * pcm;    // samples.data() or the caller's buffer
+	size_t pcm_count;
 	int32_t loop_sample;
 	bool looped;
+
+private:
+	WavWriter(const WavWriter &);
+	WavWriter & operator=(const WavWriter &);
+
+	void OwnSamples();
+	bool BuildChunks(uint8_t * header, uint8_t * smpl_chunk, size_t & smpl_chunk_size);
 };
 
 #endif
@@ -0,0 +1,459 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ZipReader.h"
+#include "Inflate.h"
+#include "cpath.h"
+
+#ifdef WIN32
+#define strcasecmp _stricmp
+#endif
+
+#define ZIP_LOCAL_HEADER_SIGNATURE      0x04034b50
+#define ZIP_CENTRAL_HEADER_SIGNATURE    0x02014b50
+#define ZIP_EOCD_SIGNATURE              0x06054b50
+#define ZIP64_EOCD_SIGNATURE            0x06064b50
+#define ZIP64_EOCD_LOCATOR_SIGNATURE    0x07064b50
+
+#define ZIP_LOCAL_HEADER_SIZE           30
+#define ZIP_CENTRAL_HEADER_SIZE         46
+#define ZIP_EOCD_SIZE                   22
+#define ZIP64_EOCD_SIZE                 56
+#define ZIP64_EOCD_LOCATOR_SIZE         20
+
+#define ZIP_METHOD_STORED               0
+#define ZIP_METHOD_DEFLATE              8
+#define ZIP_FLAG_ENCRYPTED              0x0001
+
+static inline uint16_t read_u16(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t read_u32(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t read_u64(const uint8_t * p)
+{
+	return read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
+
+ZipReader::ZipReader() :
+	extension(),
+	num_threads(0),
+	max_file_size(UINT64_MAX),
+	map_base(NULL),
+	map_size(0),
+	next_extract_index(0),
+	next_deliver_index(0),
+	stopping(false)
+{
+}
+
+ZipReader::~ZipReader()
+{
+	Close();
+}
+
+bool ZipReader::Open(const std::string & filename)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		m_message = "Unable to open";
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < ZIP_EOCD_SIZE || (ULONGLONG)file_size.QuadPart > (SIZE_MAX >> 1)) {
+		CloseHandle(file);
+		m_message = "Not a ZIP archive";
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		m_message = "Unable to map the archive";
+		return false;
+	}
+
+	void * base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (base == NULL) {
+		m_message = "Unable to map the archive";
+		return false;
+	}
+	map_size = (size_t)file_size.QuadPart;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) {
+		m_message = "Unable to open";
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < ZIP_EOCD_SIZE) {
+		close(fd);
+		m_message = "Not a ZIP archive";
+		return false;
+	}
+
+	void * base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		m_message = "Unable to map the archive";
+		return false;
+	}
+	map_size = (size_t)st.st_size;
+#endif
+
+	map_base = (const uint8_t *)base;
+
+	if (!ReadCentralDirectory()) {
+		Close();
+		return false;
+	}
+
+	m_message.clear();
+	return true;
+}
+
+void ZipReader::Close(void)
+{
+	Stop();
+	Unmap();
+	entries.clear();
+}
+
+bool ZipReader::IsTargetFile(const std::string & name) const
+{
+	if (name.empty() || name[name.size() - 1] == '/') {
+		return false;
+	}
+
+	if (extension.empty()) {
+		return true;
+	}
+	return strcasecmp(path_findext(name.c_str()), extension.c_str()) == 0;
+}
+
+bool ZipReader::ReadCentralDirectory(void)
+{
+	// the end of central directory record is followed by a comment of up to 64 KB
+	size_t eocd_offset = map_size - ZIP_EOCD_SIZE;
+	size_t eocd_limit = (map_size > ZIP_EOCD_SIZE + 0xffff) ? (map_size - ZIP_EOCD_SIZE - 0xffff) : 0;
+	for (;;) {
+		if (read_u32(&map_base[eocd_offset]) == ZIP_EOCD_SIGNATURE) {
+			break;
+		}
+		if (eocd_offset == eocd_limit) {
+			m_message = "Not a ZIP archive";
+			return false;
+		}
+		eocd_offset--;
+	}
+
+	const uint8_t * eocd = &map_base[eocd_offset];
+	uint64_t num_entries = read_u16(&eocd[10]);
+	uint64_t cd_size = read_u32(&eocd[12]);
+	uint64_t cd_offset = read_u32(&eocd[16]);
+
+	if (num_entries == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff) {
+		if (eocd_offset < ZIP64_EOCD_LOCATOR_SIZE) {
+			m_message = "Broken Zip64 end of central directory";
+			return false;
+		}
+
+		const uint8_t * locator = &map_base[eocd_offset - ZIP64_EOCD_LOCATOR_SIZE];
+		if (read_u32(locator) != ZIP64_EOCD_LOCATOR_SIGNATURE) {
+			m_message = "Broken Zip64 end of central directory";
+			return false;
+		}
+
+		uint64_t eocd64_offset = read_u64(&locator[8]);
+		if (map_size < ZIP64_EOCD_SIZE || eocd64_offset > map_size - ZIP64_EOCD_SIZE || read_u32(&map_base[eocd64_offset]) != ZIP64_EOCD_SIGNATURE) {
+			m_message = "Broken Zip64 end of central directory";
+			return false;
+		}
+
+		const uint8_t * eocd64 = &map_base[eocd64_offset];
+		num_entries = read_u64(&eocd64[32]);
+		cd_size = read_u64(&eocd64[40]);
+		cd_offset = read_u64(&eocd64[48]);
+	}
+
+	if (cd_offset > map_size || cd_size > map_size - cd_offset) {
+		m_message = "Broken central directory";
+		return false;
+	}
+
+	const uint8_t * p = &map_base[cd_offset];
+	const uint8_t * cd_end = p + cd_size;
+	for (uint64_t i = 0; i < num_entries; i++) {
+		if ((size_t)(cd_end - p) < ZIP_CENTRAL_HEADER_SIZE || read_u32(p) != ZIP_CENTRAL_HEADER_SIGNATURE) {
+			m_message = "Broken central directory";
+			return false;
+		}
+
+		uint16_t name_length = read_u16(&p[28]);
+		uint16_t extra_length = read_u16(&p[30]);
+		uint16_t comment_length = read_u16(&p[32]);
+		size_t header_size = ZIP_CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+		if ((size_t)(cd_end - p) < header_size) {
+			m_message = "Broken central directory";
+			return false;
+		}
+
+		Entry entry;
+		entry.name.assign((const char *)&p[ZIP_CENTRAL_HEADER_SIZE], name_length);
+		entry.flags = read_u16(&p[8]);
+		entry.method = read_u16(&p[10]);
+		entry.crc32 = read_u32(&p[16]);
+		entry.compressed_size = read_u32(&p[20]);
+		entry.uncompressed_size = read_u32(&p[24]);
+		entry.local_header_offset = read_u32(&p[42]);
+
+		// Zip64 extended information holds only the fields saturated above, in this order
+		const uint8_t * extra = &p[ZIP_CENTRAL_HEADER_SIZE + name_length];
+		const uint8_t * extra_end = extra + extra_length;
+		while (extra_end - extra >= 4) {
+			uint16_t tag = read_u16(extra);
+			uint16_t size = read_u16(&extra[2]);
+			if (extra_end - extra - 4 < size) {
+				break;
+			}
+
+			if (tag == 0x0001) {
+				const uint8_t * field = &extra[4];
+				const uint8_t * field_end = field + size;
+				if (entry.uncompressed_size == 0xffffffff && field_end - field >= 8) {
+					entry.uncompressed_size = read_u64(field);
+					field += 8;
+				}
+				if (entry.compressed_size == 0xffffffff && field_end - field >= 8) {
+					entry.compressed_size = read_u64(field);
+					field += 8;
+				}
+				if (entry.local_header_offset == 0xffffffff && field_end - field >= 8) {
+					entry.local_header_offset = read_u64(field);
+					field += 8;
+				}
+			}
+			extra += 4 + size;
+		}
+
+		if (IsTargetFile(entry.name)) {
+			entries.push_back(entry);
+		}
+
+		p += header_size;
+	}
+
+	return true;
+}
+
+bool ZipReader::Extract(size_t index, std::vector<uint8_t> & data, std::string & error) const
+{
+	const Entry & entry = entries[index];
+
+	if ((entry.flags & ZIP_FLAG_ENCRYPTED) != 0) {
+		error = "Encrypted members are not supported";
+		return false;
+	}
+	if (entry.method != ZIP_METHOD_STORED && entry.method != ZIP_METHOD_DEFLATE) {
+		error = "Unsupported compression method";
+		return false;
+	}
+	if (entry.uncompressed_size > max_file_size || entry.uncompressed_size > (SIZE_MAX >> 1)) {
+		error = "File too large";
+		return false;
+	}
+
+	if (map_size < ZIP_LOCAL_HEADER_SIZE || entry.local_header_offset > map_size - ZIP_LOCAL_HEADER_SIZE ||
+		read_u32(&map_base[entry.local_header_offset]) != ZIP_LOCAL_HEADER_SIGNATURE) {
+		error = "Broken local file header";
+		return false;
+	}
+
+	// the local header may carry a different extra field than the central directory
+	const uint8_t * local_header = &map_base[entry.local_header_offset];
+	uint64_t data_offset = entry.local_header_offset + ZIP_LOCAL_HEADER_SIZE + read_u16(&local_header[26]) + read_u16(&local_header[28]);
+	if (data_offset > map_size || entry.compressed_size > map_size - data_offset) {
+		error = "Unexpected end of archive";
+		return false;
+	}
+
+	const uint8_t * src = &map_base[data_offset];
+	size_t size = (size_t)entry.uncompressed_size;
+	data.resize(size);
+
+	if (entry.method == ZIP_METHOD_STORED) {
+		if (entry.compressed_size != entry.uncompressed_size) {
+			error = "Broken central directory";
+			return false;
+		}
+		if (size != 0) {
+			memcpy(&data[0], src, size);
+		}
+	}
+	else {
+		size_t out_size;
+		if (!Inflate::Decompress(src, (size_t)entry.compressed_size, data.empty() ? NULL : &data[0], size, out_size) || out_size != size) {
+			error = "Decompression error";
+			return false;
+		}
+	}
+
+	if (Crc32(data.empty() ? NULL : &data[0], size) != entry.crc32) {
+		error = "CRC error";
+		return false;
+	}
+
+	error.clear();
+	return true;
+}
+
+void ZipReader::Start(void)
+{
+	Stop();
+
+	int num_workers = num_threads;
+	if (num_workers <= 0) {
+		num_workers = (int)std::thread::hardware_concurrency();
+		if (num_workers <= 0) {
+			num_workers = 1;
+		}
+	}
+
+	// a couple of buffers per worker keeps every thread busy while the caller consumes
+	slots.resize((size_t)num_workers * 2);
+	for (auto itr = slots.begin(); itr != slots.end(); ++itr) {
+		itr->done = false;
+	}
+
+	next_extract_index = 0;
+	next_deliver_index = 0;
+	stopping = false;
+	for (int i = 0; i < num_workers; i++) {
+		workers.push_back(std::thread(&ZipReader::WorkerMain, this));
+	}
+}
+
+bool ZipReader::Next(size_t & index, std::vector<uint8_t> & data, std::string & error)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (workers.empty() || next_deliver_index >= entries.size()) {
+		return false;
+	}
+
+	Slot & slot = slots[next_deliver_index % slots.size()];
+	slot_ready.wait(lock, [&slot] { return slot.done; });
+
+	// the caller's previous buffer goes back to the slot for reuse
+	index = next_deliver_index;
+	data.swap(slot.data);
+	error.swap(slot.error);
+	slot.done = false;
+	next_deliver_index++;
+
+	lock.unlock();
+	slot_free.notify_all();
+	return true;
+}
+
+void ZipReader::Stop(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	slot_free.notify_all();
+
+	for (auto itr = workers.begin(); itr != workers.end(); ++itr) {
+		itr->join();
+	}
+	workers.clear();
+	slots.clear();
+}
+
+void ZipReader::WorkerMain(void)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		slot_free.wait(lock, [this] {
+			return stopping || next_extract_index >= entries.size() ||
+				next_extract_index < next_deliver_index + slots.size();
+		});
+		if (stopping || next_extract_index >= entries.size()) {
+			break;
+		}
+
+		size_t index = next_extract_index++;
+		Slot & slot = slots[index % slots.size()];
+		lock.unlock();
+
+		Extract(index, slot.data, slot.error);
+
+		lock.lock();
+		slot.done = true;
+		slot_ready.notify_all();
+	}
+}
+
+void ZipReader::Unmap(void)
+{
+	if (map_base != NULL) {
+#ifdef _WIN32
+		UnmapViewOfFile(map_base);
+#else
+		munmap((void *)map_base, map_size);
+#endif
+		map_base = NULL;
+		map_size = 0;
+	}
+}
+
+uint32_t ZipReader::Crc32(const uint8_t * data, size_t size, uint32_t crc)
+{
+	struct Crc32Table {
+		uint32_t table[256];
+
+		Crc32Table() {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++) {
+					c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+				}
+				table[i] = c;
+			}
+		}
+	};
+	static const Crc32Table crc_table;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = crc_table.table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
@@ -0,0 +1,113 @@
+#ifndef ZIPREADER_H_INCLUDED
+#define ZIPREADER_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Reads members of a ZIP archive (stored or deflate, including Zip64) from
+// a read-only mapping of the archive. Start() decompresses members on a
+// pool of worker threads into a window of reusable buffers, and Next()
+// hands them out in central directory order.
+class ZipReader
+{
+public:
+	struct Entry {
+		std::string name;
+		uint16_t flags;
+		uint16_t method;
+		uint32_t crc32;
+		uint64_t compressed_size;
+		uint64_t uncompressed_size;
+		uint64_t local_header_offset;
+	};
+
+	ZipReader();
+	virtual ~ZipReader();
+
+	inline const std::string & GetExtension(void) const {
+		return extension;
+	}
+
+	// case-insensitive filter such as ".spc", empty string matches any member
+	inline void SetExtension(const std::string & extension) {
+		this->extension = extension;
+	}
+
+	inline int GetNumThreads(void) const {
+		return num_threads;
+	}
+
+	inline void SetNumThreads(int num_threads) {
+		this->num_threads = num_threads;
+	}
+
+	inline void SetMaxFileSize(uint64_t max_file_size) {
+		this->max_file_size = max_file_size;
+	}
+
+	inline const std::vector<Entry> & GetEntries(void) const {
+		return entries;
+	}
+
+	inline const std::string & message(void) const {
+		return m_message;
+	}
+
+	bool Open(const std::string & filename);
+	void Close(void);
+
+	// Thread-safe; data is resized to the member size.
+	bool Extract(size_t index, std::vector<uint8_t> & data, std::string & error) const;
+
+	// Next() returns false after the last member; a member which could
+	// not be extracted is reported through a non-empty error.
+	void Start(void);
+	bool Next(size_t & index, std::vector<uint8_t> & data, std::string & error);
+	void Stop(void);
+
+	static uint32_t Crc32(const uint8_t * data, size_t size, uint32_t crc = 0);
+
+protected:
+	std::string extension;
+	int num_threads;
+	uint64_t max_file_size;
+
+	std::vector<Entry> entries;
+
+	std::string m_message;
+
+private:
+	ZipReader(const ZipReader &);
+	ZipReader & operator=(const ZipReader &);
+
+	struct Slot {
+		std::vector<uint8_t> data;
+		std::string error;
+		bool done;
+	};
+
+	bool IsTargetFile(const std::string & name) const;
+	bool ReadCentralDirectory(void);
+	void WorkerMain(void);
+	void Unmap(void);
+
+	const uint8_t * map_base;
+	size_t map_size;
+
+	std::vector<std::thread> workers;
+	std::vector<Slot> slots;
+	std::mutex mutex;
+	std::condition_variable slot_ready;
+	std::condition_variable slot_free;
+	size_t next_extract_index;
+	size_t next_deliver_index;
+	bool stopping;
+};
+
+#endif /* !ZIPREADER_H_INCLUDED */
@@ -11,10 +11,16 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
+#include <memory>
 
 #include "cpath.h"
 #include "SPCSampDir.h"
+#include "BRRFileScanner.h"
 #include "WavWriter.h"
+#include "OutputSink.h"
+#include "UringReader.h"
+#include "ZipReader.h"
 
 #ifdef WIN32
 #include <Windows.h>
@@ -22,16 +28,23 @@
 #include <float.h>
 #define getcwd _getcwd
 #define chdir _chdir
+#define mkdir(path, mode) _mkdir(path)
 #define isnan _isnan
 #define strcasecmp _stricmp
 #else
 #include <unistd.h>
+#include <sys/stat.h>
 #endif
 
 #define APP_NAME    "brr2wav"
 #define APP_VER     "[2015-11-04]"
 #define APP_URL     "http://github.com/gocha/split700"
 
+#define MAX_BRR_FILE_SIZE   0x800000
+
+// informational messages move to stderr when stdout carries the output archive
+static FILE * info_stream = stdout;
+
 uint8_t * readfile(const std::string & filename)
 {
 	off_t filesize = path_getfilesize(filename.c_str());
@@ -66,30 +79,69 @@ uint8_t * readfile(const std::string & filename)
 	return data;
 }
 
-bool brr2wav(const std::string & brr_filename, uint16_t pitch)
+static std::string get_wav_filename(const std::string & brr_filename)
 {
 	char path_c[PATH_MAX];
+	strcpy(path_c, brr_filename.c_str());
+	path_basename(path_c);
+	path_stripext(path_c);
+	strcat(path_c, ".wav");
+	return std::string(path_c);
+}
 
-	off_t brr_filesize = path_getfilesize(brr_filename.c_str());
-	if (brr_filesize == -1) {
-		fprintf(stderr, "Error: %s: Unable to open\n", brr_filename.c_str());
-		return false;
-	}
-	if (brr_filesize == 0) {
-		fprintf(stderr, "Error: %s: File is empty\n", brr_filename.c_str());
-		return false;
+// Maps a ZIP member to "<archive>/<member>.wav" under the working directory,
+// creating the directories on the way if requested. Leading slashes are
+// dropped and ".." is rejected.
+static bool get_member_wav_filename(const std::string & zip_filename, const std::string & member_name, std::string & wav_filename, bool create_dirs)
+{
+	char path_c[PATH_MAX];
+	strcpy(path_c, zip_filename.c_str());
+	path_basename(path_c);
+	path_stripext(path_c);
+	wav_filename = path_c;
+
+	std::string component;
+	std::string::size_type offset = 0;
+	bool has_name = false;
+	while (offset <= member_name.size()) {
+		std::string::size_type separator = member_name.find('/', offset);
+		if (separator == std::string::npos) {
+			separator = member_name.size();
+		}
+		component = member_name.substr(offset, separator - offset);
+		offset = separator + 1;
+
+		if (component.empty() || component == ".") {
+			continue;
+		}
+		if (component == "..") {
+			return false;
+		}
+
+		if (create_dirs && !path_isdir(wav_filename.c_str()) && mkdir(wav_filename.c_str(), 0777) != 0) {
+			return false;
+		}
+		wav_filename += PATH_SEPARATOR_STR + component;
+		has_name = true;
 	}
-	if (brr_filesize > 0x800000) {
-		fprintf(stderr, "Error: %s: File too large\n", brr_filename.c_str());
+	if (!has_name) {
 		return false;
 	}
 
-	uint8_t * data = readfile(brr_filename);
-	if (data == NULL) {
+	strcpy(path_c, wav_filename.c_str());
+	path_stripext(path_c);
+	wav_filename = std::string(path_c) + ".wav";
+	return true;
+}
+
+bool brr2wav(const std::string & brr_filename, const uint8_t * data, size_t brr_filesize, const std::string & wav_filename, uint16_t pitch, OutputSink & sink)
+{
+	if (brr_filesize == 0) {
+		fprintf(stderr, "Error: %s: File is empty\n", brr_filename.c_str());
 		return false;
 	}
 
-	uint8_t * brr = data;
+	const uint8_t * brr = data;
 	size_t brr_size = brr_filesize;
 
 	int32_t loop_sample = 0;
@@ -103,7 +155,7 @@ bool brr2wav(const std::string & brr_filename, uint16_t pitch)
 		loop_sample = loop_offset / 9 * 16;
 
 		if (loop_offset % 9 == 0) {
-			printf("%s: addmusicM header detected, loop offset = $%04x (sample #%d).\n", brr_filename.c_str(), loop_offset, loop_sample);
+			fprintf(info_stream, "%s: addmusicM header detected, loop offset = $%04x (sample #%d).\n", brr_filename.c_str(), loop_offset, loop_sample);
 			has_header = true;
 		}
 		else {
@@ -122,12 +174,6 @@ bool brr2wav(const std::string & brr_filename, uint16_t pitch)
 		break;
 	}
 
-	strcpy(path_c, brr_filename.c_str());
-	path_basename(path_c);
-	path_stripext(path_c);
-	strcat(path_c, ".wav");
-	std::string wav_filename(path_c);
-
 	bool looped = false;
 	WavWriter wave(SPCSampDir::decode_brr(brr, brr_size, &looped));
 	wave.samplerate = pitch * 32000 / 0x1000;
@@ -137,16 +183,112 @@ bool brr2wav(const std::string & brr_filename, uint16_t pitch)
 		wave.SetLoopSample(loop_sample);
 	}
 
-	if (!wave.WriteFile(wav_filename)) {
+	char wav_dir_c[PATH_MAX];
+	strcpy(wav_dir_c, wav_filename.c_str());
+	path_dirname(wav_dir_c);
+	std::string wav_dir(wav_dir_c[0] != '\0' ? wav_dir_c : ".");
+
+	char wav_basename_c[PATH_MAX];
+	strcpy(wav_basename_c, wav_filename.c_str());
+	path_basename(wav_basename_c);
+
+	if (!wave.WriteTo(sink, wav_dir, wav_basename_c)) {
 		fprintf(stderr, "Error: %s: %s\n", wav_filename.c_str(), wave.message().c_str());
-		delete[] data;
 		return false;
 	}
 
-	delete[] data;
 	return true;
 }
 
+bool brr2wav(const std::string & brr_filename, uint16_t pitch, OutputSink & sink)
+{
+	off_t brr_filesize = path_getfilesize(brr_filename.c_str());
+	if (brr_filesize == -1) {
+		fprintf(stderr, "Error: %s: Unable to open\n", brr_filename.c_str());
+		return false;
+	}
+	if (brr_filesize == 0) {
+		fprintf(stderr, "Error: %s: File is empty\n", brr_filename.c_str());
+		return false;
+	}
+	if (brr_filesize > MAX_BRR_FILE_SIZE) {
+		fprintf(stderr, "Error: %s: File too large\n", brr_filename.c_str());
+		return false;
+	}
+
+	uint8_t * data = readfile(brr_filename);
+	if (data == NULL) {
+		return false;
+	}
+
+	bool result = brr2wav(brr_filename, data, (size_t)brr_filesize, get_wav_filename(brr_filename), pitch, sink);
+	delete[] data;
+	return result;
+}
+
+// Scan mode: writes every BRR chain found at any offset of the file as
+// "<name>_<offset>.wav" (or .brr), with the file offset in hexadecimal.
+// Loop points are unknown without a sample directory, so none is written.
+bool brr_scan(const std::string & filename, BRRFileScanner & file_scanner, bool raw_output, uint16_t pitch, OutputSink & sink)
+{
+	if (!file_scanner.Open(filename)) {
+		fprintf(stderr, "Error: %s: %s\n", filename.c_str(), file_scanner.message().c_str());
+		return false;
+	}
+	const uint8_t * data = file_scanner.GetData();
+
+	// outputs go next to the input, as in normal mode
+	char out_dir_c[PATH_MAX];
+	strcpy(out_dir_c, filename.c_str());
+	path_dirname(out_dir_c);
+	std::string out_dir(out_dir_c[0] != '\0' ? out_dir_c : ".");
+
+	char base_name_c[PATH_MAX];
+	strcpy(base_name_c, filename.c_str());
+	path_basename(base_name_c);
+	path_stripext(base_name_c);
+	std::string base_name(base_name_c);
+
+	bool result = true;
+	unsigned long long num_chains = 0;
+	std::vector<BRRScanner::Chain> chains;
+	file_scanner.Start();
+	while (result && file_scanner.Next(chains)) {
+		for (auto itr_chain = chains.begin(); itr_chain != chains.end(); ++itr_chain) {
+			const BRRScanner::Chain & chain = *itr_chain;
+
+			char suffix[32];
+			sprintf(suffix, "_%08llx", (unsigned long long)chain.start);
+			std::string out_filename(base_name + suffix + (raw_output ? ".brr" : ".wav"));
+
+			if (raw_output) {
+				OutputChunk chunk(&data[chain.start], chain.end - chain.start);
+				if (!sink.WriteFile(out_dir, out_filename, &chunk, 1)) {
+					fprintf(stderr, "Error: %s: %s\n", out_filename.c_str(), sink.message().c_str());
+					result = false;
+					break;
+				}
+			}
+			else {
+				WavWriter wave(SPCSampDir::decode_brr(&data[chain.start], chain.end - chain.start));
+				wave.samplerate = pitch * 32000 / 0x1000;
+				wave.bitwidth = 16;
+				wave.channels = 1;
+				if (!wave.WriteTo(sink, out_dir, out_filename)) {
+					fprintf(stderr, "Error: %s: %s\n", out_filename.c_str(), wave.message().c_str());
+					result = false;
+					break;
+				}
+			}
+			num_chains++;
+		}
+	}
+	file_scanner.Close();
+
+	fprintf(info_stream, "%s: %llu BRR chains found.\n", filename.c_str(), num_chains);
+	return result;
+}
+
 static void usage(const char * progname)
 {
 	printf("%s %s\n", APP_NAME, APP_VER);
@@ -157,7 +299,7 @@ static void usage(const char * progname)
 	printf("Usage\n");
 	printf("-----\n");
 	printf("\n");
-	printf("Syntax: `%s [options] [brr files]`\n", progname);
+	printf("Syntax: `%s [options] [brr/zip files]`\n", progname);
 	printf("\n");
 
 	printf("### Options\n");
@@ -165,6 +307,30 @@ static void usage(const char * progname)
 	printf("`--pitch HEX_VALUE`\n");
 	printf("  : Specify pitch (sample rate) for output file (0x1000 = 1.0)\n");
 	printf("\n");
+	printf("`--scan`\n");
+	printf("  : Scan each input file (e.g. a ROM image) of any size for BRR chains at every offset, and convert each one found.\n");
+	printf("\n");
+	printf("`--brr`\n");
+	printf("  : With `--scan`, write the chains found as BRR files instead of WAVE files.\n");
+	printf("\n");
+	printf("`--min-blocks N`\n");
+	printf("  : With `--scan`, ignore chains shorter than N blocks (default: 8).\n");
+	printf("\n");
+	printf("`--min-score N`\n");
+	printf("  : With `--scan`, ignore chains that score below N of 100 on looking like real samples (default: 70).\n");
+	printf("\n");
+	printf("`--threads N`\n");
+	printf("  : Number of threads for `--scan` (default: number of cores).\n");
+	printf("\n");
+	printf("`--sink TYPE`\n");
+	printf("  : Output destination: `dir` (files, default), `tar` (tar archive to stdout) or `null` (count only).\n");
+	printf("\n");
+	printf("`--io-uring`\n");
+	printf("  : Read input files through io_uring when available (Linux).\n");
+	printf("\n");
+	printf("`--io-depth N`\n");
+	printf("  : Number of input files kept in flight with `--io-uring` (default: 32).\n");
+	printf("\n");
 	printf("`-?`, `--help`\n");
 	printf("  : Display this help.\n");
 	printf("\n");
@@ -173,6 +339,12 @@ static void usage(const char * progname)
 int main(int argc, char *argv[])
 {
 	uint16_t pitch = 0x1000;
+	bool use_io_uring = false;
+	int io_queue_depth = 32;
+	std::string sink_name("dir");
+	bool scan_mode = false;
+	bool raw_output = false;
+	BRRFileScanner file_scanner;
 
 	long l;
 	char * endptr = NULL;
@@ -210,6 +382,84 @@ int main(int argc, char *argv[])
 			pitch = (uint16_t)l;
 			argi++;
 		}
+		else if (strcmp(argv[argi], "--scan") == 0) {
+			scan_mode = true;
+		}
+		else if (strcmp(argv[argi], "--brr") == 0) {
+			raw_output = true;
+		}
+		else if (strcmp(argv[argi], "--min-blocks") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			l = strtol(argv[argi + 1], &endptr, 10);
+			if (*endptr != '\0' || errno == ERANGE || l < 1 || l > 0x10000 / SPCSampDir::BRR_CHUNK_SIZE) {
+				fprintf(stderr, "Error: Number format error (minimum block count must be 1-%d) \"%s\"\n", 0x10000 / SPCSampDir::BRR_CHUNK_SIZE, argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			file_scanner.GetScanner().SetMinBlocks((size_t)l);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--min-score") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			l = strtol(argv[argi + 1], &endptr, 10);
+			if (*endptr != '\0' || errno == ERANGE || l < 0 || l > 100) {
+				fprintf(stderr, "Error: Number format error (minimum score must be 0-100) \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			file_scanner.GetScanner().SetMinScore((int)l);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--threads") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			l = strtol(argv[argi + 1], &endptr, 10);
+			if (*endptr != '\0' || errno == ERANGE || l < 1 || l > 4096) {
+				fprintf(stderr, "Error: Number format error (thread count must be 1-4096) \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			file_scanner.SetNumThreads((int)l);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--sink") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			sink_name = argv[argi + 1];
+			if (sink_name != "dir" && sink_name != "tar" && sink_name != "null") {
+				fprintf(stderr, "Error: Unknown output sink \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--io-uring") == 0) {
+			use_io_uring = true;
+		}
+		else if (strcmp(argv[argi], "--io-depth") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			l = strtol(argv[argi + 1], &endptr, 10);
+			if (*endptr != '\0' || errno == ERANGE || l < 1 || l > 4096) {
+				fprintf(stderr, "Error: Number format error (queue depth must be 1-4096) \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			io_queue_depth = (int)l;
+			argi++;
+		}
 		else {
 			fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[argi]);
 			return EXIT_FAILURE;
@@ -221,14 +471,135 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (raw_output && !scan_mode) {
+		fprintf(stderr, "Error: \"--brr\" requires \"--scan\"\n");
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<OutputSink> sink;
+	if (sink_name == "tar") {
+		sink.reset(new TarSink(stdout));
+		info_stream = stderr;
+	}
+	else if (sink_name == "null") {
+		sink.reset(new NullSink());
+	}
+	else {
+		sink.reset(new DirectorySink());
+	}
+
 	int errors = 0;
+
+	// inputs of any size and type are mapped and scanned, not read as one BRR stream
+	if (scan_mode) {
+		for (; argi < argc; argi++) {
+			if (!brr_scan(argv[argi], file_scanner, raw_output, pitch, *sink)) {
+				errors++;
+			}
+		}
+	}
+
+	std::vector<std::string> brr_filenames;
+	std::vector<std::string> zip_filenames;
 	for (; argi < argc; argi++) {
-		std::string brr_filename(argv[argi]);
-		if (!brr2wav(brr_filename, pitch)) {
+		if (strcasecmp(path_findext(argv[argi]), ".zip") == 0) {
+			zip_filenames.push_back(argv[argi]);
+		}
+		else {
+			brr_filenames.push_back(argv[argi]);
+		}
+	}
+
+	UringReader uring_reader;
+	if (use_io_uring) {
+		uring_reader.SetMaxFileSize(MAX_BRR_FILE_SIZE);
+		if (uring_reader.Start(brr_filenames, io_queue_depth)) {
+			fprintf(stderr, "Info: Input backend: io_uring (queue depth %d)\n", io_queue_depth);
+		}
+		else {
+			fprintf(stderr, "Info: Input backend: stdio (io_uring is not available)\n");
+		}
+	}
+
+	std::vector<uint8_t> brr_data;
+	for (size_t brr_index = 0; brr_index < brr_filenames.size(); brr_index++) {
+		const std::string & brr_filename = brr_filenames[brr_index];
+		bool result;
+
+		if (uring_reader.IsRunning()) {
+			size_t read_index;
+			int read_error;
+			if (!uring_reader.Next(read_index, brr_data, read_error)) {
+				read_error = EIO;
+			}
+
+			if (read_error == EFBIG) {
+				fprintf(stderr, "Error: %s: File too large\n", brr_filename.c_str());
+				result = false;
+			}
+			else if (read_error != 0) {
+				fprintf(stderr, "Error: %s: Unable to open\n", brr_filename.c_str());
+				result = false;
+			}
+			else {
+				result = brr2wav(brr_filename, brr_data.empty() ? NULL : &brr_data[0], brr_data.size(), get_wav_filename(brr_filename), pitch, *sink);
+			}
+		}
+		else {
+			result = brr2wav(brr_filename, pitch, *sink);
+		}
+
+		if (!result) {
 			//fprintf(stderr, "Error: %s: Conversion failed\n", brr_filename.c_str());
 			errors++;
 		}
 	}
 
+	ZipReader zip_reader;
+	zip_reader.SetExtension(".brr");
+	zip_reader.SetMaxFileSize(MAX_BRR_FILE_SIZE);
+	for (auto itr_zip = zip_filenames.begin(); itr_zip != zip_filenames.end(); ++itr_zip) {
+		if (!zip_reader.Open(*itr_zip)) {
+			fprintf(stderr, "Error: %s: %s\n", itr_zip->c_str(), zip_reader.message().c_str());
+			errors++;
+			continue;
+		}
+
+		const std::vector<ZipReader::Entry> & entries = zip_reader.GetEntries();
+
+		size_t member_index;
+		std::string zip_error;
+		std::string wav_filename;
+		zip_reader.Start();
+		while (zip_reader.Next(member_index, brr_data, zip_error)) {
+			std::string brr_filename(*itr_zip + "/" + entries[member_index].name);
+			if (!zip_error.empty()) {
+				fprintf(stderr, "Error: %s: %s\n", brr_filename.c_str(), zip_error.c_str());
+				errors++;
+				continue;
+			}
+
+			if (!get_member_wav_filename(*itr_zip, entries[member_index].name, wav_filename, sink_name == "dir")) {
+				fprintf(stderr, "Error: %s: Unable to create output path\n", brr_filename.c_str());
+				errors++;
+				continue;
+			}
+
+			if (!brr2wav(brr_filename, brr_data.empty() ? NULL : &brr_data[0], brr_data.size(), wav_filename, pitch, *sink)) {
+				errors++;
+			}
+		}
+		zip_reader.Close();
+	}
+
+	if (!sink->Finish()) {
+		fprintf(stderr, "Error: %s\n", sink->message().c_str());
+		errors++;
+	}
+
+	if (sink_name == "null") {
+		fprintf(stderr, "Info: %llu files, %llu bytes\n", (unsigned long long)sink->GetFileCount(), (unsigned long long)sink->GetByteCount());
+	}
+
 	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
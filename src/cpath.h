@@ -5,6 +5,7 @@
 #ifndef CPATH_H_INCLUDED
 #define CPATH_H_INCLUDED
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
@@ -121,7 +122,20 @@ static INLINE void path_dirname(char *path)
 #ifdef _WIN32
 	PathRemoveFileSpecA(path);
 #else
-	dirname(path);
+	/* in place like PathRemoveFileSpec; dirname() may return static storage instead */
+	char *pslash = strrchr(path, PATH_SEPARATOR_CHAR);
+	if (pslash == NULL)
+	{
+		path[0] = '\0';
+	}
+	else if (pslash == path)
+	{
+		path[1] = '\0';
+	}
+	else
+	{
+		*pslash = '\0';
+	}
 #endif
 }
 
@@ -165,6 +179,25 @@ static off_t path_getfilesize(const char *path)
 	return -1;
 }
 
+/* size of an already opened file, saves a second path lookup */
+static off_t file_getsize(FILE *fp)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_fstat64(_fileno(fp), &st) == 0)
+	{
+		return (off_t)st.st_size;
+	}
+#else
+	struct stat st;
+	if (fstat(fileno(fp), &st) == 0)
+	{
+		return st.st_size;
+	}
+#endif
+	return -1;
+}
+
 static char *path_getabspath(const char *path, char *absolute_path)
 {
 #ifdef _WIN32
@@ -8,33 +8,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <errno.h>
 
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <map>
+#include <memory>
 
 #include "split700.h"
 #include "cpath.h"
 #include "SPCFile.h"
+#include "SPCFileView.h"
 #include "SPCSampDir.h"
 #include "WavWriter.h"
+#include "DirWalker.h"
+#include "InputScheduler.h"
+#include "UringReader.h"
+#include "TarReader.h"
+#include "ZipReader.h"
 
 #ifdef WIN32
 #include <Windows.h>
 #include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <float.h>
-#define getcwd _getcwd
-#define chdir _chdir
+#define mkdir(path, mode) _mkdir(path)
 #define isnan _isnan
 #define strcasecmp _stricmp
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #endif
 
 #define APP_NAME    "split700"
 #define APP_VER     "[2015-11-04]"
 #define APP_URL     "http://github.com/gocha/split700"
 
+// an SPC is 66KB plus its extended ID666 tags; anything far larger is not one
+#define MAX_SPC_FILE_SIZE   0x100000
+
 static std::vector<std::string> split(const std::string &str, char delim)
 {
 	std::vector<std::string> tokens;
@@ -60,9 +76,30 @@ static std::string trim(const std::string & str, const char * trim_chars = " \t\
 	return result;
 }
 
+static std::string get_base_path(const std::string & spc_filename)
+{
+	char base_path_c[PATH_MAX];
+	strcpy(base_path_c, spc_filename.c_str());
+	path_stripext(base_path_c);
+	return std::string(base_path_c);
+}
+
+static std::string get_basename(const std::string & spc_filename)
+{
+	char basename_c[PATH_MAX];
+	strcpy(basename_c, spc_filename.c_str());
+	path_basename(basename_c);
+	return std::string(basename_c);
+}
+
 Split700::Split700() :
 	loop_point_to_filename(false),
-	force(false)
+	force(false),
+	list_memory_layout(false),
+	scan_orphans(false),
+	voice_selection(VOICES_NONE),
+	play_seconds(0),
+	output_sink(&directory_sink)
 {
 }
 
@@ -72,177 +109,260 @@ Split700::~Split700()
 
 bool Split700::ExportLoopSamples(const std::string & spc_filename, bool export_loop_point)
 {
-	SPCFile * spc_file_ptr = SPCFile::Load(spc_filename);
-	if (spc_file_ptr == NULL) {
+	if (!SPCFileView::OpenInto(spc_filename, spc_view)) {
 		m_message = "File open error (possible invalid format)";
 		return false;
 	}
 
-	char base_path_c[PATH_MAX];
-	strcpy(base_path_c, spc_filename.c_str());
-	path_stripext(base_path_c);
-	std::string base_path(base_path_c);
+	std::string base_path(get_base_path(spc_filename));
 
-	bool result = ExportLoopSamples(*spc_file_ptr, base_path, export_loop_point);
-	delete spc_file_ptr;
+	bool result = ExportLoopSamples(spc_view, base_path, export_loop_point);
+	spc_view.Reset();
 	return result;
 }
 
 bool Split700::ExportLoopSamples(const std::string & spc_filename, const std::vector<uint8_t> & srcns, bool export_loop_point)
 {
-	SPCFile * spc_file_ptr = SPCFile::Load(spc_filename);
-	if (spc_file_ptr == NULL) {
+	if (!SPCFileView::OpenInto(spc_filename, spc_view)) {
 		m_message = "File open error (possible invalid format)";
 		return false;
 	}
 
-	char base_path_c[PATH_MAX];
-	strcpy(base_path_c, spc_filename.c_str());
-	path_stripext(base_path_c);
-	std::string base_path(base_path_c);
+	std::string base_path(get_base_path(spc_filename));
 
-	bool result = ExportLoopSamples(*spc_file_ptr, base_path, srcns, export_loop_point);
-	delete spc_file_ptr;
+	bool result = ExportLoopSamples(spc_view, base_path, srcns, export_loop_point);
+	spc_view.Reset();
 	return result;
 }
 
 bool Split700::ExportLoopSamples(const SPCFile & spc_file, const std::string & base_path, bool export_loop_point)
 {
-	std::vector<uint8_t> srcns(GetSampList(spc_file));
-	return ExportLoopSamples(spc_file, base_path, srcns, export_loop_point);
+	return ExportLoopSamples(SPCFileView(spc_file), base_path, export_loop_point);
 }
 
 bool Split700::ExportLoopSamples(const SPCFile & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, bool export_loop_point)
 {
-	char pwd[PATH_MAX];
-	getcwd(pwd, PATH_MAX);
-
-	char base_dir_c[PATH_MAX];
-	strcpy(base_dir_c, base_path.c_str());
-	path_dirname(base_dir_c);
-	std::string base_dir(base_dir_c);
-
-	std::vector<uint8_t> dumpable_srcns = QueryDumpableSamples(spc_file, srcns);
-	for (auto itr_srcn = dumpable_srcns.begin(); itr_srcn != dumpable_srcns.end(); ++itr_srcn) {
-		uint8_t srcn = *itr_srcn;
-		const SPCSampDir & sample = spc_file.samples[srcn];
-
-		std::string brr_filename(GetExportFilename(spc_file, base_path, srcn, ".brr"));
-
-		chdir(base_dir.c_str());
-		FILE * brr_file = fopen(brr_filename.c_str(), "wb");
-		if (brr_file == NULL) {
-			chdir(pwd);
-			m_message = brr_filename + ": File open error";
-			return false;
-		}
-		chdir(pwd);
-
-		if (export_loop_point) {
-			uint16_t loop_point_rel;
-			if (sample.looped && sample.loop_address >= sample.start_address && sample.loop_address < sample.end_address) {
-				loop_point_rel = sample.loop_address - sample.start_address;
-			}
-			else {
-				loop_point_rel = sample.end_address - sample.start_address;
-			}
-
-			uint8_t data[2] = { (uint8_t)(loop_point_rel & 0xff), (uint8_t)(loop_point_rel >> 8) };
-			if (fwrite(data, 2, 1, brr_file) != 1) {
-				m_message = brr_filename + ": File write error";
-				fclose(brr_file);
-				return false;
-			}
-		}
-
-		if (fwrite(&spc_file.ram[sample.start_address], sample.compressed_size(), 1, brr_file) != 1) {
-			m_message = brr_filename + ": File write error";
-			fclose(brr_file);
-			return false;
-		}
+	return ExportLoopSamples(SPCFileView(spc_file), base_path, srcns, export_loop_point);
+}
 
-		fclose(brr_file);
-	}
+bool Split700::ExportLoopSamples(const SPCFileView & spc_file, const std::string & base_path, bool export_loop_point)
+{
+	std::vector<uint8_t> srcns(GetSampList(spc_file));
+	return ExportLoopSamples(spc_file, base_path, srcns, export_loop_point);
+}
 
-	return true;
+bool Split700::ExportLoopSamples(const SPCFileView & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, bool export_loop_point)
+{
+	return ExportSamples(spc_file, base_path, std::string(), srcns, OUTPUT_BRR, export_loop_point);
 }
 
 bool Split700::ExportLoopSamplesAsWAV(const std::string & spc_filename, int32_t samplerate)
 {
-	SPCFile * spc_file_ptr = SPCFile::Load(spc_filename);
-	if (spc_file_ptr == NULL) {
+	if (!SPCFileView::OpenInto(spc_filename, spc_view)) {
 		m_message = "File open error (possible invalid format)";
 		return false;
 	}
 
-	char base_path_c[PATH_MAX];
-	strcpy(base_path_c, spc_filename.c_str());
-	path_stripext(base_path_c);
-	std::string base_path(base_path_c);
-
+	std::string base_path(get_base_path(spc_filename));
 
-	bool result = ExportLoopSamplesAsWAV(*spc_file_ptr, base_path, samplerate);
-	delete spc_file_ptr;
+	bool result = ExportLoopSamplesAsWAV(spc_view, base_path, samplerate);
+	spc_view.Reset();
 	return result;
 }
 
 bool Split700::ExportLoopSamplesAsWAV(const std::string & spc_filename, const std::vector<uint8_t> & srcns, int32_t samplerate)
 {
-	SPCFile * spc_file_ptr = SPCFile::Load(spc_filename);
-	if (spc_file_ptr == NULL) {
+	if (!SPCFileView::OpenInto(spc_filename, spc_view)) {
 		m_message = "File open error (possible invalid format)";
 		return false;
 	}
 
-	char base_path_c[PATH_MAX];
-	strcpy(base_path_c, spc_filename.c_str());
-	path_stripext(base_path_c);
-	std::string base_path(base_path_c);
-
+	std::string base_path(get_base_path(spc_filename));
 
-	bool result = ExportLoopSamplesAsWAV(*spc_file_ptr, base_path, srcns, samplerate);
-	delete spc_file_ptr;
+	bool result = ExportLoopSamplesAsWAV(spc_view, base_path, srcns, samplerate);
+	spc_view.Reset();
 	return result;
 }
 
 bool Split700::ExportLoopSamplesAsWAV(const SPCFile & spc_file, const std::string & base_path, int32_t samplerate)
+{
+	return ExportLoopSamplesAsWAV(SPCFileView(spc_file), base_path, samplerate);
+}
+
+bool Split700::ExportLoopSamplesAsWAV(const SPCFile & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, int32_t samplerate)
+{
+	return ExportLoopSamplesAsWAV(SPCFileView(spc_file), base_path, srcns, samplerate);
+}
+
+bool Split700::ExportLoopSamplesAsWAV(const SPCFileView & spc_file, const std::string & base_path, int32_t samplerate)
 {
 	std::vector<uint8_t> srcns(GetSampList(spc_file));
 	return ExportLoopSamplesAsWAV(spc_file, base_path, srcns, samplerate);
 }
 
-bool Split700::ExportLoopSamplesAsWAV(const SPCFile & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, int32_t samplerate)
+bool Split700::ExportLoopSamplesAsWAV(const SPCFileView & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, int32_t samplerate)
 {
-	char pwd[PATH_MAX];
-	getcwd(pwd, PATH_MAX);
+	return ExportSamples(spc_file, base_path, std::string(), srcns, OUTPUT_WAV, false, samplerate);
+}
 
-	char base_dir_c[PATH_MAX];
-	strcpy(base_dir_c, base_path.c_str());
-	path_dirname(base_dir_c);
-	std::string base_dir(base_dir_c);
+bool Split700::ExportSamples(const SPCFileView & spc_file, const std::string & base_path, const std::string & title, const std::vector<uint8_t> & srcns, unsigned int outputs, bool export_loop_point, int32_t samplerate)
+{
+	file_context.Reset();
+	return ExportSamples(spc_file, file_context, base_path, title, srcns, outputs, export_loop_point, samplerate);
+}
+
+bool Split700::ExportSamples(const SPCFileView & spc_file, FileContext & context, const std::string & base_path, const std::string & title, const std::vector<uint8_t> & srcns, unsigned int outputs, bool export_loop_point, int32_t samplerate)
+{
+	std::vector<BRRScanner::Chain> orphans;
+	if (scan_orphans) {
+		orphans = FindOrphanSamples(spc_file, context);
+	}
+
+	if ((outputs & OUTPUT_LIST) != 0) {
+		if (!PrintSPCInfo(spc_file, context, title, srcns)) {
+			return false;
+		}
+		if (scan_orphans) {
+			PrintOrphanList(orphans);
+		}
+	}
+
+	if ((outputs & (OUTPUT_BRR | OUTPUT_WAV)) == 0) {
+		return true;
+	}
 
 	std::vector<uint8_t> dumpable_srcns = QueryDumpableSamples(spc_file, srcns);
 	for (auto itr_srcn = dumpable_srcns.begin(); itr_srcn != dumpable_srcns.end(); ++itr_srcn) {
 		uint8_t srcn = *itr_srcn;
 		const SPCSampDir & sample = spc_file.samples[srcn];
 
-		std::string wav_filename(GetExportFilename(spc_file, base_path, srcn, ".wav"));
+		if ((outputs & OUTPUT_BRR) != 0) {
+			if (!WriteBRRSample(spc_file, base_path, sample, GetExportFilename(spc_file, base_path, srcn, ".brr"), export_loop_point)) {
+				return false;
+			}
+		}
 
-		WavWriter wave(SPCSampDir::decode_brr(&spc_file.ram[sample.start_address], sample.compressed_size()));
-		wave.samplerate = samplerate;
-		wave.bitwidth = 16;
-		wave.channels = 1;
-		if (sample.looped) {
-			wave.SetLoopSample(sample.loop_sample());
+		if ((outputs & OUTPUT_WAV) != 0) {
+			// SRCNs sharing the same sample are decoded once
+			const std::vector<int16_t> & pcm = spc_file.samples.GetPCM(srcn);
+			if (!WriteWAVSample(base_path, sample, GetExportFilename(spc_file, base_path, srcn, ".wav"), pcm.empty() ? NULL : &pcm[0], pcm.size(), samplerate)) {
+				return false;
+			}
 		}
+	}
 
-		chdir(base_dir.c_str());
-		if (!wave.WriteFile(wav_filename)) {
-			chdir(pwd);
-			m_message = wav_filename + ": " + wave.message();
-			return false;
+	// the loop point of an orphan is unknown, so it is exported as a one-shot sample
+	for (auto itr_orphan = orphans.begin(); itr_orphan != orphans.end(); ++itr_orphan) {
+		const BRRScanner::Chain & orphan = *itr_orphan;
+
+		SPCSampDir sample;
+		sample.start_address = (uint16_t)orphan.start;
+		sample.loop_address = (uint16_t)orphan.start;
+		sample.end_address = (uint16_t)orphan.end;
+		sample.valid = true;
+
+		if ((outputs & OUTPUT_BRR) != 0) {
+			if (!WriteBRRSample(spc_file, base_path, sample, GetOrphanFilename(base_path, orphan, ".brr"), export_loop_point)) {
+				return false;
+			}
+		}
+
+		if ((outputs & OUTPUT_WAV) != 0) {
+			std::vector<int16_t> pcm(SPCSampDir::decode_brr(&spc_file.ram[sample.start_address], sample.compressed_size()));
+			if (!WriteWAVSample(base_path, sample, GetOrphanFilename(base_path, orphan, ".wav"), pcm.empty() ? NULL : &pcm[0], pcm.size(), samplerate)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool Split700::ExportSamples(const SPCFileView & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, unsigned int outputs, std::vector<ExportedSample> & exported, bool export_loop_point, int32_t samplerate)
+{
+	exported.clear();
+
+	// the same export, captured in memory instead of the configured sink
+	MemorySink memory_sink;
+	OutputSink * saved_sink = output_sink;
+	output_sink = &memory_sink;
+	bool result = ExportSamples(spc_file, base_path, std::string(), srcns, outputs & (OUTPUT_BRR | OUTPUT_WAV), export_loop_point, samplerate);
+	output_sink = saved_sink;
+	if (!result) {
+		return false;
+	}
+
+	// files not named after a directory entry are orphans, exported as one-shot samples
+	std::map<std::string, uint8_t> srcn_by_filename;
+	std::vector<uint8_t> dumpable_srcns = QueryDumpableSamples(spc_file, srcns);
+	for (auto itr_srcn = dumpable_srcns.begin(); itr_srcn != dumpable_srcns.end(); ++itr_srcn) {
+		srcn_by_filename[GetExportFilename(spc_file, base_path, *itr_srcn, ".brr")] = *itr_srcn;
+		srcn_by_filename[GetExportFilename(spc_file, base_path, *itr_srcn, ".wav")] = *itr_srcn;
+	}
+
+	const std::vector<MemorySink::File> & files = memory_sink.GetFiles();
+	exported.resize(files.size());
+	for (size_t i = 0; i < files.size(); i++) {
+		char filename_c[PATH_MAX];
+		strcpy(filename_c, files[i].path.c_str());
+		path_basename(filename_c);
+
+		ExportedSample & file = exported[i];
+		file.filename = filename_c;
+		file.data = files[i].data;
+		file.srcn = -1;
+		file.looped = false;
+		file.loop_sample = 0;
+
+		auto itr_srcn = srcn_by_filename.find(file.filename);
+		if (itr_srcn != srcn_by_filename.end()) {
+			const SPCSampDir & sample = spc_file.samples[itr_srcn->second];
+			file.srcn = itr_srcn->second;
+			file.looped = sample.looped;
+			file.loop_sample = sample.looped ? sample.loop_sample() : 0;
 		}
-		chdir(pwd);
+	}
+
+	return true;
+}
+
+bool Split700::WriteBRRSample(const SPCFileView & spc_file, const std::string & base_path, const SPCSampDir & sample, const std::string & brr_filename, bool export_loop_point)
+{
+	uint8_t header[2];
+	size_t header_size = 0;
+	if (export_loop_point) {
+		uint16_t loop_point_rel = GetRelativeLoopPoint(sample);
+		header[0] = (uint8_t)(loop_point_rel & 0xff);
+		header[1] = (uint8_t)(loop_point_rel >> 8);
+		header_size = 2;
+	}
+
+	// sample data is also the slice of the input file at 0x100 + start_address
+	OutputChunk chunks[2] = {
+		OutputChunk(header, header_size),
+		OutputChunk(&spc_file.ram[sample.start_address], sample.compressed_size(), spc_file.GetFileDescriptor(), 0x100 + sample.start_address),
+	};
+	if (!output_sink->WriteFile(GetExportDir(base_path), brr_filename, chunks, 2)) {
+		m_message = brr_filename + ": " + output_sink->message();
+		return false;
+	}
+
+	return true;
+}
+
+bool Split700::WriteWAVSample(const std::string & base_path, const SPCSampDir & sample, const std::string & wav_filename, const int16_t * pcm, size_t pcm_count, int32_t samplerate)
+{
+	WavWriter wave(pcm, pcm_count);
+	wave.samplerate = samplerate;
+	wave.bitwidth = 16;
+	wave.channels = 1;
+	if (sample.looped) {
+		wave.SetLoopSample(sample.loop_sample());
+	}
+
+	if (!wave.WriteTo(*output_sink, GetExportDir(base_path), wav_filename)) {
+		m_message = wav_filename + ": " + wave.message();
+		return false;
 	}
 
 	return true;
@@ -250,51 +370,59 @@ bool Split700::ExportLoopSamplesAsWAV(const SPCFile & spc_file, const std::strin
 
 bool Split700::PrintSPCInfo(const std::string & spc_filename)
 {
-	char basename[PATH_MAX];
-	strcpy(basename, spc_filename.c_str());
-	path_basename(basename);
-	std::string spc_basename(basename);
+	std::string spc_basename(get_basename(spc_filename));
 
-	SPCFile * spc_file_ptr = SPCFile::Load(spc_filename);
-	if (spc_file_ptr == NULL) {
+	if (!SPCFileView::OpenInto(spc_filename, spc_view)) {
 		m_message = "File open error (possible invalid format)";
 		return false;
 	}
-	SPCFile & spc_file = *spc_file_ptr;
+	const SPCFileView & spc_file = spc_view;
 
 	std::string title(GetSongTitle(spc_file, spc_basename));
-	bool result = PrintSPCInfo(*spc_file_ptr, title);
-	delete spc_file_ptr;
+	bool result = PrintSPCInfo(spc_view, title);
+	spc_view.Reset();
 	return result;
 }
 
 bool Split700::PrintSPCInfo(const std::string & spc_filename, const std::vector<uint8_t> & srcns)
 {
-	char basename[PATH_MAX];
-	strcpy(basename, spc_filename.c_str());
-	path_basename(basename);
-	std::string spc_basename(basename);
+	std::string spc_basename(get_basename(spc_filename));
 
-	SPCFile * spc_file_ptr = SPCFile::Load(spc_filename);
-	if (spc_file_ptr == NULL) {
+	if (!SPCFileView::OpenInto(spc_filename, spc_view)) {
 		m_message = spc_basename + ": " + "File open error (possible invalid format)";
 		return false;
 	}
-	SPCFile & spc_file = *spc_file_ptr;
+	const SPCFileView & spc_file = spc_view;
 
 	std::string title(GetSongTitle(spc_file, spc_basename));
-	bool result = PrintSPCInfo(*spc_file_ptr, title, srcns);
-	delete spc_file_ptr;
+	bool result = PrintSPCInfo(spc_view, title, srcns);
+	spc_view.Reset();
 	return result;
 }
 
 bool Split700::PrintSPCInfo(const SPCFile & spc_file, const std::string & title)
 {
-	std::vector<uint8_t> srcns(GetSampList(spc_file));
-	return PrintSPCInfo(spc_file, title, srcns);
+	return PrintSPCInfo(SPCFileView(spc_file), title);
 }
 
 bool Split700::PrintSPCInfo(const SPCFile & spc_file, const std::string & title, const std::vector<uint8_t> & srcns)
+{
+	return PrintSPCInfo(SPCFileView(spc_file), title, srcns);
+}
+
+bool Split700::PrintSPCInfo(const SPCFileView & spc_file, const std::string & title)
+{
+	std::vector<uint8_t> srcns(GetSampList(spc_file, file_context));
+	return PrintSPCInfo(spc_file, file_context, title, srcns);
+}
+
+bool Split700::PrintSPCInfo(const SPCFileView & spc_file, const std::string & title, const std::vector<uint8_t> & srcns)
+{
+	file_context.Reset();
+	return PrintSPCInfo(spc_file, file_context, title, srcns);
+}
+
+bool Split700::PrintSPCInfo(const SPCFileView & spc_file, FileContext & context, const std::string & title, const std::vector<uint8_t> & srcns)
 {
 	printf("### %s\n", title.c_str());
 	printf("\n");
@@ -303,11 +431,18 @@ bool Split700::PrintSPCInfo(const SPCFile & spc_file, const std::string & title,
 	printf("* Sample DIR address = $%04x\n", dir);
 	printf("\n");
 
+	if (voice_selection != VOICES_NONE) {
+		PrintVoiceList(spc_file);
+	}
+
 	PrintSampList(spc_file.samples, srcns);
+	if (list_memory_layout) {
+		PrintMemoryLayout(spc_file, context);
+	}
 	return true;
 }
 
-void Split700::PrintSampList(const SPCSampDir samples[], const std::vector<uint8_t> & srcns) const
+void Split700::PrintSampList(const SPCSampDirTable & samples, const std::vector<uint8_t> & srcns) const
 {
 	printf("|SRCN |SA    |LSA   |EA    |Size  |Loop   |\n");
 	printf("|-----|------|------|------|------|-------|\n");
@@ -337,47 +472,185 @@ void Split700::PrintSampList(const SPCSampDir samples[], const std::vector<uint8
 	printf("\n");
 }
 
-std::vector<uint8_t> Split700::GetSampList(const SPCFile & spc_file) const
+void Split700::PrintMemoryLayout(const SPCFileView & spc_file, FileContext & context) const
 {
-	std::vector<uint8_t> srcns;
+	CheckSamples(spc_file, context, spc_file.samp_dir_length);
 
-	for (int samp = 0; samp < spc_file.samp_dir_length; samp++) {
-		uint8_t srcn = (uint8_t)samp;
-		const SPCSampDir & sample = spc_file.samples[srcn];
+	printf("* Memory layout\n");
+	printf("\n");
+	printf("|Start |End   |Size  |Contents |\n");
+	printf("|------|------|------|---------|\n");
 
-		if (!force) {
-			if (!IsValidSample(spc_file, srcn)) {
-				continue;
+	std::vector<SPCMemoryMap::Region> regions(context.memory_map.GetRegions());
+	for (auto itr_region = regions.begin(); itr_region != regions.end(); ++itr_region) {
+		const SPCMemoryMap::Region & region = *itr_region;
+
+		std::string contents;
+		if ((region.owners & SPCMemoryMap::OWNER_DIR) != 0) {
+			contents += "DIR ";
+		}
+		if ((region.owners & SPCMemoryMap::OWNER_ECHO) != 0) {
+			contents += "Echo ";
+		}
+		if ((region.owners & SPCMemoryMap::OWNER_BRR_MASK) != 0) {
+			contents += "BRR";
+			for (int srcn = 0; srcn < context.checked_length; srcn++) {
+				const SPCSampDir & sample = spc_file.samples[srcn];
+				if (context.valid[srcn] && sample.start_address < region.end_address && (uint32_t)sample.start_address + sample.compressed_size() > region.start_address) {
+					char str_srcn[8];
+					sprintf(str_srcn, " $%02x", srcn);
+					contents += str_srcn;
+				}
 			}
+		}
+		if (contents.empty()) {
+			contents = "-";
+		}
+		else if (contents[contents.size() - 1] == ' ') {
+			contents.erase(contents.size() - 1);
+		}
+
+		printf("|$%04X |$%04X |%5u |%s |\n", region.start_address, region.end_address - 1,
+			region.end_address - region.start_address, contents.c_str());
+	}
+	printf("|------|------|------|---------|\n");
+	printf("\n");
+}
+
+void Split700::PrintOrphanList(const std::vector<BRRScanner::Chain> & orphans) const
+{
+	printf("* Orphan BRR chains (not in the sample directory)\n");
+	printf("\n");
+	printf("|SA    |EA    |Size  |Loop   |Score |\n");
+	printf("|------|------|------|-------|------|\n");
+	for (auto itr_orphan = orphans.begin(); itr_orphan != orphans.end(); ++itr_orphan) {
+		const BRRScanner::Chain & orphan = *itr_orphan;
+
+		// the end block tells whether the chain loops, but not where to
+		printf("|$%04X |$%04X |%5u |%6s |%5d |\n", (unsigned int)orphan.start, (unsigned int)orphan.end,
+			(unsigned int)(orphan.end - orphan.start), orphan.looped ? "?" : "-", orphan.score);
+	}
+	printf("|------|------|------|-------|------|\n");
+	printf("\n");
+}
 
-			// alignment check for overlapped samples
-			bool valid_alignment = true;
-			for (auto itr_srcn = srcns.begin(); itr_srcn != srcns.end(); ++itr_srcn) {
-				const SPCSampDir & valid_sample = spc_file.samples[*itr_srcn];
+std::vector<BRRScanner::Chain> Split700::FindOrphanSamples(const SPCFileView & spc_file, FileContext & context) const
+{
+	// every entry that GetSampList would accept without a selection is
+	// known, so an unlisted SRCN is not mistaken for an orphan
+	CheckSamples(spc_file, context, spc_file.samp_dir_length);
+
+	// chains over known samples, DIR, the echo buffer or direct pages (as
+	// in IsValidSample) are not even scored
+	const uint16_t owner_mask = SPCMemoryMap::OWNER_BRR_MASK | SPCMemoryMap::OWNER_ECHO | SPCMemoryMap::OWNER_DIR;
+	std::vector<uint64_t> excluded(0x10000 / 64);
+	context.memory_map.GetOwnerBits(owner_mask, &excluded[0]);
+	for (uint32_t word = 0; word < 0x200 / 64; word++) {
+		excluded[word] = ~(uint64_t)0;
+	}
 
-				// overlapped sample?
-				if ((sample.start_address >= valid_sample.start_address && sample.start_address < valid_sample.end_address) ||
-					(sample.end_address > valid_sample.start_address && sample.end_address <= valid_sample.end_address)) {
+	std::vector<BRRScanner::Chain> candidates;
+	orphan_scanner.Scan(spc_file.ram, 0x10000, candidates, 0, &excluded[0]);
 
-					// alignment should match
-					if ((sample.start_address % SPCSampDir::BRR_CHUNK_SIZE) != (valid_sample.start_address % SPCSampDir::BRR_CHUNK_SIZE)) {
-						valid_alignment = false;
-						break;
-					}
-				}
-			}
+	// the best candidates first, so that a weaker chain of another phase
+	// overlapping them is the one dropped
+	std::stable_sort(candidates.begin(), candidates.end(), [](const BRRScanner::Chain & a, const BRRScanner::Chain & b) {
+		return a.score > b.score;
+	});
 
-			if (!valid_alignment) {
-				continue;
-			}
+	std::vector<BRRScanner::Chain> orphans;
+	for (auto itr_candidate = candidates.begin(); itr_candidate != candidates.end(); ++itr_candidate) {
+		const BRRScanner::Chain & candidate = *itr_candidate;
+
+		// the end address must fit in 16 bits
+		if (candidate.end >= 0x10000) {
+			continue;
 		}
 
-		srcns.push_back(srcn);
+		// only orphans taken so far are left to check against, and they are
+		// added to the excluded bits rather than to the shared context
+		bool taken = false;
+		for (size_t address = candidate.start; address < candidate.end && !taken; address++) {
+			taken = ((excluded[address / 64] >> (address % 64)) & 1) != 0;
+		}
+		if (taken) {
+			continue;
+		}
+
+		for (size_t address = candidate.start; address < candidate.end; address++) {
+			excluded[address / 64] |= (uint64_t)1 << (address % 64);
+		}
+		orphans.push_back(candidate);
+	}
+
+	std::sort(orphans.begin(), orphans.end(), [](const BRRScanner::Chain & a, const BRRScanner::Chain & b) {
+		return a.start < b.start;
+	});
+	return orphans;
+}
+
+void Split700::PrintVoiceList(const SPCFileView & spc_file) const
+{
+	uint8_t kon = spc_file.dsp[0x4c];
+	uint8_t koff = spc_file.dsp[0x5c];
+
+	printf("* Voices\n");
+	printf("\n");
+	printf("|Voice |SRCN |Pitch |ENVX |KON |KOFF |\n");
+	printf("|------|-----|------|-----|----|-----|\n");
+	for (int voice = 0; voice < 8; voice++) {
+		const uint8_t * regs = &spc_file.dsp[voice * 0x10];
+		uint16_t pitch = regs[2] | ((regs[3] & 0x3f) << 8);
+		printf("|%5d |$%02x  |$%04X |$%02x  |%3s |%4s |\n", voice, regs[4], pitch, regs[8],
+			((kon >> voice) & 1) ? "*" : "-", ((koff >> voice) & 1) ? "*" : "-");
+	}
+	printf("|------|-----|------|-----|----|-----|\n");
+	printf("\n");
+}
+
+std::vector<uint8_t> Split700::GetSampList(const SPCFile & spc_file) const
+{
+	return GetSampList(SPCFileView(spc_file));
+}
+
+std::vector<uint8_t> Split700::GetSampList(const SPCFileView & spc_file) const
+{
+	return GetSampList(spc_file, file_context);
+}
+
+std::vector<uint8_t> Split700::GetSampList(const SPCFileView & spc_file, FileContext & context) const
+{
+	context.Reset();
+	if (voice_selection != VOICES_NONE || play_seconds != 0) {
+		return GetVoiceSampList(spc_file, context);
+	}
+
+	// with -n, only the listed entries are evaluated at all
+	std::vector<uint8_t> srcns;
+	for (int samp = 0; samp < spc_file.samp_dir_length; samp++) {
+		uint8_t srcn = (uint8_t)samp;
+		if (sample_filter.IsCandidate(srcn) && IsSelected(spc_file, context, srcn)) {
+			srcns.push_back(srcn);
+		}
 	}
 
 	return srcns;
 }
 
+bool Split700::SetSampleFilter(const std::string & expression)
+{
+	if (expression.empty()) {
+		sample_filter.Clear();
+		return true;
+	}
+
+	if (!sample_filter.Compile(expression)) {
+		m_message = sample_filter.message();
+		return false;
+	}
+	return true;
+}
+
 bool Split700::ParseSampIndexStr(std::vector<uint8_t> & srcns, const std::string & str_samples)
 {
 	srcns.clear();
@@ -440,7 +713,7 @@ bool Split700::ParseSampIndexStr(std::vector<uint8_t> & srcns, const std::string
 	return srcns.size() != 0;
 }
 
-bool Split700::IsValidSample(const SPCFile & spc_file, uint8_t srcn) const
+bool Split700::IsValidSample(const SPCFileView & spc_file, const SPCMemoryMap & memory_map, uint8_t srcn) const
 {
 	const SPCSampDir & sample = spc_file.samples[srcn];
 
@@ -467,12 +740,7 @@ bool Split700::IsValidSample(const SPCFile & spc_file, uint8_t srcn) const
 		return false;
 	}
 
-	uint16_t dir = spc_file.dsp[0x5d] << 8;
-	uint8_t flg = spc_file.dsp[0x6c];
-	uint16_t esa = spc_file.dsp[0x6d] << 8;
-	uint8_t edl = spc_file.dsp[0x7d] & 15;
-	bool echo_enabled = ((flg & 0x20) == 0);
-
+	unsigned int dir = memory_map.GetDir();
 	unsigned int dir_end = dir + ((srcn + 1) * 4);
 	if (dir_end >= 0x10000) {
 		return false;
@@ -499,64 +767,315 @@ bool Split700::IsValidSample(const SPCFile & spc_file, uint8_t srcn) const
 	}
 
 	// samples must not be erased by echo
-	if (echo_enabled) {
-		uint16_t echo_size = (edl != 0) ? (2048 * edl) : 4;
-		uint16_t echo_end = esa + echo_size;
-
-		if (esa < echo_end) {
-			if ((sample.start_address >= esa && sample.start_address < echo_end) ||
-				(sample.end_address > esa && sample.end_address <= echo_end)) {
-				return false;
-			}
-		}
-		else {
-			if (sample.start_address >= esa || sample.start_address < echo_end ||
-				sample.end_address > esa || sample.end_address <= echo_end) {
-				return false;
-			}
-		}
+	if (memory_map.OverlapsEcho(sample)) {
+		return false;
 	}
 
 	return true;
 }
 
-std::vector<uint8_t> Split700::QueryDumpableSamples(const SPCFile & spc_file, const std::vector<uint8_t> & srcns)
+void Split700::CheckSamples(const SPCFileView & spc_file, FileContext & context, int end) const
 {
-	std::vector<uint8_t> dumpable_srcns;
-	for (auto itr_srcn = srcns.begin(); itr_srcn != srcns.end(); ++itr_srcn) {
-		uint8_t srcn = *itr_srcn;
-		const SPCSampDir & sample = spc_file.samples[srcn];
+	// clearing 64K owners is left until something needs them, which a
+	// selection by SRCN alone never does
+	if (!context.map_ready) {
+		context.memory_map.Reset(spc_file);
+		context.map_ready = true;
+	}
 
-		if (sample.start_address > sample.end_address) {
-			continue;
-		}
+	if (end > spc_file.samp_dir_length) {
+		end = spc_file.samp_dir_length;
+	}
+	if (context.checked_length >= end) {
+		return;
+	}
 
-		if (sample.compressed_size() == 0) {
-			continue;
-		}
+	// an entry must agree with the valid entries before it, so they are
+	// checked in directory order
+	for (; context.checked_length < end; context.checked_length++) {
+		uint8_t srcn = (uint8_t)context.checked_length;
+		const SPCSampDir & sample = spc_file.samples[srcn];
 
-		dumpable_srcns.push_back(srcn);
+		context.aligned[srcn] = context.memory_map.IsAligned(sample);
+		context.valid[srcn] = context.aligned[srcn] && IsValidSample(spc_file, context.memory_map, srcn);
+		if (context.valid[srcn]) {
+			context.memory_map.AddSample(sample);
+			context.dir_length = srcn + 1;
+		}
 	}
 
-	return dumpable_srcns;
+	if (context.checked_length == spc_file.samp_dir_length) {
+		context.memory_map.AddDirectory(context.dir_length);
+	}
 }
 
-std::string Split700::GetSongTitle(const SPCFile & spc_file, const std::string & filename) const
+// A SRCN test that fails reads nothing else of the entry, and the
+// directory checks only run for valid and aligned.
+class Split700::SampleFields : public SampleFilter::FieldSource
 {
-	std::string title(filename);
-	if (spc_file.tags.count(SPCFile::XID6ItemId::XID6_SONG_NAME) != 0) {
-		std::string song_name(spc_file.GetStringTag(SPCFile::XID6ItemId::XID6_SONG_NAME));
-		title = song_name + " (" + filename + ")";
+public:
+	SampleFields(const Split700 & app, const SPCFileView & spc_file, FileContext & context, uint8_t srcn) :
+		app(app),
+		spc_file(spc_file),
+		context(context),
+		srcn(srcn)
+	{
 	}
-	return title;
-}
 
-std::string Split700::GetExportFilename(const SPCFile & spc_file, const std::string & basename, uint8_t srcn, const std::string & extension) const
-{
-	char tmp[32];
+	virtual int32_t GetField(SampleFilter::Field field)
+	{
+		switch (field) {
+		case SampleFilter::FIELD_SRCN:
+			return srcn;
+
+		case SampleFilter::FIELD_VALID:
+			app.CheckSamples(spc_file, context, srcn + 1);
+			return context.valid[srcn];
+
+		case SampleFilter::FIELD_ALIGNED:
+			app.CheckSamples(spc_file, context, srcn + 1);
+			return context.aligned[srcn];
+
+		case SampleFilter::FIELD_VOICE:
+		case SampleFilter::FIELD_SOUNDING:
+			for (int voice = 0; voice < 8; voice++) {
+				const uint8_t * regs = &spc_file.dsp[voice * 0x10];
+				if (regs[4] == srcn && (field == SampleFilter::FIELD_VOICE || regs[8] != 0)) {
+					return 1;
+				}
+			}
+			return 0;
 
-	char pwd[PATH_MAX];
-	getcwd(pwd, PATH_MAX);
+		default:
+			break;
+		}
+
+		const SPCSampDir & sample = spc_file.samples[srcn];
+		switch (field) {
+		case SampleFilter::FIELD_START:
+			return sample.start_address;
+
+		case SampleFilter::FIELD_LOOP:
+			return sample.loop_address;
+
+		case SampleFilter::FIELD_END:
+			return sample.end_address;
+
+		case SampleFilter::FIELD_SIZE:
+			return (int32_t)sample.compressed_size();
+
+		case SampleFilter::FIELD_BLOCKS:
+			return (int32_t)(sample.compressed_size() / SPCSampDir::BRR_CHUNK_SIZE);
+
+		case SampleFilter::FIELD_SAMPLES:
+			return sample.sample_count();
+
+		case SampleFilter::FIELD_LOOP_SAMPLE:
+			return sample.loop_sample();
+
+		case SampleFilter::FIELD_LOOPED:
+			return sample.looped;
+
+		case SampleFilter::FIELD_OVERLAPS_ECHO:
+			app.CheckSamples(spc_file, context, 0);
+			return context.memory_map.OverlapsEcho(sample);
+
+		default:
+			return 0;
+		}
+	}
+
+private:
+	const Split700 & app;
+	const SPCFileView & spc_file;
+	FileContext & context;
+	uint8_t srcn;
+};
+
+bool Split700::IsSelected(const SPCFileView & spc_file, FileContext & context, uint8_t srcn) const
+{
+	if (sample_filter.IsEmpty()) {
+		if (force) {
+			return true;
+		}
+
+		CheckSamples(spc_file, context, srcn + 1);
+		return context.valid[srcn];
+	}
+
+	SampleFields fields(*this, spc_file, context, srcn);
+	return sample_filter.Evaluate(fields);
+}
+
+uint16_t Split700::GetRelativeLoopPoint(const SPCSampDir & sample) const
+{
+	if (sample.looped && sample.loop_address >= sample.start_address && sample.loop_address < sample.end_address) {
+		return sample.loop_address - sample.start_address;
+	}
+	else {
+		return sample.end_address - sample.start_address;
+	}
+}
+
+std::vector<uint8_t> Split700::GetVoiceSampList(const SPCFileView & spc_file, FileContext & context) const
+{
+	bool selected[256] = { false };
+	if (voice_selection != VOICES_NONE) {
+		for (int voice = 0; voice < 8; voice++) {
+			selected[spc_file.dsp[voice * 0x10 + 4]] = true;
+		}
+	}
+
+	if (play_seconds != 0) {
+		// the voices sounding at the time of the snapshot, and every SRCN the
+		// driver keys on from there
+		for (int voice = 0; voice < 8; voice++) {
+			if (spc_file.dsp[voice * 0x10 + 8] != 0) {
+				selected[spc_file.dsp[voice * 0x10 + 4]] = true;
+			}
+		}
+
+		emulator.Load(spc_file);
+		emulator.Run((uint64_t)play_seconds * SPCEmulator::CLOCK_RATE);
+		for (int srcn = 0; srcn < 256; srcn++) {
+			if (emulator.IsKeyedOn((uint8_t)srcn)) {
+				selected[srcn] = true;
+			}
+		}
+	}
+
+	// validity comes from the whole directory as in GetSampList, so a
+	// voice's sample must also agree with the valid entries before it
+	std::vector<uint8_t> srcns;
+	for (int samp = 0; samp < spc_file.samp_dir_length; samp++) {
+		uint8_t srcn = (uint8_t)samp;
+		if (selected[srcn] && IsSelected(spc_file, context, srcn)) {
+			srcns.push_back(srcn);
+		}
+	}
+
+	if (voice_selection == VOICES_LINKED) {
+		// the same sample with another loop point, or a chain that a voice's
+		// sample shares blocks with, which the driver may switch to
+		CheckSamples(spc_file, context, spc_file.samp_dir_length);
+
+		std::vector<uint8_t> linked_srcns;
+		for (int samp = 0; samp < spc_file.samp_dir_length; samp++) {
+			uint8_t srcn = (uint8_t)samp;
+			if (selected[srcn] || !context.valid[srcn]) {
+				continue;
+			}
+
+			// blocks are shared when the chains overlap at the same alignment
+			const SPCSampDir & sample = spc_file.samples[srcn];
+			bool linked = false;
+			for (auto itr_srcn = srcns.begin(); itr_srcn != srcns.end() && !linked; ++itr_srcn) {
+				const SPCSampDir & voice_sample = spc_file.samples[*itr_srcn];
+				linked = context.valid[*itr_srcn] &&
+					sample.start_address < voice_sample.end_address && voice_sample.start_address < sample.end_address &&
+					(sample.start_address - voice_sample.start_address) % SPCSampDir::BRR_CHUNK_SIZE == 0;
+			}
+			if (!linked) {
+				continue;
+			}
+
+			if (!IsSelected(spc_file, context, srcn)) {
+				continue;
+			}
+
+			linked_srcns.push_back(srcn);
+		}
+
+		srcns.insert(srcns.end(), linked_srcns.begin(), linked_srcns.end());
+		std::sort(srcns.begin(), srcns.end());
+	}
+
+	return srcns;
+}
+
+int Split700::FindVoice(const SPCFileView & spc_file, uint8_t srcn) const
+{
+	int found_voice = -1;
+	for (int voice = 0; voice < 8; voice++) {
+		const uint8_t * regs = &spc_file.dsp[voice * 0x10];
+		if (regs[4] != srcn) {
+			continue;
+		}
+
+		// ENVX != 0: the voice is sounding at the time of the snapshot
+		if (regs[8] != 0) {
+			return voice;
+		}
+
+		if (found_voice == -1) {
+			found_voice = voice;
+		}
+	}
+	return found_voice;
+}
+
+std::vector<uint8_t> Split700::QueryDumpableSamples(const SPCFileView & spc_file, const std::vector<uint8_t> & srcns)
+{
+	std::vector<uint8_t> dumpable_srcns;
+	for (auto itr_srcn = srcns.begin(); itr_srcn != srcns.end(); ++itr_srcn) {
+		uint8_t srcn = *itr_srcn;
+		const SPCSampDir & sample = spc_file.samples[srcn];
+
+		if (sample.start_address > sample.end_address) {
+			continue;
+		}
+
+		if (sample.compressed_size() == 0) {
+			continue;
+		}
+
+		dumpable_srcns.push_back(srcn);
+	}
+
+	return dumpable_srcns;
+}
+
+std::string Split700::GetExportDir(const std::string & base_path) const
+{
+	if (!output_dir.empty()) {
+		return output_dir;
+	}
+
+	char base_dir_c[PATH_MAX];
+	strcpy(base_dir_c, base_path.c_str());
+	path_dirname(base_dir_c);
+	std::string dir(base_dir_c);
+	if (dir.empty()) {
+		dir = ".";
+	}
+	return dir;
+}
+
+std::string Split700::GetSongTitle(const SPCFileView & spc_file, const std::string & filename) const
+{
+	std::string title(filename);
+	if (spc_file.tags.count(SPCFile::XID6ItemId::XID6_SONG_NAME) != 0) {
+		std::string song_name(spc_file.GetStringTag(SPCFile::XID6ItemId::XID6_SONG_NAME));
+		title = song_name + " (" + filename + ")";
+	}
+	return title;
+}
+
+std::string Split700::GetOrphanFilename(const std::string & basename, const BRRScanner::Chain & orphan, const std::string & extension) const
+{
+	char tmp[32];
+	sprintf(tmp, "_orphan_%04x", (unsigned int)orphan.start);
+
+	std::string out_filename = basename + tmp + extension;
+	char out_basename_c[PATH_MAX];
+	strcpy(out_basename_c, out_filename.c_str());
+	path_basename(out_basename_c);
+	return std::string(out_basename_c);
+}
+
+std::string Split700::GetExportFilename(const SPCFileView & spc_file, const std::string & basename, uint8_t srcn, const std::string & extension) const
+{
+	char tmp[32];
 
 	sprintf(tmp, "%02x", srcn);
 	std::string str_srcn(tmp);
@@ -573,6 +1092,15 @@ std::string Split700::GetExportFilename(const SPCFile & spc_file, const std::str
 		}
 	}
 
+	if (voice_selection != VOICES_NONE) {
+		int voice = FindVoice(spc_file, srcn);
+		if (voice != -1) {
+			const uint8_t * regs = &spc_file.dsp[voice * 0x10];
+			sprintf(tmp, "p%04x", regs[2] | ((regs[3] & 0x3f) << 8));
+			loop_info += (loop_info.empty() ? "" : "-") + std::string(tmp);
+		}
+	}
+
 	std::string out_filename = basename + "_" + str_srcn + (loop_info.empty() ? "" : "-") + loop_info + extension;
 	char out_basename_c[PATH_MAX];
 	strcpy(out_basename_c, out_filename.c_str());
@@ -580,13 +1108,6 @@ std::string Split700::GetExportFilename(const SPCFile & spc_file, const std::str
 	return std::string(out_basename_c);
 }
 
-enum Split700ProcMode
-{
-	SPLIT700_PROC_BRR = 0,
-	SPLIT700_PROC_WAV,
-	SPLIT700_PROC_LIST,
-};
-
 static void usage(const char * progname)
 {
 	printf("%s %s\n", APP_NAME, APP_VER);
@@ -597,7 +1118,7 @@ static void usage(const char * progname)
 	printf("Usage\n");
 	printf("-----\n");
 	printf("\n");
-	printf("Syntax: `%s [options] [spc files]`\n", progname);
+	printf("Syntax: `%s [options] [spc/zip files]`\n", progname);
 	printf("\n");
 
 	printf("### Options\n");
@@ -608,8 +1129,32 @@ static void usage(const char * progname)
 	printf("`-n N`, `--srcn N`\n");
 	printf("  : Specify target sample number. (example: `--srcn \"1, 2, $10-20\"`)\n");
 	printf("\n");
+	printf("`--where EXPR`\n");
+	printf("  : Export only the samples for which the expression holds (example: `--where \"looped && size >= 288 && !overlaps_echo\"`).\n");
+	printf("    Fields: srcn, start, loop, end, size, blocks, samples, loop_sample, looped, valid, aligned, overlaps_echo, voice, sounding.\n");
+	printf("    Operators: `||`, `&&`, `!`, `==`, `!=`, `<`, `<=`, `>`, `>=`, `in [1, $10..$20]`.\n");
+	printf("    It narrows down the samples that pass the default checks (`valid`), or those of `-f` or `-n`.\n");
+	printf("\n");
 	printf("`-l`, `--list`\n");
-	printf("  : Display only voice list, with no file outputs.\n");
+	printf("  : Display voice list (with no file outputs unless `--brr` or `--wav` is also given).\n");
+	printf("\n");
+	printf("`--layout`\n");
+	printf("  : Add a RAM layout (DIR, echo buffer and samples) to the voice list.\n");
+	printf("\n");
+	printf("`--voices`\n");
+	printf("  : Export only the samples of the eight voices' SRCNs, with the voice pitch in the filename (e.g. `_05-p1000`).\n");
+	printf("\n");
+	printf("`--voices-linked`\n");
+	printf("  : Same as `--voices`, plus directory entries that share BRR blocks with those samples.\n");
+	printf("\n");
+	printf("`--play SECONDS`\n");
+	printf("  : Run each SPC ahead for the given emulated time (no sound) and export only the samples keyed on, plus those of the sounding voices. Combines with `--voices`.\n");
+	printf("\n");
+	printf("`--scan-orphans`\n");
+	printf("  : Also list and export plausible BRR chains in RAM that no sample directory entry covers.\n");
+	printf("\n");
+	printf("`--brr`\n");
+	printf("  : Export BRR samples (default). `--list`, `--brr` and `--wav` can be combined.\n");
 	printf("\n");
 	printf("`--wav`\n");
 	printf("  : Convert BRR samples to WAVE files.\n");
@@ -617,6 +1162,33 @@ static void usage(const char * progname)
 	printf("`--pitch HEX`\n");
 	printf("  : Specify sample rate for output WAVE file (0x1000 = 32000 Hz).\n");
 	printf("\n");
+	printf("`-o DIR`, `--output-dir DIR`\n");
+	printf("  : Write output files into the directory instead of next to each input.\n");
+	printf("\n");
+	printf("`--sink TYPE`\n");
+	printf("  : Output destination: `dir` (files, default), `tar` (tar archive to stdout) or `null` (count only).\n");
+	printf("\n");
+	printf("`-r DIR`, `--recursive DIR`\n");
+	printf("  : Process every *.spc file under the directory tree.\n");
+	printf("\n");
+	printf("`--files-from FILE`\n");
+	printf("  : Read NUL-delimited input filenames from the file (`-` for stdin).\n");
+	printf("\n");
+	printf("`--tar FILE`\n");
+	printf("  : Process *.spc members of a tar archive (`-` for stdin) without extracting it.\n");
+	printf("\n");
+	printf("`--sort-inputs`\n");
+	printf("  : Process input files in on-disk order (except for `--list`).\n");
+	printf("\n");
+	printf("`--readahead N`\n");
+	printf("  : Prefetch the next N input files while processing the current one.\n");
+	printf("\n");
+	printf("`--io-uring`\n");
+	printf("  : Read input files through io_uring when available (Linux).\n");
+	printf("\n");
+	printf("`--io-depth N`\n");
+	printf("  : Number of input files kept in flight with `--io-uring` (default: 32).\n");
+	printf("\n");
 	printf("`-L`\n");
 	printf("  : Add loop point info to output filename of the sample.\n");
 	printf("\n");
@@ -628,13 +1200,98 @@ static void usage(const char * progname)
 	printf("\n");
 }
 
+// Maps an archive member name to a path under root_dir (or the working
+// directory), optionally creating its directories so that exported samples
+// are placed as if the archive had been extracted there. Leading slashes
+// are dropped and ".." is rejected.
+static bool get_member_path(const std::string & root_dir, const std::string & member_name, std::string & spc_filename, bool create_dirs)
+{
+	std::vector<std::string> components(split(member_name, '/'));
+
+	spc_filename = root_dir;
+	bool has_name = false;
+	for (size_t i = 0; i < components.size(); i++) {
+		const std::string & component = components[i];
+		if (component.empty() || component == ".") {
+			continue;
+		}
+		if (component == "..") {
+			return false;
+		}
+
+		if (!spc_filename.empty()) {
+			if (create_dirs && !path_isdir(spc_filename.c_str()) && mkdir(spc_filename.c_str(), 0777) != 0) {
+				return false;
+			}
+			spc_filename += PATH_SEPARATOR_STR;
+		}
+		spc_filename += component;
+		has_name = true;
+	}
+	return has_name;
+}
+
+// "srcn in [...]" for a list of SRCNs, with runs folded into ranges
+static std::string get_srcn_filter(std::vector<uint8_t> srcns)
+{
+	std::sort(srcns.begin(), srcns.end());
+
+	std::string filter("srcn in [");
+	char tmp[16];
+	for (size_t i = 0; i < srcns.size(); ) {
+		size_t last = i;
+		while (last + 1 < srcns.size() && srcns[last + 1] == srcns[last] + 1) {
+			last++;
+		}
+
+		if (last == i) {
+			sprintf(tmp, "%s$%02x", (i != 0) ? ", " : "", srcns[i]);
+		}
+		else {
+			sprintf(tmp, "%s$%02x..$%02x", (i != 0) ? ", " : "", srcns[i], srcns[last]);
+		}
+		filter += tmp;
+		i = last + 1;
+	}
+	filter += "]";
+	return filter;
+}
+
+static bool process_spc(Split700 & app, Split700::FileContext & context, unsigned int outputs, const SPCFileView & spc_view, const std::string & spc_filename,
+	bool export_loop_point, int32_t wav_samplerate)
+{
+	std::string base_path(get_base_path(spc_filename));
+
+	// one sample selection feeds every requested output
+	std::string title;
+	if ((outputs & Split700::OUTPUT_LIST) != 0) {
+		title = app.GetSongTitle(spc_view, get_basename(spc_filename));
+	}
+
+	std::vector<uint8_t> srcns(app.GetSampList(spc_view, context));
+	if (!app.ExportSamples(spc_view, context, base_path, title, srcns, outputs, export_loop_point, wav_samplerate)) {
+		fprintf(stderr, "Error: %s: %s\n", spc_filename.c_str(), app.message().c_str());
+		return false;
+	}
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
 	Split700 app;
-	Split700ProcMode mode = SPLIT700_PROC_BRR;
+	unsigned int outputs = 0;
 	bool export_loop_point = false;
 	std::vector<uint8_t> srcns;
+	std::string where;
 	int32_t wav_samplerate = 32000;
+	std::vector<std::string> input_dirs;
+	std::vector<std::string> input_lists;
+	std::vector<std::string> input_tars;
+	bool sort_inputs = false;
+	int readahead_window = 0;
+	bool use_io_uring = false;
+	int io_queue_depth = 32;
+	std::string sink_name("dir");
 
 	long l;
 	char * endptr = NULL;
@@ -658,13 +1315,39 @@ int main(int argc, char *argv[])
 			app.SetForce(true);
 		}
 		else if (strcmp(argv[argi], "-l") == 0 || strcmp(argv[argi], "--list") == 0) {
-			mode = SPLIT700_PROC_LIST;
+			outputs |= Split700::OUTPUT_LIST;
 		}
 		else if (strcmp(argv[argi], "--brr") == 0) {
-			mode = SPLIT700_PROC_BRR;
+			outputs |= Split700::OUTPUT_BRR;
+		}
+		else if (strcmp(argv[argi], "--layout") == 0) {
+			app.SetMemoryLayoutListed(true);
+		}
+		else if (strcmp(argv[argi], "--voices") == 0) {
+			app.SetVoiceSelection(Split700::VOICES_ONLY);
+		}
+		else if (strcmp(argv[argi], "--voices-linked") == 0) {
+			app.SetVoiceSelection(Split700::VOICES_LINKED);
+		}
+		else if (strcmp(argv[argi], "--play") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			l = strtol(argv[argi + 1], &endptr, 10);
+			if (*endptr != '\0' || errno == ERANGE || l < 1 || l > 3600) {
+				fprintf(stderr, "Error: Number format error (play time must be 1-3600 seconds) \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			app.SetPlaySeconds((unsigned int)l);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--scan-orphans") == 0) {
+			app.SetOrphanScanEnabled(true);
 		}
 		else if (strcmp(argv[argi], "--wav") == 0) {
-			mode = SPLIT700_PROC_WAV;
+			outputs |= Split700::OUTPUT_WAV;
 		}
 		else if (strcmp(argv[argi], "--pitch") == 0) {
 			if (argc <= (argi + 1)) {
@@ -696,6 +1379,102 @@ int main(int argc, char *argv[])
 			}
 			argi++;
 		}
+		else if (strcmp(argv[argi], "--where") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			where = argv[argi + 1];
+			argi++;
+		}
+		else if (strcmp(argv[argi], "-r") == 0 || strcmp(argv[argi], "--recursive") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			input_dirs.push_back(argv[argi + 1]);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--files-from") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			input_lists.push_back(argv[argi + 1]);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "-o") == 0 || strcmp(argv[argi], "--output-dir") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			if (!path_isdir(argv[argi + 1])) {
+				fprintf(stderr, "Error: %s: Output directory does not exist\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			app.SetOutputDir(argv[argi + 1]);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--sink") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			sink_name = argv[argi + 1];
+			if (sink_name != "dir" && sink_name != "tar" && sink_name != "null") {
+				fprintf(stderr, "Error: Unknown output sink \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--tar") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			input_tars.push_back(argv[argi + 1]);
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--sort-inputs") == 0) {
+			sort_inputs = true;
+		}
+		else if (strcmp(argv[argi], "--readahead") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			l = strtol(argv[argi + 1], &endptr, 10);
+			if (*endptr != '\0' || errno == ERANGE || l < 0 || l > 4096) {
+				fprintf(stderr, "Error: Number format error (readahead window must be 0-4096) \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			readahead_window = (int)l;
+			argi++;
+		}
+		else if (strcmp(argv[argi], "--io-uring") == 0) {
+			use_io_uring = true;
+		}
+		else if (strcmp(argv[argi], "--io-depth") == 0) {
+			if (argc <= (argi + 1)) {
+				fprintf(stderr, "Error: Too few arguments for \"%s\"\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+
+			l = strtol(argv[argi + 1], &endptr, 10);
+			if (*endptr != '\0' || errno == ERANGE || l < 1 || l > 4096) {
+				fprintf(stderr, "Error: Number format error (queue depth must be 1-4096) \"%s\"\n", argv[argi + 1]);
+				return EXIT_FAILURE;
+			}
+			io_queue_depth = (int)l;
+			argi++;
+		}
 		else if (strcmp(argv[argi], "-L") == 0) {
 			app.SetLoopPointToFileName(true);
 		}
@@ -708,63 +1487,257 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (argc <= argi) {
+	if (argc <= argi && input_dirs.empty() && input_lists.empty() && input_tars.empty()) {
 		fprintf(stderr, "Error: No input files\n");
 		return EXIT_FAILURE;
 	}
 
+	// -f, -n and --where all end up in one expression: the default checks
+	// are the "valid" predicate, which -f and -n (that has never validated
+	// the listed samples) leave out
+	if (!where.empty()) {
+		// compiled alone first, for error messages about the user's own text
+		SampleFilter where_filter;
+		if (!where_filter.Compile(where)) {
+			fprintf(stderr, "Error: \"--where\": %s\n", where_filter.message().c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::string filter;
+	if (!srcns.empty()) {
+		filter = get_srcn_filter(srcns);
+	}
+	else if (!app.IsForce()) {
+		filter = "valid";
+	}
+	if (!where.empty()) {
+		filter += (filter.empty() ? "(" : " && (") + where + ")";
+	}
+	if (!where.empty() || !srcns.empty()) {
+		if (!app.SetSampleFilter(filter)) {
+			fprintf(stderr, "Error: Sample filter: %s\n", app.message().c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (outputs == 0) {
+		outputs = Split700::OUTPUT_BRR;
+	}
+
+	// file outputs on stdout would be mixed with the list
+	bool writes_files = (outputs & (Split700::OUTPUT_BRR | Split700::OUTPUT_WAV)) != 0;
+	if ((outputs & Split700::OUTPUT_LIST) != 0 && writes_files && sink_name == "tar") {
+		fprintf(stderr, "Error: \"--list\" cannot be combined with file outputs to \"--sink tar\"\n");
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<OutputSink> output_sink;
+	if (sink_name == "tar") {
+		output_sink.reset(new TarSink(stdout));
+	}
+	else if (sink_name == "null") {
+		output_sink.reset(new NullSink());
+	}
+	app.SetOutputSink(output_sink.get());
+
+	// member directories are created only when outputs go next to the inputs
+	bool create_member_dirs = writes_files && sink_name == "dir" && app.GetOutputDir().empty();
+
 	int errors = 0;
+	std::vector<std::string> spc_filenames;
+	std::vector<std::string> input_zips;
 	for (; argi < argc; argi++) {
-		std::string spc_filename(argv[argi]);
-		bool result;
+		if (strcasecmp(path_findext(argv[argi]), ".zip") == 0) {
+			input_zips.push_back(argv[argi]);
+		}
+		else {
+			spc_filenames.push_back(argv[argi]);
+		}
+	}
+
+	for (auto itr_list = input_lists.begin(); itr_list != input_lists.end(); ++itr_list) {
+		if (!DirWalker::ReadFileList(*itr_list, spc_filenames)) {
+			fprintf(stderr, "Error: %s: Unable to read file list\n", itr_list->c_str());
+			errors++;
+		}
+	}
+
+	DirWalker walker;
+	walker.SetExtension(".spc");
+	for (auto itr_dir = input_dirs.begin(); itr_dir != input_dirs.end(); ++itr_dir) {
+		if (!walker.Walk(*itr_dir, spc_filenames)) {
+			fprintf(stderr, "Error: %s\n", walker.message().c_str());
+			errors++;
+		}
+		else if (!walker.message().empty()) {
+			fprintf(stderr, "Warning: %s\n", walker.message().c_str());
+		}
+	}
+
+	// output files do not depend on the processing order, but the list does
+	InputScheduler scheduler;
+	scheduler.SetReadaheadWindow(readahead_window);
+	if (sort_inputs && (outputs & Split700::OUTPUT_LIST) == 0) {
+		scheduler.SortByLocation(spc_filenames);
+	}
 
-		switch (mode) {
-		case SPLIT700_PROC_BRR:
-			if (srcns.size() != 0) {
-				result = app.ExportLoopSamples(spc_filename, srcns, export_loop_point);
+	UringReader uring_reader;
+	if (use_io_uring) {
+		uring_reader.SetMaxFileSize(MAX_SPC_FILE_SIZE);
+		if (uring_reader.Start(spc_filenames, io_queue_depth)) {
+			fprintf(stderr, "Info: Input backend: io_uring (queue depth %d)\n", io_queue_depth);
+		}
+		else {
+			fprintf(stderr, "Info: Input backend: mmap (io_uring is not available)\n");
+		}
+	}
+
+	// one context serves every input, whichever reader it comes from
+	std::unique_ptr<Split700::FileContext> file_context(new Split700::FileContext());
+	SPCFileView spc_view;
+	std::vector<uint8_t> spc_data;
+	for (size_t spc_index = 0; spc_index < spc_filenames.size(); spc_index++) {
+		const std::string & spc_filename = spc_filenames[spc_index];
+
+		bool opened;
+		if (uring_reader.IsRunning()) {
+			size_t read_index;
+			int read_error;
+			if (!uring_reader.Next(read_index, spc_data, read_error)) {
+				read_error = EIO;
 			}
-			else {
-				result = app.ExportLoopSamples(spc_filename, export_loop_point);
+
+			if (read_error == EFBIG) {
+				fprintf(stderr, "Error: %s: File too large\n", spc_filename.c_str());
+				errors++;
+				continue;
+			}
+			opened = read_error == 0 &&
+				SPCFileView::OpenInto(spc_data.empty() ? NULL : &spc_data[0], spc_data.size(), spc_view);
+		}
+		else {
+			scheduler.Prefetch(spc_filenames, spc_index);
+			opened = SPCFileView::OpenInto(spc_filename, spc_view);
+		}
+
+		if (!opened) {
+			fprintf(stderr, "Error: %s: File open error (possible invalid format)\n", spc_filename.c_str());
+			errors++;
+			continue;
+		}
+
+		if (!process_spc(app, *file_context, outputs, spc_view, spc_filename, export_loop_point, wav_samplerate)) {
+			errors++;
+		}
+
+		spc_view.Reset();
+	}
+
+	// archive members are parsed straight from the stream, named after their path in the archive
+	TarReader tar_reader;
+	tar_reader.SetExtension(".spc");
+	tar_reader.SetMaxFileSize(MAX_SPC_FILE_SIZE);
+	for (auto itr_tar = input_tars.begin(); itr_tar != input_tars.end(); ++itr_tar) {
+		if (!tar_reader.Open(*itr_tar)) {
+			fprintf(stderr, "Error: %s: %s\n", itr_tar->c_str(), tar_reader.message().c_str());
+			errors++;
+			continue;
+		}
+
+		std::string member_name;
+		std::string tar_error;
+		std::string spc_filename;
+		while (tar_reader.Next(member_name, spc_data, tar_error)) {
+			if (!tar_error.empty()) {
+				fprintf(stderr, "Error: %s: %s: %s\n", itr_tar->c_str(), member_name.c_str(), tar_error.c_str());
+				errors++;
+				continue;
 			}
 
-			if (!result) {
-				fprintf(stderr, "Error: %s: %s\n", spc_filename.c_str(), app.message().c_str());
+			if (!SPCFileView::OpenInto(spc_data.empty() ? NULL : &spc_data[0], spc_data.size(), spc_view)) {
+				fprintf(stderr, "Error: %s: File open error (possible invalid format)\n", member_name.c_str());
 				errors++;
+				continue;
 			}
-			break;
 
-		case SPLIT700_PROC_LIST:
-			if (srcns.size() != 0) {
-				result = app.PrintSPCInfo(spc_filename, srcns);
+			if (!get_member_path("", member_name, spc_filename, create_member_dirs)) {
+				fprintf(stderr, "Error: %s: Unable to create output path\n", member_name.c_str());
+				errors++;
+				spc_view.Reset();
+				continue;
 			}
-			else {
-				result = app.PrintSPCInfo(spc_filename);
+
+			if (!process_spc(app, *file_context, outputs, spc_view, spc_filename, export_loop_point, wav_samplerate)) {
+				errors++;
 			}
 
-			if (!result) {
-				fprintf(stderr, "Error: %s: %s\n", spc_filename.c_str(), app.message().c_str());
+			spc_view.Reset();
+		}
+
+		if (!tar_reader.message().empty()) {
+			fprintf(stderr, "Error: %s: %s\n", itr_tar->c_str(), tar_reader.message().c_str());
+			errors++;
+		}
+		tar_reader.Close();
+	}
+
+	// members of each ZIP archive are exported under a directory named after the archive
+	ZipReader zip_reader;
+	zip_reader.SetExtension(".spc");
+	zip_reader.SetMaxFileSize(MAX_SPC_FILE_SIZE);
+	for (auto itr_zip = input_zips.begin(); itr_zip != input_zips.end(); ++itr_zip) {
+		if (!zip_reader.Open(*itr_zip)) {
+			fprintf(stderr, "Error: %s: %s\n", itr_zip->c_str(), zip_reader.message().c_str());
+			errors++;
+			continue;
+		}
+
+		std::string archive_root(get_base_path(*itr_zip));
+		const std::vector<ZipReader::Entry> & entries = zip_reader.GetEntries();
+
+		size_t member_index;
+		std::string zip_error;
+		std::string spc_filename;
+		zip_reader.Start();
+		while (zip_reader.Next(member_index, spc_data, zip_error)) {
+			const std::string & member_name = entries[member_index].name;
+			if (!zip_error.empty()) {
+				fprintf(stderr, "Error: %s: %s: %s\n", itr_zip->c_str(), member_name.c_str(), zip_error.c_str());
 				errors++;
+				continue;
 			}
-			break;
 
-		case SPLIT700_PROC_WAV:
-			if (srcns.size() != 0) {
-				result = app.ExportLoopSamplesAsWAV(spc_filename, srcns, wav_samplerate);
+			if (!get_member_path(archive_root, member_name, spc_filename, create_member_dirs)) {
+				fprintf(stderr, "Error: %s: %s: Unable to create output path\n", itr_zip->c_str(), member_name.c_str());
+				errors++;
+				continue;
 			}
-			else {
-				result = app.ExportLoopSamplesAsWAV(spc_filename, wav_samplerate);
+
+			if (!SPCFileView::OpenInto(spc_data.empty() ? NULL : &spc_data[0], spc_data.size(), spc_view)) {
+				fprintf(stderr, "Error: %s: File open error (possible invalid format)\n", spc_filename.c_str());
+				errors++;
+				continue;
 			}
 
-			if (!result) {
-				fprintf(stderr, "Error: %s: %s\n", spc_filename.c_str(), app.message().c_str());
+			if (!process_spc(app, *file_context, outputs, spc_view, spc_filename, export_loop_point, wav_samplerate)) {
 				errors++;
 			}
-			break;
 
-		default:
-			fprintf(stderr, "Error: Unsupported processing mode\n");
+			spc_view.Reset();
+		}
+		zip_reader.Close();
+	}
+
+	if (writes_files) {
+		OutputSink & sink = app.GetOutputSink();
+		if (!sink.Finish()) {
+			fprintf(stderr, "Error: %s\n", sink.message().c_str());
 			errors++;
-			break;
+		}
+
+		if (sink_name == "null") {
+			fprintf(stderr, "Info: %llu files, %llu bytes\n", (unsigned long long)sink.GetFileCount(), (unsigned long long)sink.GetByteCount());
 		}
 	}
 
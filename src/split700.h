@@ -10,6 +10,12 @@
 #endif
 
 #include "SPCFile.h"
+#include "SPCFileView.h"
+#include "OutputSink.h"
+#include "SPCMemoryMap.h"
+#include "BRRScanner.h"
+#include "SPCEmulator.h"
+#include "SampleFilter.h"
 
 class Split700
 {
@@ -17,6 +23,52 @@ public:
 	Split700();
 	virtual ~Split700();
 
+	// outputs of ExportSamples, combinable
+	enum OutputType {
+		OUTPUT_LIST = 1,
+		OUTPUT_BRR = 2,
+		OUTPUT_WAV = 4,
+	};
+
+	// samples picked by GetSampList
+	enum VoiceSelection {
+		VOICES_NONE = 0,    // every directory entry
+		VOICES_ONLY,        // the SRCNs of the eight voices
+		VOICES_LINKED,      // and entries sharing BRR blocks with them
+	};
+
+	// What the default checks make of one file's sample directory: whether
+	// each entry is valid, and the RAM held by DIR, the echo buffer and the
+	// valid entries. GetSampList resets it for its file and the outputs of
+	// the same file read it on; entries are checked in directory order,
+	// only as far as something asks.
+	struct FileContext {
+		SPCMemoryMap memory_map;    // set up by the first CheckSamples
+		bool map_ready;
+		int checked_length;         // entries checked so far
+		int dir_length;             // up to the last valid entry
+		bool valid[256];            // passes the checks that --force skips
+		bool aligned[256];          // no conflict with the valid entries before it
+
+		FileContext() : map_ready(false), checked_length(0), dir_length(0) {
+		}
+
+		inline void Reset(void) {
+			map_ready = false;
+			checked_length = 0;
+			dir_length = 0;
+		}
+	};
+
+	// a file written by ExportSamples, kept in memory
+	struct ExportedSample {
+		int srcn;               // -1 for an orphan chain
+		std::string filename;
+		std::vector<uint8_t> data;
+		bool looped;
+		int32_t loop_sample;
+	};
+
 	inline bool IsLoopPointToFileName(void) const {
 		return loop_point_to_filename;
 	}
@@ -33,6 +85,69 @@ public:
 		this->force = force;
 	}
 
+	inline const SampleFilter & GetSampleFilter(void) const {
+		return sample_filter;
+	}
+
+	// GetSampList keeps the directory entries for which the expression
+	// holds, in place of the force flag; an empty string clears it
+	bool SetSampleFilter(const std::string & expression);
+
+	inline bool IsMemoryLayoutListed(void) const {
+		return list_memory_layout;
+	}
+
+	// adds a RAM layout report to PrintSPCInfo
+	inline void SetMemoryLayoutListed(bool list_memory_layout) {
+		this->list_memory_layout = list_memory_layout;
+	}
+
+	inline VoiceSelection GetVoiceSelection(void) const {
+		return voice_selection;
+	}
+
+	// also lists the voices, and tags exported filenames with the voice pitch
+	inline void SetVoiceSelection(VoiceSelection voice_selection) {
+		this->voice_selection = voice_selection;
+	}
+
+	inline unsigned int GetPlaySeconds(void) const {
+		return play_seconds;
+	}
+
+	// non-zero makes GetSampList run each snapshot ahead for that long and
+	// pick the samples keyed on, along with the voices sounding at the start
+	inline void SetPlaySeconds(unsigned int play_seconds) {
+		this->play_seconds = play_seconds;
+	}
+
+	inline bool IsOrphanScanEnabled(void) const {
+		return scan_orphans;
+	}
+
+	// makes ExportSamples also list and export BRR chains outside the directory
+	inline void SetOrphanScanEnabled(bool scan_orphans) {
+		this->scan_orphans = scan_orphans;
+	}
+
+	inline const std::string & GetOutputDir(void) const {
+		return output_dir;
+	}
+
+	// empty string writes every output next to its input file
+	inline void SetOutputDir(const std::string & output_dir) {
+		this->output_dir = output_dir;
+	}
+
+	inline OutputSink & GetOutputSink(void) const {
+		return *output_sink;
+	}
+
+	// NULL restores the default sink, which writes files to the filesystem
+	inline void SetOutputSink(OutputSink * output_sink) {
+		this->output_sink = (output_sink != NULL) ? output_sink : &directory_sink;
+	}
+
 	inline const std::string& message(void) const {
 		return m_message;
 	}
@@ -41,30 +156,88 @@ public:
 	bool ExportLoopSamples(const std::string & spc_filename, const std::vector<uint8_t> & srcns, bool export_loop_point = false);
 	bool ExportLoopSamples(const SPCFile & spc_file, const std::string & base_path, bool export_loop_point = false);
 	bool ExportLoopSamples(const SPCFile & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, bool export_loop_point = false);
+	bool ExportLoopSamples(const SPCFileView & spc_file, const std::string & base_path, bool export_loop_point = false);
+	bool ExportLoopSamples(const SPCFileView & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, bool export_loop_point = false);
 	bool ExportLoopSamplesAsWAV(const std::string & spc_filename, int32_t samplerate = 32000);
 	bool ExportLoopSamplesAsWAV(const std::string & spc_filename, const std::vector<uint8_t> & srcns, int32_t samplerate = 32000);
 	bool ExportLoopSamplesAsWAV(const SPCFile & spc_file, const std::string & base_path, int32_t samplerate = 32000);
 	bool ExportLoopSamplesAsWAV(const SPCFile & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, int32_t samplerate = 32000);
+	bool ExportLoopSamplesAsWAV(const SPCFileView & spc_file, const std::string & base_path, int32_t samplerate = 32000);
+	bool ExportLoopSamplesAsWAV(const SPCFileView & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, int32_t samplerate = 32000);
+	bool ExportSamples(const SPCFileView & spc_file, const std::string & base_path, const std::string & title, const std::vector<uint8_t> & srcns, unsigned int outputs, bool export_loop_point = false, int32_t samplerate = 32000);
+	// returns the BRR and WAV files in memory, with their loop points, instead
+	// of writing them to the output sink
+	bool ExportSamples(const SPCFileView & spc_file, const std::string & base_path, const std::vector<uint8_t> & srcns, unsigned int outputs, std::vector<ExportedSample> & exported, bool export_loop_point = false, int32_t samplerate = 32000);
+	// context: from GetSampList of the same file
+	bool ExportSamples(const SPCFileView & spc_file, FileContext & context, const std::string & base_path, const std::string & title, const std::vector<uint8_t> & srcns, unsigned int outputs, bool export_loop_point = false, int32_t samplerate = 32000);
 	bool PrintSPCInfo(const std::string & spc_filename);
 	bool PrintSPCInfo(const std::string & spc_filename, const std::vector<uint8_t> & srcns);
 	bool PrintSPCInfo(const SPCFile & spc_file, const std::string & title);
 	bool PrintSPCInfo(const SPCFile & spc_file, const std::string & title, const std::vector<uint8_t> & srcns);
-	void PrintSampList(const SPCSampDir samples[], const std::vector<uint8_t> & srcns) const;
+	bool PrintSPCInfo(const SPCFileView & spc_file, const std::string & title);
+	bool PrintSPCInfo(const SPCFileView & spc_file, const std::string & title, const std::vector<uint8_t> & srcns);
+	bool PrintSPCInfo(const SPCFileView & spc_file, FileContext & context, const std::string & title, const std::vector<uint8_t> & srcns);
+	void PrintSampList(const SPCSampDirTable & samples, const std::vector<uint8_t> & srcns) const;
+	// DIR, the echo buffer and the valid entries, whichever SRCNs are selected
+	void PrintMemoryLayout(const SPCFileView & spc_file, FileContext & context) const;
+	void PrintOrphanList(const std::vector<BRRScanner::Chain> & orphans) const;
+	void PrintVoiceList(const SPCFileView & spc_file) const;
+	// plausible BRR chains in RAM that no valid directory entry overlaps,
+	// whichever SRCNs are selected
+	std::vector<BRRScanner::Chain> FindOrphanSamples(const SPCFileView & spc_file, FileContext & context) const;
 	std::vector<uint8_t> GetSampList(const SPCFile & spc_file) const;
+	std::vector<uint8_t> GetSampList(const SPCFileView & spc_file) const;
+	// context is reset for spc_file, and keeps what the checks found
+	std::vector<uint8_t> GetSampList(const SPCFileView & spc_file, FileContext & context) const;
+	std::string GetSongTitle(const SPCFileView & spc_file, const std::string & filename) const;
 
 	static bool ParseSampIndexStr(std::vector<uint8_t> & srcns, const std::string & str_samples);
 
 protected:
 	bool loop_point_to_filename;
 	bool force;
+	bool list_memory_layout;
+	bool scan_orphans;
+	VoiceSelection voice_selection;
+	unsigned int play_seconds;
+	std::string output_dir;
 
 	std::string m_message;
 
+	// reused across input files to avoid per-file allocations
+	SPCFileView spc_view;
+
 private:
-	bool IsValidSample(const SPCFile & spc_file, uint8_t srcn) const;
-	std::vector<uint8_t> QueryDumpableSamples(const SPCFile & spc_file, const std::vector<uint8_t> & srcns);
-	std::string GetSongTitle(const SPCFile & spc_file, const std::string & filename) const;
-	std::string GetExportFilename(const SPCFile & spc_file, const std::string & basename, uint8_t srcn, const std::string & extension) const;
+	// the fields of one entry for sample_filter
+	class SampleFields;
+
+	// memory_map must be Reset for spc_file; alignment is left to CheckSamples
+	bool IsValidSample(const SPCFileView & spc_file, const SPCMemoryMap & memory_map, uint8_t srcn) const;
+	// checks the entries before end that the context has not checked yet;
+	// end 0 only sets up the memory map
+	void CheckSamples(const SPCFileView & spc_file, FileContext & context, int end) const;
+	// the sample filter, or the force flag without one
+	bool IsSelected(const SPCFileView & spc_file, FileContext & context, uint8_t srcn) const;
+	uint16_t GetRelativeLoopPoint(const SPCSampDir & sample) const;
+	// the samples of the voices and/or those keyed on while playing ahead
+	std::vector<uint8_t> GetVoiceSampList(const SPCFileView & spc_file, FileContext & context) const;
+	// the voice playing srcn, preferring one with a non-zero envelope, or -1
+	int FindVoice(const SPCFileView & spc_file, uint8_t srcn) const;
+	std::vector<uint8_t> QueryDumpableSamples(const SPCFileView & spc_file, const std::vector<uint8_t> & srcns);
+	std::string GetExportFilename(const SPCFileView & spc_file, const std::string & basename, uint8_t srcn, const std::string & extension) const;
+	std::string GetOrphanFilename(const std::string & basename, const BRRScanner::Chain & orphan, const std::string & extension) const;
+	std::string GetExportDir(const std::string & base_path) const;
+	bool WriteBRRSample(const SPCFileView & spc_file, const std::string & base_path, const SPCSampDir & sample, const std::string & brr_filename, bool export_loop_point);
+	bool WriteWAVSample(const std::string & base_path, const SPCSampDir & sample, const std::string & wav_filename, const int16_t * pcm, size_t pcm_count, int32_t samplerate);
+
+	DirectorySink directory_sink;
+	OutputSink * output_sink;
+
+	// context of the overloads that do not take one, reused across input files
+	mutable FileContext file_context;
+	BRRScanner orphan_scanner;
+	mutable SPCEmulator emulator;
+	SampleFilter sample_filter;
 };
 
 #endif
@@ -0,0 +1,105 @@
+// Checks the SIMD block header scan against the scalar reference:
+// parse_brr (directly and through BRRChainMemo) against parse_brr_scalar for
+// random start addresses, and scan_brr_headers against a byte-by-byte scan,
+// over pseudo-random RAM images with sparse to dense end flags.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "SPCSampDir.h"
+
+#define NUM_IMAGES  200
+#define NUM_STARTS  512
+
+static uint32_t rand_state = 0x2545f491;
+
+static uint32_t next_rand(void)
+{
+	// xorshift32, so that every run checks the same images
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static void fill_image(uint8_t * ram, uint32_t end_rate)
+{
+	for (int address = 0; address < 0x10000; address++) {
+		uint8_t value = (uint8_t)next_rand();
+		// most bytes lose the end flag, so chains run past the 64-block windows
+		if ((next_rand() % end_rate) != 0) {
+			value &= ~1;
+		}
+		ram[address] = value;
+	}
+}
+
+static bool same_result(const SPCSampDir & lhs, const SPCSampDir & rhs)
+{
+	return lhs.end_address == rhs.end_address && lhs.looped == rhs.looped && lhs.valid == rhs.valid;
+}
+
+static int check_image(const uint8_t * ram)
+{
+	int mismatches = 0;
+
+	BRRChainMemo memo;
+	for (int i = 0; i < NUM_STARTS; i++) {
+		uint32_t start_address = next_rand() % 0x10000;
+
+		SPCSampDir reference;
+		reference.start_address = (uint16_t)start_address;
+		reference.loop_address = (uint16_t)(start_address + (next_rand() % 4) * SPCSampDir::BRR_CHUNK_SIZE);
+		reference.parse_brr_scalar(&ram[start_address], 0x10000 - start_address);
+
+		SPCSampDir sample(reference);
+		sample.parse_brr(&ram[start_address], 0x10000 - start_address);
+		if (!same_result(sample, reference)) {
+			mismatches++;
+		}
+
+		// the memo takes over chains walked from earlier start addresses
+		SPCSampDir memo_sample(reference);
+		memo_sample.parse_brr(ram, memo);
+		if (!same_result(memo_sample, reference)) {
+			mismatches++;
+		}
+	}
+
+	std::vector<uint64_t> end_bits(0x10000 / 64);
+	std::vector<uint64_t> range_bits(0x10000 / 64);
+	SPCSampDir::scan_brr_headers(ram, 0x10000, &end_bits[0], &range_bits[0]);
+	for (uint32_t address = 0; address < 0x10000; address++) {
+		uint64_t bit = (uint64_t)1 << (address % 64);
+		bool end_flag = (ram[address] & 1) != 0;
+		bool range_error = (ram[address] >> 4) > 0x0c;
+		if (((end_bits[address / 64] & bit) != 0) != end_flag ||
+			((range_bits[address / 64] & bit) != 0) != range_error) {
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+int main(void)
+{
+	static const uint32_t end_rates[] = { 2, 16, 128, 1024 };
+
+	std::vector<uint8_t> ram(0x10000);
+	int mismatches = 0;
+	for (int image = 0; image < NUM_IMAGES; image++) {
+		fill_image(&ram[0], end_rates[image % (sizeof(end_rates) / sizeof(end_rates[0]))]);
+		mismatches += check_image(&ram[0]);
+	}
+
+	if (mismatches != 0) {
+		fprintf(stderr, "Error: %d mismatches against the scalar reference\n", mismatches);
+		return 1;
+	}
+
+	printf("%d RAM images match the scalar reference\n", NUM_IMAGES);
+	return 0;
+}